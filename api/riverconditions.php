@@ -3,11 +3,21 @@
 	Captures river conditions from waterreporter.org and waterservices.usgs.gov
 	Data is retreived in JSON, parsed, reduced, and repacked as JSON into a managable size.
 	JSON data is cached as files where the file name is the station id.
+	
+	Clients sending "Accept: application/msgpack" receive the same data encoded
+	as MessagePack (compact binary), otherwise JSON is returned.
+	Clients sending "Accept-Encoding: gzip" receive a gzip body compressed with
+	a 4 KB window so the firmware can inflate it with a small fixed buffer.
 
 	Sep. 5th 2020
 	
+	Delta mode: every response carries station.version (hash of the data).
+	Clients passing back the version they hold receive {"unchanged": true}
+	when nothing changed, or {"delta": true} with only the changed data objects.
+	
 	Usage example where hostingwebsite is your website: 
 		www.hostingwebsite.com/api/riverconditions?stationId=02029000,8863
+		www.hostingwebsite.com/api/riverconditions?stationId=02029000,8863&version=1a2b3c4d
 */
  
 
@@ -25,6 +35,9 @@ else
 
 $stationIdArray = explode(",", $stationIdRaw);
 
+// Version of the data held by the client (delta mode).
+$clientVersion = isset($_GET['version']) ? preg_replace('/[^0-9a-f]/', '', $_GET['version']) : "";
+
 
 
 // Set station IDs for API endpoints.
@@ -68,9 +81,9 @@ else
     $wrJson = null;
 }
 
-$jsonComplete = parse_station_json($usgsJson, $wrJson);
+$array = parse_station_json($usgsJson, $wrJson);
 
-echo $jsonComplete;
+respond(build_delta($stationIdArray, $array, $clientVersion));
 
 // End script.
 
@@ -302,19 +315,198 @@ function parse_station_json($usgsJson, $wrJson)
         )
     );
 
-    return json_encode($array, JSON_PRETTY_PRINT);
+    return $array;
+}
+
+// Versions the station data and reduces the response to what changed
+// since the version held by the client.
+function build_delta($stationIdArray, $array, $clientVersion)
+{
+    $version = sprintf('%08x', crc32(json_encode($array['data']) . $array['station']['locationStatus']));
+    $array['station']['version'] = $version;
+
+    // Keep recent versions of the data so deltas can be computed.
+    $versionDir = 'cache' . DIRECTORY_SEPARATOR . 'versions';
+    if (!is_dir($versionDir))
+    {
+        mkdir($versionDir, 0755, true);
+    }
+
+    sort($stationIdArray);
+    $versionKey = implode('-', $stationIdArray);
+    $versionFile = $versionDir . DIRECTORY_SEPARATOR . $versionKey . '-' . $version . '.json';
+
+    if (!file_exists($versionFile))
+    {
+        file_put_contents($versionFile, json_encode($array['data']));
+
+        // Bound the number of kept versions per station set.
+        $versionFiles = glob($versionDir . DIRECTORY_SEPARATOR . $versionKey . '-*.json');
+        usort($versionFiles, function ($a, $b) { return filemtime($b) - filemtime($a); });
+        foreach (array_slice($versionFiles, 8) as $oldFile)
+        {
+            unlink($oldFile);
+        }
+    }
+
+    if ($clientVersion == "")
+    {
+        return $array;
+    }
+
+    if ($clientVersion == $version)
+    {
+        return array('unchanged' => true, 'version' => $version);
+    }
+
+    $clientFile = $versionDir . DIRECTORY_SEPARATOR . $versionKey . '-' . $clientVersion . '.json';
+
+    if (!file_exists($clientFile))
+    {
+        return $array;
+    }
+
+    $clientData = json_decode(file_get_contents($clientFile), true);
+    $changedData = array();
+
+    foreach ($array['data'] as $name => $measurement)
+    {
+        if (!isset($clientData[$name]) || $clientData[$name] != $measurement)
+        {
+            $changedData[$name] = $measurement;
+        }
+    }
+
+    return array('delta' => true, 'station' => $array['station'], 'data' => $changedData);
 }
 
 function error($msg)
 {
-    $repsonse = new \stdClass();
-    $repsonse->error = true;
-	$repsonse->date = date(DateTime::ISO8601);
-    $repsonse->message = $msg;
-    echo json_encode($repsonse);
+    $repsonse = array(
+        'error' => true,
+        'date' => date(DateTime::ISO8601),
+        'message' => $msg
+    );
+    respond($repsonse);
     exit();
 }
 
+// Sends the response array encoded per the client's Accept header.
+// Content-Length is always set so the firmware can parse directly from the socket.
+function respond($array)
+{
+    $accept = isset($_SERVER['HTTP_ACCEPT']) ? $_SERVER['HTTP_ACCEPT'] : "";
+
+    if (strpos($accept, 'application/msgpack') !== false)
+    {
+        $body = msgpack_encode($array);
+        header('Content-Type: application/msgpack');
+    }
+    else
+    {
+        $body = json_encode($array, JSON_PRETTY_PRINT);
+        header('Content-Type: application/json');
+    }
+
+    // Compress here (not by the web server) to control the deflate window size.
+    $acceptEncoding = isset($_SERVER['HTTP_ACCEPT_ENCODING']) ? $_SERVER['HTTP_ACCEPT_ENCODING'] : "";
+
+    if (strpos($acceptEncoding, 'gzip') !== false && function_exists('deflate_init'))
+    {
+        ini_set('zlib.output_compression', 'Off');
+        if (function_exists('apache_setenv'))
+        {
+            apache_setenv('no-gzip', '1');
+        }
+
+        $context = deflate_init(ZLIB_ENCODING_GZIP, array('level' => 9, 'window' => 12));
+        $body = deflate_add($context, $body, ZLIB_FINISH);
+        header('Content-Encoding: gzip');
+    }
+
+    header('Vary: Accept, Accept-Encoding');
+    header('Content-Length: ' . strlen($body));
+    echo $body;
+}
+
+// Minimal MessagePack encoder (https://github.com/msgpack/msgpack/blob/master/spec.md)
+// covering the types produced by parse_station_json() and error().
+function msgpack_encode($value)
+{
+    if (is_null($value))
+    {
+        return "\xc0";
+    }
+
+    if (is_bool($value))
+    {
+        return $value ? "\xc3" : "\xc2";
+    }
+
+    if (is_int($value))
+    {
+        if ($value >= 0 && $value < 128)
+        {
+            return chr($value);
+        }
+        if ($value < 0 && $value >= -32)
+        {
+            return chr($value & 0xff);
+        }
+        if ($value >= -2147483648 && $value <= 2147483647)
+        {
+            return "\xd2" . pack('N', $value);
+        }
+        return "\xd3" . pack('J', $value);
+    }
+
+    if (is_float($value))
+    {
+        return "\xcb" . pack('E', $value);
+    }
+
+    if (is_array($value))
+    {
+        $count = count($value);
+        $isList = $count == 0 || array_keys($value) === range(0, $count - 1);
+
+        if ($isList)
+        {
+            $out = $count < 16 ? chr(0x90 | $count) : ($count < 65536 ? "\xdc" . pack('n', $count) : "\xdd" . pack('N', $count));
+            foreach ($value as $item)
+            {
+                $out .= msgpack_encode($item);
+            }
+        }
+        else
+        {
+            $out = $count < 16 ? chr(0x80 | $count) : ($count < 65536 ? "\xde" . pack('n', $count) : "\xdf" . pack('N', $count));
+            foreach ($value as $key => $item)
+            {
+                $out .= msgpack_encode(strval($key)) . msgpack_encode($item);
+            }
+        }
+        return $out;
+    }
+
+    $string = strval($value);
+    $length = strlen($string);
+
+    if ($length < 32)
+    {
+        return chr(0xa0 | $length) . $string;
+    }
+    if ($length < 256)
+    {
+        return "\xd9" . chr($length) . $string;
+    }
+    if ($length < 65536)
+    {
+        return "\xda" . pack('n', $length) . $string;
+    }
+    return "\xdb" . pack('N', $length) . $string;
+}
+
 /**
  * Get a web file (HTML, XHTML, XML, image, etc.) from a URL.  Return an
  * array containing the HTTP server response header fields and content.
@@ -0,0 +1,180 @@
+// buttonEvents
+//
+// Interrupt driven push buttons.
+// Pin edges are debounced in the interrupt handler and queued as
+// timestamped press/release events, so presses made while loop() is
+// blocked are not lost and press durations do not depend on loop cadence.
+//
+// Buttons are active low. The queue is single consumer: read events
+// from the loop task only.
+//
+// Version 1.0
+
+#ifndef BUTTON_EVENTS_H
+#define BUTTON_EVENTS_H
+
+#include <Arduino.h>
+#include <atomic>
+
+#ifdef ARDUINO_ARCH_ESP32
+#include "soc/gpio_struct.h"
+#endif
+
+struct ButtonEvent
+{
+  uint8_t button; // Index of the button (order given to begin()).
+  bool pressed;   // True on press, false on release.
+  uint32_t time;  // millis() of the edge.
+};
+
+class ButtonEvents
+{
+
+private:
+  static const int maxButtons = 4;
+  static const size_t queueSize = 32; // Power of two.
+
+  struct Input
+  {
+    ButtonEvents *owner;
+    uint8_t index;
+    uint8_t pin;
+    volatile bool pressed;       // Debounced state.
+    volatile uint32_t lastEdge;  // Time of the last accepted edge.
+  };
+
+  Input _inputs[maxButtons];
+  int _numButtons = 0;
+  uint32_t _debounce = 25;
+
+  ButtonEvent _queue[queueSize];
+  std::atomic<uint32_t> _head{0}; // Advanced by the interrupt handler.
+  std::atomic<uint32_t> _tail{0}; // Advanced by read().
+  std::atomic<uint32_t> _dropped{0};
+  portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+  TaskHandle_t _wakeTask = nullptr;
+
+  // Accepts an edge when the level differs from the debounced state
+  // and the previous edge is older than the debounce time.
+  void IRAM_ATTR edge(Input &input, bool pressed, uint32_t time)
+  {
+    if (pressed == input.pressed || time - input.lastEdge < _debounce)
+    {
+      return;
+    }
+
+    input.pressed = pressed;
+    input.lastEdge = time;
+
+    uint32_t head = _head.load(std::memory_order_relaxed);
+
+    if (head - _tail.load(std::memory_order_acquire) == queueSize)
+    {
+      _dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+
+    _queue[head & (queueSize - 1)] = {input.index, pressed, time};
+    _head.store(head + 1, std::memory_order_release);
+  }
+
+  // Pin level read from the GPIO registers, the handler runs from IRAM
+  // (e.g. during flash writes) where digitalRead() is not available.
+  static inline bool IRAM_ATTR isLow(uint8_t pin)
+  {
+#ifdef ARDUINO_ARCH_ESP32
+    return pin < 32 ? !((GPIO.in >> pin) & 1) : !((GPIO.in1.val >> (pin - 32)) & 1);
+#else
+    return digitalRead(pin) == LOW;
+#endif
+  }
+
+  static void IRAM_ATTR isr(void *arg)
+  {
+    Input *input = (Input *)arg;
+    ButtonEvents *owner = input->owner;
+
+    portENTER_CRITICAL_ISR(&owner->_mux);
+    owner->edge(*input, isLow(input->pin), millis());
+    portEXIT_CRITICAL_ISR(&owner->_mux);
+
+    if (owner->_wakeTask != nullptr)
+    {
+      BaseType_t woken = pdFALSE;
+      vTaskNotifyGiveFromISR(owner->_wakeTask, &woken);
+      if (woken)
+      {
+        portYIELD_FROM_ISR();
+      }
+    }
+  }
+
+public:
+  // Buttons need external pull-ups (pins 34 to 39 have none).
+  void begin(const uint8_t *pins, int count, uint32_t debounce = 25)
+  {
+    _numButtons = count < maxButtons ? count : maxButtons;
+    _debounce = debounce;
+
+    for (int i = 0; i < _numButtons; i++)
+    {
+      Input &input = _inputs[i];
+      input.owner = this;
+      input.index = i;
+      input.pin = pins[i];
+
+      pinMode(input.pin, INPUT);
+      input.pressed = digitalRead(input.pin) == LOW;
+      input.lastEdge = millis();
+
+      attachInterruptArg(input.pin, isr, &input, CHANGE);
+    }
+  }
+
+  // Notifies a task on every pin edge, e.g. to end an idle wait.
+  inline void setWakeTask(TaskHandle_t task)
+  {
+    _wakeTask = task;
+  }
+
+  // Catches up with edges ignored while debouncing (e.g. a release shorter
+  // than the debounce time), so the debounced state follows the pin.
+  void poll()
+  {
+    for (int i = 0; i < _numButtons; i++)
+    {
+      Input &input = _inputs[i];
+
+      portENTER_CRITICAL(&_mux);
+      edge(input, isLow(input.pin), millis());
+      portEXIT_CRITICAL(&_mux);
+    }
+  }
+
+  // Takes the oldest event from the queue, false when empty.
+  bool read(ButtonEvent &event)
+  {
+    uint32_t tail = _tail.load(std::memory_order_relaxed);
+
+    if (tail == _head.load(std::memory_order_acquire))
+    {
+      return false;
+    }
+
+    event = _queue[tail & (queueSize - 1)];
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  inline bool isPressed(int button)
+  {
+    return _inputs[button].pressed;
+  }
+
+  inline uint32_t dropped()
+  {
+    return _dropped.load(std::memory_order_relaxed);
+  }
+};
+
+#endif
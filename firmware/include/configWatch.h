@@ -0,0 +1,135 @@
+// configWatch
+//
+// Detects changed configuration files, e.g. on an SD card edited on a PC,
+// without reading them at every check: check() compares each file's size
+// and last write time, the contents are hashed only when one of them
+// differs, so a file written with the same contents is not reported.
+//
+// A change is reported once, the new contents are then the reference
+// whether or not the caller could apply them. A removed file is not
+// reported, the configuration read before stays in use.
+//
+// Version 1.0
+
+#ifndef CONFIG_WATCH_H
+#define CONFIG_WATCH_H
+
+#include <Arduino.h>
+#include <FS.h>
+
+class ConfigWatch
+{
+
+private:
+  static const int maxFiles = 4;
+
+  struct Watched
+  {
+    const char *path;
+    size_t size;
+    time_t lastWrite;
+    uint32_t hash; // FNV-1a of the contents, 0 when the file is missing.
+  };
+
+  fs::FS *_fs = nullptr;
+  Watched _files[maxFiles];
+  int _numFiles = 0;
+  uint32_t _hashes = 0;
+
+  // FNV-1a of a file's contents.
+  static uint32_t hash(File &file)
+  {
+    uint8_t buf[256];
+    uint32_t h = 2166136261u;
+
+    for (size_t length; (length = file.read(buf, sizeof(buf))) > 0;)
+    {
+      for (size_t i = 0; i < length; i++)
+      {
+        h = (h ^ buf[i]) * 16777619u;
+      }
+    }
+    return h;
+  }
+
+  // Updates the reference of a file, true when its contents changed.
+  bool update(Watched &watched)
+  {
+    File file = _fs->open(watched.path);
+
+    if (!file || file.isDirectory())
+    {
+      return false;
+    }
+
+    size_t size = file.size();
+    time_t lastWrite = file.getLastWrite();
+
+    if (size == watched.size && lastWrite == watched.lastWrite && watched.hash != 0)
+    {
+      file.close();
+      return false;
+    }
+
+    uint32_t h = hash(file);
+    file.close();
+    _hashes++;
+
+    bool changed = watched.hash != 0 && h != watched.hash;
+    bool appeared = watched.hash == 0;
+
+    watched.size = size;
+    watched.lastWrite = lastWrite;
+    watched.hash = h;
+    return changed || appeared;
+  }
+
+public:
+  void begin(fs::FS &fs)
+  {
+    _fs = &fs;
+    _numFiles = 0;
+  }
+
+  // Watches a file from its current contents (up to maxFiles files),
+  // returns its index or -1.
+  int watch(const char *path)
+  {
+    if (_numFiles == maxFiles)
+    {
+      return -1;
+    }
+
+    Watched &watched = _files[_numFiles];
+    watched = {path, 0, 0, 0};
+    update(watched);
+    return _numFiles++;
+  }
+
+  // Index of the next file changed since it was last reported, -1 when
+  // none changed.
+  int check()
+  {
+    for (int i = 0; i < _numFiles; i++)
+    {
+      if (update(_files[i]))
+      {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  inline const char *path(int index)
+  {
+    return _files[index].path;
+  }
+
+  // Files read for hashing, a measure of the cost of checks.
+  inline uint32_t hashes()
+  {
+    return _hashes;
+  }
+};
+
+#endif
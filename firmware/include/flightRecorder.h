@@ -0,0 +1,306 @@
+// flightRecorder
+//
+// Loop stall watchdog with a flight recorder in RTC memory, which keeps
+// its contents over resets other than power on.
+//
+// The loop task marks the stage it runs with stage(). A stage that took
+// longer than slowMillis is recorded when it ends, a monitor task records
+// a stage still running after stallMillis, and the task watchdog resets
+// the ESP32 when loop() stops feeding it. The stage running at a reset is
+// recorded with the next boot, so the reset is attributed to a stage.
+//
+// Records are a ring of the last `capacity` boot, stage and event
+// records over all boots since power on, printed as text by print().
+//
+// Version 1.0
+
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <Arduino.h>
+
+#ifdef ARDUINO_ARCH_ESP32
+#include "esp_system.h"
+#include "esp_task_wdt.h"
+#endif
+
+enum FlightRecordType : uint8_t
+{
+  FlightBoot,    // value: reset reason, stage: running at the reset.
+  FlightSlow,    // value: stage duration in ms.
+  FlightStall,   // value: ms the stage had run when the monitor saw it.
+  FlightFatal,   // FatalError(), message kept separately.
+  FlightEvent,   // value: event code given by the caller.
+  numFlightRecordTypes
+};
+
+struct FlightRecord
+{
+  uint32_t time;  // millis() since that boot.
+  uint16_t value; // Saturated at 65535.
+  FlightRecordType type;
+  uint8_t stage;
+};
+
+// Storage in RTC memory, declare with RTC_NOINIT_ATTR.
+struct FlightLog
+{
+  static const uint16_t capacity = 256;
+
+  uint32_t magic;
+  uint32_t boots;
+  uint16_t next;  // Index of the next record.
+  uint16_t count; // Valid records.
+  volatile uint8_t stage;
+  volatile uint32_t stageStart;
+  char fatal[64]; // Message of the last fatal error.
+  FlightRecord records[capacity];
+};
+
+class FlightRecorder
+{
+
+private:
+  static const uint32_t magic = 0x31524652; // "RFR1"
+
+  FlightLog &_log;
+  const char *const *_stageNames = nullptr;
+  int _numStages = 0;
+  uint8_t _idleStage = 0;
+  uint32_t _slowMillis = 1000;
+  uint32_t _stallMillis = 5000;
+  uint8_t _resetReason = 0;
+  uint8_t _resetStage = 0;
+  bool _recovered = false; // Log kept from before the reset.
+  bool _watching = false;
+  uint32_t _stalls = 0;
+  portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+
+  void append(FlightRecordType type, uint8_t stage, uint32_t value)
+  {
+    portENTER_CRITICAL(&_mux);
+    FlightRecord &record = _log.records[_log.next];
+    record.time = millis();
+    record.value = value < 65535 ? value : 65535;
+    record.type = type;
+    record.stage = stage;
+    _log.next = (_log.next + 1) % FlightLog::capacity;
+    if (_log.count < FlightLog::capacity)
+    {
+      _log.count++;
+    }
+    portEXIT_CRITICAL(&_mux);
+  }
+
+  // Records a stage once when it runs past the stall threshold.
+  static void monitor(void *parameter)
+  {
+    FlightRecorder *recorder = (FlightRecorder *)parameter;
+    uint32_t reported = 0;
+
+    while (1)
+    {
+      vTaskDelay(pdMS_TO_TICKS(1000));
+
+      FlightLog &log = recorder->_log;
+      uint8_t stage = log.stage;
+      uint32_t start = log.stageStart;
+      uint32_t running = millis() - start;
+
+      if (stage != recorder->_idleStage && running >= recorder->_stallMillis && start != reported)
+      {
+        reported = start;
+        recorder->_stalls++;
+        recorder->append(FlightStall, stage, running);
+      }
+    }
+  }
+
+public:
+  FlightRecorder(FlightLog &log) : _log(log)
+  {
+  }
+
+  // Keeps the records from before a reset unless the log is not valid
+  // (power on) and records the boot. The idle stage is never a stall.
+  void begin(const char *const *stageNames, int numStages, uint8_t idleStage, uint8_t firstStage, uint32_t slowMillis = 1000, uint32_t stallMillis = 5000)
+  {
+    _stageNames = stageNames;
+    _numStages = numStages;
+    _idleStage = idleStage;
+    _slowMillis = slowMillis;
+    _stallMillis = stallMillis;
+
+#ifdef SIMULATOR
+    _resetReason = ESP_RST_POWERON;
+#else
+    _resetReason = esp_reset_reason();
+#endif
+
+    _recovered = _resetReason != ESP_RST_POWERON && _log.magic == magic && _log.next < FlightLog::capacity && _log.count <= FlightLog::capacity && _log.stage < numStages;
+    if (!_recovered)
+    {
+      memset(&_log, 0, sizeof(_log));
+      _log.magic = magic;
+    }
+
+    _resetStage = _log.stage;
+    _log.boots++;
+    append(FlightBoot, _resetStage, _resetReason);
+
+    _log.stage = firstStage;
+    _log.stageStart = millis();
+  }
+
+  // Starts the monitor task on core 0 and subscribes the calling task to
+  // the task watchdog, which resets the ESP32 after timeoutSeconds
+  // without feed().
+  void watch(uint32_t timeoutSeconds)
+  {
+    xTaskCreatePinnedToCore(monitor, "stall", 2048, this, 1, nullptr, 0);
+
+#ifdef SIMULATOR
+    (void)timeoutSeconds;
+#else
+    esp_task_wdt_init(timeoutSeconds, true);
+    esp_task_wdt_add(nullptr);
+#endif
+    _watching = true;
+  }
+
+  inline void feed()
+  {
+#ifndef SIMULATOR
+    if (_watching)
+    {
+      esp_task_wdt_reset();
+    }
+#endif
+  }
+
+  // Ends the running stage and starts the next one.
+  void stage(uint8_t next)
+  {
+    uint32_t now = millis();
+    uint32_t elapsed = now - _log.stageStart;
+
+    if (_log.stage != _idleStage && elapsed >= _slowMillis)
+    {
+      append(FlightSlow, _log.stage, elapsed);
+    }
+
+    _log.stage = next;
+    _log.stageStart = now;
+  }
+
+  void fatal(const char *message)
+  {
+    strncpy(_log.fatal, message, sizeof(_log.fatal) - 1);
+    _log.fatal[sizeof(_log.fatal) - 1] = '\0';
+    append(FlightFatal, _log.stage, 0);
+  }
+
+  inline void event(uint16_t code)
+  {
+    append(FlightEvent, _log.stage, code);
+  }
+
+  // Short name of an esp_reset_reason_t value.
+  static const char *resetName(uint8_t reason)
+  {
+    static const char *const names[] = {"unknown", "power on", "external", "software", "panic", "interrupt WDT", "task WDT", "WDT", "deep sleep", "brownout", "SDIO"};
+    return reason < sizeof(names) / sizeof(names[0]) ? names[reason] : "unknown";
+  }
+
+  const char *stageName(uint8_t stage)
+  {
+    return stage < _numStages ? _stageNames[stage] : "?";
+  }
+
+  static const char *typeName(FlightRecordType type)
+  {
+    static const char *const names[numFlightRecordTypes] = {"boot", "slow", "stall", "fatal", "event"};
+    return names[type % numFlightRecordTypes];
+  }
+
+  // Prints the records oldest first, one per line, from boot fromBoot on
+  // (boots are numbered since power on).
+  void print(Print &out, const char *const *eventNames = nullptr, int numEvents = 0, uint32_t fromBoot = 0)
+  {
+    uint32_t boot = _log.boots;
+
+    // Numbered from the current boot back.
+    for (int i = 0; i < _log.count; i++)
+    {
+      boot -= _log.records[(_log.next + FlightLog::capacity - _log.count + i) % FlightLog::capacity].type == FlightBoot;
+    }
+
+    for (int i = 0; i < _log.count; i++)
+    {
+      const FlightRecord &record = _log.records[(_log.next + FlightLog::capacity - _log.count + i) % FlightLog::capacity];
+      boot += record.type == FlightBoot;
+
+      if (boot < fromBoot)
+      {
+        continue;
+      }
+
+      out.printf("%u %10lu %-5s %-14s ", (unsigned int)boot, (unsigned long)record.time, typeName(record.type), stageName(record.stage));
+
+      switch (record.type)
+      {
+      case FlightBoot:
+        out.printf("%s reset\n", resetName(record.value));
+        break;
+      case FlightFatal:
+        out.printf("%s\n", _log.fatal);
+        break;
+      case FlightEvent:
+        out.printf("%s\n", record.value < numEvents ? eventNames[record.value] : "?");
+        break;
+      default:
+        out.printf("%u ms\n", record.value);
+        break;
+      }
+    }
+  }
+
+  // The n-th newest record (0 is the newest), nullptr past the oldest.
+  const FlightRecord *newest(int n)
+  {
+    if (n < 0 || n >= _log.count)
+    {
+      return nullptr;
+    }
+    return &_log.records[(_log.next + FlightLog::capacity - 1 - n) % FlightLog::capacity];
+  }
+
+  // Reason of the last reset, and the stage running then when the log was kept.
+  inline uint8_t resetReason()
+  {
+    return _resetReason;
+  }
+
+  inline bool recovered()
+  {
+    return _recovered;
+  }
+
+  inline uint8_t resetStage()
+  {
+    return _resetStage;
+  }
+
+  inline uint32_t boots()
+  {
+    return _log.boots;
+  }
+
+  // Stalls recorded since boot.
+  inline uint32_t stalls()
+  {
+    return _stalls;
+  }
+};
+
+#endif
@@ -0,0 +1,277 @@
+// historyLog
+//
+// Append-only ring log of fixed size measurement samples stored in a file.
+// Sector 0 holds the header (capacity, next write slot, sample count),
+// samples follow in 512 byte sectors of 16 samples each.
+//
+// Appends are O(1) and collected in a sector buffer which is written as a
+// whole sector when full or on flush(), reading the last N samples takes
+// a single seek. Oldest samples are overwritten once capacity is reached.
+//
+// Version 1.0
+
+#ifndef HISTORY_LOG_H
+#define HISTORY_LOG_H
+
+#include <Arduino.h>
+#include <FS.h>
+
+struct HistorySample
+{
+  uint32_t time;     // UTC epoch seconds.
+  float streamFlow;  // ft3/s, NAN when not available.
+  float gaugeHeight; // ft, NAN when not available.
+  float waterTempC;  // C, NAN when not available.
+  float eColi;       // col/samp., NAN when not available.
+  uint8_t status;    // Location status code (0: N.A., 1: Fair, 2: Caution, 3: Danger).
+  uint8_t reserved[11];
+};
+
+class HistoryLog
+{
+
+private:
+  static const uint32_t magic = 0x31485352; // "RSH1"
+  static const size_t sectorSize = 512;
+  static const size_t samplesPerSector = sectorSize / sizeof(HistorySample);
+
+  struct Header
+  {
+    uint32_t magic;
+    uint16_t sampleSize;
+    uint16_t reserved;
+    uint32_t capacity; // Samples, multiple of samplesPerSector.
+    uint32_t head;     // Next slot written.
+    uint32_t count;    // Valid samples.
+  };
+
+  fs::FS *_fs = nullptr;
+  String _path;
+  uint32_t _capacity = 0;
+  Header _header;
+  bool _loaded = false;
+  HistorySample *_sector = nullptr; // Sector being filled, allocated on demand.
+  bool _sectorLoaded = false;
+  bool _dirty = false;
+  uint32_t _lastTime = 0; // Time of the newest sample, once read.
+  bool _lastTimeKnown = false;
+
+  inline size_t sectorOffset(uint32_t slot)
+  {
+    return sectorSize + (slot / samplesPerSector) * sectorSize;
+  }
+
+  // Reads the header, creates the file when missing or incompatible.
+  bool load()
+  {
+    if (_loaded)
+    {
+      return true;
+    }
+
+    File file = _fs->open(_path.c_str(), FILE_READ);
+
+    if (file && file.read((uint8_t *)&_header, sizeof(Header)) == sizeof(Header) &&
+        _header.magic == magic && _header.sampleSize == sizeof(HistorySample) && _header.capacity == _capacity &&
+        _header.head < _capacity && _header.count <= _capacity)
+    {
+      file.close();
+      _loaded = true;
+      return true;
+    }
+
+    if (file)
+    {
+      file.close();
+    }
+
+    memset(&_header, 0, sizeof(Header));
+    _header.magic = magic;
+    _header.sampleSize = sizeof(HistorySample);
+    _header.capacity = _capacity;
+
+    file = _fs->open(_path.c_str(), FILE_WRITE);
+    if (!file)
+    {
+      return false;
+    }
+
+    _loaded = writeHeader(file);
+    file.close();
+    return _loaded;
+  }
+
+  bool writeHeader(File &file)
+  {
+    uint8_t sector[sectorSize] = {0};
+    memcpy(sector, &_header, sizeof(Header));
+    return file.seek(0) && file.write(sector, sectorSize) == sectorSize;
+  }
+
+public:
+  // Capacity in samples, rounded up to whole sectors.
+  inline void begin(fs::FS &fs, const String &path, uint32_t capacity)
+  {
+    _fs = &fs;
+    _path = path;
+    _capacity = (capacity + samplesPerSector - 1) / samplesPerSector * samplesPerSector;
+    _loaded = false;
+    _lastTimeKnown = false;
+  }
+
+  inline uint32_t count()
+  {
+    return load() ? _header.count : 0;
+  }
+
+  bool append(const HistorySample &sample)
+  {
+    if (!load())
+    {
+      return false;
+    }
+
+    uint32_t index = _header.head % samplesPerSector;
+
+    if (_sector == nullptr)
+    {
+      _sector = (HistorySample *)malloc(sectorSize);
+      _sectorLoaded = false;
+      if (_sector == nullptr)
+      {
+        return false;
+      }
+    }
+
+    if (!_sectorLoaded)
+    {
+      memset(_sector, 0, sectorSize);
+
+      // Keep samples already stored in the sector: the start of a partially
+      // written sector, or older samples once the ring has wrapped.
+      if (index > 0 || _header.count == _capacity)
+      {
+        File file = _fs->open(_path.c_str(), FILE_READ);
+        if (file && file.seek(sectorOffset(_header.head)))
+        {
+          file.read((uint8_t *)_sector, sectorSize);
+        }
+        if (file)
+        {
+          file.close();
+        }
+      }
+      _sectorLoaded = true;
+    }
+
+    _sector[index] = sample;
+    _lastTime = sample.time;
+    _lastTimeKnown = true;
+    _header.head = (_header.head + 1) % _capacity;
+    _header.count = min(_header.count + 1, _capacity);
+    _dirty = true;
+
+    if (index == samplesPerSector - 1)
+    {
+      return flush();
+    }
+    return true;
+  }
+
+  // Writes the sector being filled and the header.
+  // Release frees the sector buffer until the next append.
+  bool flush(bool release = false)
+  {
+    bool ok = true;
+
+    if (_dirty)
+    {
+      File file = _fs->open(_path.c_str(), "r+");
+
+      // The sector holding the last written sample.
+      uint32_t last = (_header.head + _capacity - 1) % _capacity;
+
+      ok = file && file.seek(sectorOffset(last)) &&
+           file.write((const uint8_t *)_sector, sectorSize) == sectorSize &&
+           writeHeader(file);
+
+      if (file)
+      {
+        file.close();
+      }
+
+      if (ok)
+      {
+        _dirty = false;
+
+        // Sector complete, the next append starts a new one.
+        if (_header.head % samplesPerSector == 0)
+        {
+          _sectorLoaded = false;
+        }
+      }
+    }
+
+    if (release && !_dirty)
+    {
+      free(_sector);
+      _sector = nullptr;
+      _sectorLoaded = false;
+    }
+
+    return ok;
+  }
+
+  // Time of the newest sample, 0 when empty. Read once, then tracked.
+  uint32_t lastTime()
+  {
+    if (!_lastTimeKnown)
+    {
+      HistorySample sample;
+      _lastTime = readLast(&sample, 1) == 1 ? sample.time : 0;
+      _lastTimeKnown = true;
+    }
+    return _lastTime;
+  }
+
+  // Reads the newest samples (oldest first), returns the number read.
+  size_t readLast(HistorySample *samples, size_t n)
+  {
+    if (!load() || !flush())
+    {
+      return 0;
+    }
+
+    n = min(n, (size_t)_header.count);
+    if (n == 0)
+    {
+      return 0;
+    }
+
+    uint32_t start = (_header.head + _capacity - n) % _capacity;
+    size_t first = min(n, (size_t)(_capacity - start));
+
+    File file = _fs->open(_path.c_str(), FILE_READ);
+    if (!file)
+    {
+      return 0;
+    }
+
+    size_t read = 0;
+    if (file.seek(sectorSize + start * sizeof(HistorySample)))
+    {
+      read = file.read((uint8_t *)samples, first * sizeof(HistorySample)) / sizeof(HistorySample);
+    }
+
+    // Wrapped around the end of the ring.
+    if (read == first && n > first && file.seek(sectorSize))
+    {
+      read += file.read((uint8_t *)(samples + first), (n - first) * sizeof(HistorySample)) / sizeof(HistorySample);
+    }
+
+    file.close();
+    return read;
+  }
+};
+
+#endif
@@ -0,0 +1,223 @@
+// httpBodyStream
+//
+// Reads an HTTP response body straight from the client socket,
+// bounded by Content-Length or decoded from chunked transfer encoding.
+// Allows parsers to consume the body without buffering it.
+//
+// Version 1.0
+
+#ifndef HTTP_BODY_STREAM_H
+#define HTTP_BODY_STREAM_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+
+class HttpBodyStream : public Stream
+{
+
+private:
+  WiFiClient *_client;
+  int _remaining;      // Bytes left in body (or current chunk), -1 when unknown.
+  bool _chunked;
+  bool _end = false;
+  bool _lastChunk = false; // The zero size chunk was read.
+  size_t _bytesRead = 0;
+
+  // Waits for the next byte from the socket, -1 on timeout or closed connection.
+  int waitRead()
+  {
+    unsigned long start = millis();
+
+    do
+    {
+      int c = _client->read();
+      if (c >= 0)
+      {
+        return c;
+      }
+      if (!_client->connected() && _client->available() == 0)
+      {
+        return -1;
+      }
+      delay(1);
+    } while (millis() - start < _timeout);
+
+    return -1;
+  }
+
+  static int hexDigit(int c)
+  {
+    return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+  }
+
+  // Parses the next chunk size line, returns false on the last (zero) chunk.
+  bool nextChunk()
+  {
+    int size = 0;
+    int digit;
+    int c;
+
+    // Skip the CRLF ending the previous chunk.
+    while ((c = waitRead()) == '\r' || c == '\n')
+    {
+    }
+
+    while ((digit = hexDigit(c)) >= 0)
+    {
+      size = size * 16 + digit;
+      c = waitRead();
+    }
+
+    // Ignore chunk extensions up to the end of the line.
+    while (c >= 0 && c != '\n')
+    {
+      c = waitRead();
+    }
+
+    _remaining = size;
+    _lastChunk = c >= 0 && size == 0;
+
+    if (c < 0 || size == 0)
+    {
+      _end = true;
+      return false;
+    }
+    return true;
+  }
+
+public:
+  // Content length as reported by HTTPClient::getSize() (-1 when not known).
+  HttpBodyStream(WiFiClient *client, int contentLength, bool chunked)
+  {
+    _client = client;
+    _chunked = chunked;
+    _remaining = chunked ? 0 : contentLength;
+    _end = client == nullptr || (!chunked && contentLength == 0);
+  }
+
+  inline size_t bytesRead()
+  {
+    return _bytesRead;
+  }
+
+  // Reads what is left of the body (up to limit bytes) and the chunked
+  // trailer, true when the whole response was consumed so the connection
+  // can be reused for the next request.
+  bool finish(size_t limit = 1024)
+  {
+    while (!_end && limit-- > 0 && read() >= 0)
+    {
+    }
+
+    if (!_end || (!_chunked && _remaining != 0))
+    {
+      return false;
+    }
+
+    if (!_chunked)
+    {
+      return true;
+    }
+
+    if (!_lastChunk)
+    {
+      return false;
+    }
+
+    // Trailer lines end with an empty line.
+    int lineLength = 0;
+    int c;
+    while ((c = waitRead()) >= 0)
+    {
+      if (c == '\n')
+      {
+        if (lineLength == 0)
+        {
+          return true;
+        }
+        lineLength = 0;
+      }
+      else if (c != '\r')
+      {
+        lineLength++;
+      }
+    }
+    return false;
+  }
+
+  int available() override
+  {
+    if (_end)
+    {
+      return 0;
+    }
+
+    int socketBytes = _client->available();
+    return _remaining > 0 && socketBytes > _remaining ? _remaining : socketBytes;
+  }
+
+  int read() override
+  {
+    if (_end)
+    {
+      return -1;
+    }
+
+    if (_chunked && _remaining == 0 && !nextChunk())
+    {
+      return -1;
+    }
+
+    int c = waitRead();
+
+    if (c < 0)
+    {
+      _end = true;
+      return -1;
+    }
+
+    _bytesRead++;
+
+    if (_remaining > 0 && --_remaining == 0 && !_chunked)
+    {
+      _end = true;
+    }
+
+    return c;
+  }
+
+  int peek() override
+  {
+    if (_end || (_chunked && _remaining == 0 && !nextChunk()))
+    {
+      return -1;
+    }
+    return _client->peek();
+  }
+
+  // Returns immediately at the end of the body instead of waiting for the timeout.
+  size_t readBytes(char *buffer, size_t length) override
+  {
+    size_t count = 0;
+
+    while (count < length)
+    {
+      int c = read();
+      if (c < 0)
+      {
+        break;
+      }
+      buffer[count++] = (char)c;
+    }
+
+    return count;
+  }
+  using Stream::readBytes;
+
+  size_t write(uint8_t) override
+  {
+    return 0;
+  }
+};
+
+#endif
@@ -0,0 +1,224 @@
+// httpSession
+//
+// Long-lived HTTP/1.1 keep-alive connection to a single host.
+// The host address is resolved once and cached until a connect fails.
+// Connections idle longer than the server's keep-alive timeout are
+// replaced before sending, a request failing on a reused connection
+// (closed by the server meanwhile) is retried once on a new one.
+// Servers keep idle connections for seconds, so only back-to-back
+// requests reuse one: requests a poll interval apart each connect, and
+// only skip the DNS lookup.
+//
+// Secure sessions use TLS and connect by host name (for SNI), the server
+// certificate is checked against the CA set with setCACert(), connecting
+// fails until one is set.
+//
+// Usage: get(), read the body from stream(), then end() (also after a
+// failed get()). Pass false to end() when the body was not read to its
+// end so the connection is not reused with response bytes pending.
+//
+// Version 1.0
+
+#ifndef HTTP_SESSION_H
+#define HTTP_SESSION_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <WiFiClientSecure.h>
+#include <HTTPClient.h>
+#include <vector>
+
+class HttpSession
+{
+
+private:
+  static const int32_t connectTimeout = 5000;
+  static const unsigned long defaultIdleTimeout = 4000;
+
+  String _host;
+  uint16_t _port;
+  bool _secure;
+  WiFiClient _plainClient;
+  WiFiClientSecure _secureClient;
+  WiFiClient &_client;
+  HTTPClient _http;
+  IPAddress _address;
+  bool _resolved = false;
+  unsigned long _lastUse = 0;
+  unsigned long _idleTimeout = defaultIdleTimeout;
+  std::vector<std::pair<String, String>> _requestHeaders;
+  const char *_responseHeaders[4] = {"Content-Type", "Content-Encoding", "Transfer-Encoding", "Keep-Alive"};
+
+  uint32_t _requests = 0;
+  uint32_t _connects = 0;
+  uint32_t _lookups = 0;
+  uint32_t _retries = 0;
+  unsigned long _start = 0;
+  unsigned long _lastMillis = 0;
+  unsigned long _totalMillis = 0;
+
+  bool connect()
+  {
+    _client.stop();
+
+    if (_secure)
+    {
+      _connects++;
+      return _secureClient.connect(_host.c_str(), _port, connectTimeout);
+    }
+
+    if (!_resolved)
+    {
+      _lookups++;
+      if (!WiFi.hostByName(_host.c_str(), _address))
+      {
+        return false;
+      }
+      _resolved = true;
+    }
+
+    _connects++;
+    if (!_plainClient.connect(_address, _port, connectTimeout))
+    {
+      // The address may have changed, resolve again next time.
+      _resolved = false;
+      return false;
+    }
+    return true;
+  }
+
+  int request(const String &uri)
+  {
+    // HTTPClient reuses the client while it is connected.
+    _http.begin(_client, _host, _port, uri, _secure);
+    _http.setReuse(true);
+    _http.collectHeaders(_responseHeaders, 4);
+
+    for (auto &header : _requestHeaders)
+    {
+      _http.addHeader(header.first, header.second);
+    }
+
+    return _http.GET();
+  }
+
+  static inline bool isStaleConnectionError(int code)
+  {
+    return code == HTTPC_ERROR_SEND_HEADER_FAILED || code == HTTPC_ERROR_CONNECTION_LOST || code == HTTPC_ERROR_NOT_CONNECTED || code == HTTPC_ERROR_READ_TIMEOUT;
+  }
+
+public:
+  HttpSession(const char *host, uint16_t port = 80, bool secure = false) : _host(host), _port(port), _secure(secure), _client(secure ? _secureClient : _plainClient)
+  {
+  }
+
+  // Root CA certificates (PEM, one or more) the server certificate is
+  // checked against, the string must outlive the session.
+  void setCACert(const char *rootCA)
+  {
+    _secureClient.setCACert(rootCA);
+  }
+
+  // Header sent with every request.
+  void addHeader(const String &name, const String &value)
+  {
+    _requestHeaders.push_back({name, value});
+  }
+
+  // Sends a GET request, returns the HTTP code or a negative HTTPClient error.
+  int get(const String &uri)
+  {
+    _start = millis();
+    bool reused = _client.connected() && millis() - _lastUse < _idleTimeout;
+
+    _requests++;
+
+    int code = reused || connect() ? request(uri) : HTTPC_ERROR_CONNECTION_REFUSED;
+
+    if (reused && isStaleConnectionError(code))
+    {
+      _retries++;
+      code = connect() ? request(uri) : HTTPC_ERROR_CONNECTION_REFUSED;
+    }
+
+    return code;
+  }
+
+  inline String header(const char *name)
+  {
+    return _http.header(name);
+  }
+
+  inline int size()
+  {
+    return _http.getSize();
+  }
+
+  inline WiFiClient *stream()
+  {
+    return _http.getStreamPtr();
+  }
+
+  // Ends the request, keeps the connection when reusable.
+  void end(bool reusable = true)
+  {
+    // Keep-Alive: timeout=5, max=100
+    String keepAlive = _http.header("Keep-Alive");
+    int timeout = keepAlive.indexOf("timeout=");
+    if (timeout >= 0)
+    {
+      // Leave a second for the request to reach the server.
+      long seconds = keepAlive.substring(timeout + 8).toInt();
+      _idleTimeout = seconds > 1 ? (seconds - 1) * 1000 : 0;
+    }
+
+    _http.end();
+
+    if (!reusable)
+    {
+      _client.stop();
+    }
+    _lastUse = millis();
+    _lastMillis = _lastUse - _start;
+    _totalMillis += _lastMillis;
+  }
+
+  inline const String &host()
+  {
+    return _host;
+  }
+
+  inline uint32_t requests()
+  {
+    return _requests;
+  }
+
+  // Connection setups (TCP handshakes), including retries.
+  inline uint32_t connects()
+  {
+    return _connects;
+  }
+
+  inline uint32_t lookups()
+  {
+    return _lookups;
+  }
+
+  inline uint32_t retries()
+  {
+    return _retries;
+  }
+
+  // Duration of the last request, from get() to end().
+  inline unsigned long lastMillis()
+  {
+    return _lastMillis;
+  }
+
+  inline unsigned long averageMillis()
+  {
+    return _requests > 0 ? _totalMillis / _requests : 0;
+  }
+};
+
+#endif
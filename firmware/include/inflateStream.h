@@ -0,0 +1,295 @@
+// inflateStream
+//
+// Streaming gzip decoder using the ESP32 ROM miniz (tinfl).
+// Compressed input is pulled from a source stream in small blocks
+// and inflated into a fixed circular window, so neither the compressed
+// nor the inflated body is ever held in memory as a whole.
+//
+// The window must cover the encoder's window (the midpoint compresses
+// with 4 KB windows), bodies smaller than the window are always safe.
+// tinfl does not check match distances against a wrapping window, a
+// stream from a larger encoder window (32 KB with standard gzip) decodes
+// to corrupt data instead of failing, so only request gzip from hosts
+// known to use a small window.
+//
+// Version 1.0
+
+#ifndef INFLATE_STREAM_H
+#define INFLATE_STREAM_H
+
+#include <Arduino.h>
+
+#if __has_include("esp32/rom/miniz.h")
+#include "esp32/rom/miniz.h"
+#else
+#include "rom/miniz.h"
+#endif
+
+class InflateStream : public Stream
+{
+
+private:
+  static const size_t windowSize = 4096; // Power of two, tinfl wraps with a mask.
+  static const size_t inputSize = 256;
+
+  Stream *_source;
+  tinfl_decompressor *_decompressor = nullptr;
+  uint8_t *_window = nullptr;
+  uint8_t _input[inputSize];
+  size_t _inputPos = 0;
+  size_t _inputLen = 0;
+  size_t _windowPos = 0;
+  size_t _readPos = 0;
+  size_t _pending = 0;
+  bool _headerDone = false;
+  bool _done = false;
+  bool _error = false;
+
+  size_t _compressedBytes = 0;
+  size_t _inflatedBytes = 0;
+  unsigned long _inflateMicros = 0;
+
+  bool fillInput()
+  {
+    if (_inputPos < _inputLen)
+    {
+      return true;
+    }
+
+    _inputPos = 0;
+    _inputLen = _source->readBytes((char *)_input, inputSize);
+    _compressedBytes += _inputLen;
+    return _inputLen > 0;
+  }
+
+  int nextInputByte()
+  {
+    return fillInput() ? _input[_inputPos++] : -1;
+  }
+
+  bool skipInputBytes(size_t count)
+  {
+    while (count--)
+    {
+      if (nextInputByte() < 0)
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool skipInputString()
+  {
+    int c;
+    while ((c = nextInputByte()) > 0)
+    {
+    }
+    return c == 0;
+  }
+
+  // Skips the gzip member header (RFC 1952), leaving raw deflate data.
+  bool readHeader()
+  {
+    const uint8_t FHCRC = 0x02, FEXTRA = 0x04, FNAME = 0x08, FCOMMENT = 0x10;
+
+    if (nextInputByte() != 0x1f || nextInputByte() != 0x8b || nextInputByte() != 8)
+    {
+      return false;
+    }
+
+    int flags = nextInputByte();
+
+    // MTIME, XFL and OS.
+    if (flags < 0 || !skipInputBytes(6))
+    {
+      return false;
+    }
+
+    if (flags & FEXTRA)
+    {
+      int lo = nextInputByte();
+      int hi = nextInputByte();
+      if (lo < 0 || hi < 0 || !skipInputBytes(lo | (hi << 8)))
+      {
+        return false;
+      }
+    }
+
+    if ((flags & FNAME) && !skipInputString())
+    {
+      return false;
+    }
+
+    if ((flags & FCOMMENT) && !skipInputString())
+    {
+      return false;
+    }
+
+    if ((flags & FHCRC) && !skipInputBytes(2))
+    {
+      return false;
+    }
+
+    return true;
+  }
+
+  // Inflates until decoded bytes are pending. Only called when all
+  // previously decoded bytes were read, so the window can be overwritten.
+  bool fill()
+  {
+    if (_done || _error)
+    {
+      return false;
+    }
+
+    if (_decompressor == nullptr)
+    {
+      _decompressor = (tinfl_decompressor *)malloc(sizeof(tinfl_decompressor));
+      _window = (uint8_t *)malloc(windowSize);
+
+      if (_decompressor == nullptr || _window == nullptr)
+      {
+        _error = true;
+        return false;
+      }
+      tinfl_init(_decompressor);
+    }
+
+    if (!_headerDone)
+    {
+      if (!readHeader())
+      {
+        _error = true;
+        return false;
+      }
+      _headerDone = true;
+    }
+
+    unsigned long start = micros();
+
+    while (_pending == 0)
+    {
+      if (!fillInput())
+      {
+        // Source ended before the final deflate block.
+        _error = true;
+        break;
+      }
+
+      size_t inBytes = _inputLen - _inputPos;
+      size_t outBytes = windowSize - _windowPos;
+
+      tinfl_status status = tinfl_decompress(_decompressor, _input + _inputPos, &inBytes,
+                                             _window, _window + _windowPos, &outBytes,
+                                             TINFL_FLAG_HAS_MORE_INPUT);
+
+      _inputPos += inBytes;
+      _readPos = _windowPos;
+      _windowPos = (_windowPos + outBytes) & (windowSize - 1);
+      _pending = outBytes;
+      _inflatedBytes += outBytes;
+
+      if (status == TINFL_STATUS_DONE)
+      {
+        _done = true;
+        break;
+      }
+
+      if (status < TINFL_STATUS_DONE)
+      {
+        _error = true;
+        break;
+      }
+    }
+
+    _inflateMicros += micros() - start;
+
+    return _pending > 0;
+  }
+
+public:
+  InflateStream(Stream &source)
+  {
+    _source = &source;
+  }
+
+  ~InflateStream()
+  {
+    free(_decompressor);
+    free(_window);
+  }
+
+  inline bool error()
+  {
+    return _error;
+  }
+
+  // Compressed bytes pulled from the source so far.
+  inline size_t compressedBytes()
+  {
+    return _compressedBytes;
+  }
+
+  inline size_t inflatedBytes()
+  {
+    return _inflatedBytes;
+  }
+
+  // CPU time spent in the decoder.
+  inline unsigned long inflateMicros()
+  {
+    return _inflateMicros;
+  }
+
+  int available() override
+  {
+    return _pending > 0 || fill() ? _pending : 0;
+  }
+
+  int read() override
+  {
+    if (_pending == 0 && !fill())
+    {
+      return -1;
+    }
+
+    uint8_t c = _window[_readPos];
+    _readPos = (_readPos + 1) & (windowSize - 1);
+    _pending--;
+    return c;
+  }
+
+  int peek() override
+  {
+    if (_pending == 0 && !fill())
+    {
+      return -1;
+    }
+    return _window[_readPos];
+  }
+
+  size_t readBytes(char *buffer, size_t length) override
+  {
+    size_t count = 0;
+
+    while (count < length && (_pending > 0 || fill()))
+    {
+      size_t run = min(min(_pending, length - count), windowSize - _readPos);
+      memcpy(buffer + count, _window + _readPos, run);
+      count += run;
+      _readPos = (_readPos + run) & (windowSize - 1);
+      _pending -= run;
+    }
+
+    return count;
+  }
+  using Stream::readBytes;
+
+  size_t write(uint8_t) override
+  {
+    return 0;
+  }
+};
+
+#endif
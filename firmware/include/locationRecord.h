@@ -0,0 +1,243 @@
+// locationRecord
+//
+// Typed view of a station or location payload:
+// {"station": {...}, "data": {"streamFlow": {"date", "value", "safety"}, ...}}
+//
+// decode() walks the document once, keys are matched by switching on
+// their FNV-1a hash (computed at compile time for the schema keys) and
+// confirmed with a single compare. Unknown keys are skipped, missing
+// fields keep their defaults.
+//
+// Version 1.0
+
+#ifndef LOCATION_RECORD_H
+#define LOCATION_RECORD_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "safetyRules.h"
+
+struct MeasurementRecord
+{
+  char date[32];  // ISO 8601 with its offset, empty when not available.
+  char value[12]; // As reported, "N.A." when not available.
+  float number;   // NAN when not available.
+  Safety safety;  // As reported by the API.
+};
+
+struct LocationRecord
+{
+  char usgsId[12];
+  char wrId[12];
+  char recordTime[32]; // ISO 8601 with its offset.
+  char version[12];
+  Safety status; // locationStatus reported by the API.
+  MeasurementRecord data[numMeasurements];
+
+  // FNV-1a, usable in case labels.
+  static constexpr uint32_t hash(const char *key, uint32_t h = 2166136261u)
+  {
+    return *key == '\0' ? h : hash(key + 1, (h ^ (uint8_t)*key) * 16777619u);
+  }
+
+  void clear()
+  {
+    usgsId[0] = wrId[0] = recordTime[0] = version[0] = '\0';
+    status = SafetyNA;
+
+    for (MeasurementRecord &measurement : data)
+    {
+      measurement.date[0] = '\0';
+      strcpy(measurement.value, "N.A.");
+      measurement.number = NAN;
+      measurement.safety = SafetyNA;
+    }
+  }
+
+  // Decodes a payload, false when it has no station object.
+  bool decode(JsonVariantConst doc)
+  {
+    clear();
+
+    JsonObjectConst station = doc["station"].as<JsonObjectConst>();
+    if (station.isNull())
+    {
+      return false;
+    }
+
+    for (JsonPairConst field : station)
+    {
+      const char *key = field.key().c_str();
+      const char *value = field.value().as<const char *>();
+
+      switch (hash(key))
+      {
+      case hash("usgsId"):
+        copyIf(key, "usgsId", usgsId, sizeof(usgsId), value);
+        break;
+      case hash("wrId"):
+        copyIf(key, "wrId", wrId, sizeof(wrId), value);
+        break;
+      case hash("recordTime"):
+        copyIf(key, "recordTime", recordTime, sizeof(recordTime), value);
+        break;
+      case hash("version"):
+        copyIf(key, "version", version, sizeof(version), value);
+        break;
+      case hash("locationStatus"):
+        if (!strcmp(key, "locationStatus"))
+        {
+          status = SafetyRules::findSafety(value);
+        }
+        break;
+      }
+    }
+
+    for (JsonPairConst entry : doc["data"].as<JsonObjectConst>())
+    {
+      int m = measurementIndex(entry.key().c_str());
+      if (m >= 0)
+      {
+        decodeMeasurement(entry.value(), data[m]);
+      }
+    }
+
+    return true;
+  }
+
+  // Writes the record as a payload decode() reads back, empty IDs and
+  // measurements without a date or value are left out. The document
+  // refers to the record's strings, serialize it before they change.
+  void encode(JsonDocument &doc) const
+  {
+    doc.clear();
+
+    JsonObject station = doc.createNestedObject("station");
+    if (usgsId[0] != '\0')
+    {
+      station["usgsId"] = usgsId;
+    }
+    if (wrId[0] != '\0')
+    {
+      station["wrId"] = wrId;
+    }
+    station["recordTime"] = recordTime;
+    station["version"] = version;
+    station["locationStatus"] = safetyNames[status];
+
+    JsonObject measurements = doc.createNestedObject("data");
+    for (int m = 0; m < numMeasurements; m++)
+    {
+      if (data[m].date[0] == '\0' && !strcmp(data[m].value, "N.A."))
+      {
+        continue;
+      }
+
+      JsonObject measurement = measurements.createNestedObject(measurementNames[m]);
+      measurement["date"] = data[m].date;
+      measurement["value"] = data[m].value;
+      measurement["safety"] = safetyNames[data[m].safety];
+    }
+  }
+
+  // True when every string is terminated within its field and every
+  // safety is a known one, checks a record from outside this device.
+  bool valid() const
+  {
+    if (!terminated(usgsId, sizeof(usgsId)) || !terminated(wrId, sizeof(wrId)) ||
+        !terminated(recordTime, sizeof(recordTime)) || !terminated(version, sizeof(version)) ||
+        !known(status))
+    {
+      return false;
+    }
+
+    for (const MeasurementRecord &measurement : data)
+    {
+      if (!terminated(measurement.date, sizeof(measurement.date)) ||
+          !terminated(measurement.value, sizeof(measurement.value)) ||
+          !known(measurement.safety))
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+private:
+  static bool terminated(const char *field, size_t size)
+  {
+    return memchr(field, '\0', size) != nullptr;
+  }
+
+  static bool known(Safety safety)
+  {
+    return safety < sizeof(safetyNames) / sizeof(safetyNames[0]);
+  }
+
+  static void copyIf(const char *key, const char *expected, char *field, size_t size, const char *value)
+  {
+    if (value != nullptr && !strcmp(key, expected))
+    {
+      strncpy(field, value, size - 1);
+      field[size - 1] = '\0';
+    }
+  }
+
+  static int measurementIndex(const char *key)
+  {
+    int m;
+
+    switch (hash(key))
+    {
+    case hash("streamFlow"):
+      m = MeasureStreamFlow;
+      break;
+    case hash("gaugeHeight"):
+      m = MeasureGaugeHeight;
+      break;
+    case hash("waterTempC"):
+      m = MeasureWaterTemp;
+      break;
+    case hash("eColiConcentration"):
+      m = MeasureEColi;
+      break;
+    case hash("bacteriaThreshold"):
+      m = MeasureBacteria;
+      break;
+    default:
+      return -1;
+    }
+
+    return !strcmp(key, measurementNames[m]) ? m : -1;
+  }
+
+  static void decodeMeasurement(JsonVariantConst source, MeasurementRecord &measurement)
+  {
+    for (JsonPairConst field : source.as<JsonObjectConst>())
+    {
+      const char *key = field.key().c_str();
+      const char *value = field.value().as<const char *>();
+
+      switch (hash(key))
+      {
+      case hash("date"):
+        copyIf(key, "date", measurement.date, sizeof(measurement.date), value);
+        break;
+      case hash("value"):
+        copyIf(key, "value", measurement.value, sizeof(measurement.value), value);
+        break;
+      case hash("safety"):
+        if (!strcmp(key, "safety"))
+        {
+          measurement.safety = SafetyRules::findSafety(value);
+        }
+        break;
+      }
+    }
+
+    bool available = measurement.value[0] != '\0' && strcmp(measurement.value, "N.A.") != 0;
+    measurement.number = available ? atof(measurement.value) : NAN;
+  }
+};
+
+#endif
@@ -0,0 +1,173 @@
+// logger
+//
+// Asynchronous leveled logger.
+// Messages are formatted into a lock-free ring buffer and written to the
+// UART by a low priority task, so logging does not stall the caller.
+// Log calls above LOG_LEVEL (set in platformio.ini build_flags) compile to no
+// code, their arguments are still type checked and count as used.
+//
+// The ring buffer is single producer: log from the loop task only.
+// When the buffer is full messages are dropped and counted.
+//
+// Version 1.0
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <Arduino.h>
+#include <atomic>
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Dump of full HTTP payloads (opt-in, large).
+#ifndef LOG_PAYLOADS
+#define LOG_PAYLOADS 0
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_E(...) logger.log('E', __VA_ARGS__)
+#else
+#define LOG_E(...) do { if (0) logger.log('E', __VA_ARGS__); } while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_W(...) logger.log('W', __VA_ARGS__)
+#else
+#define LOG_W(...) do { if (0) logger.log('W', __VA_ARGS__); } while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_I(...) logger.log('I', __VA_ARGS__)
+#else
+#define LOG_I(...) do { if (0) logger.log('I', __VA_ARGS__); } while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_D(...) logger.log('D', __VA_ARGS__)
+#else
+#define LOG_D(...) do { if (0) logger.log('D', __VA_ARGS__); } while (0)
+#endif
+
+class Logger : public Print
+{
+
+private:
+  static const size_t bufferSize = 4096; // Power of two.
+  static const size_t lineSize = 160;
+
+  char _buffer[bufferSize];
+  std::atomic<size_t> _head{0}; // Advanced by the producer.
+  std::atomic<size_t> _tail{0}; // Advanced by the drain task.
+  std::atomic<uint32_t> _dropped{0};
+  Print *_out = nullptr;
+
+  static void drainTask(void *parameter)
+  {
+    Logger *logger = (Logger *)parameter;
+    uint32_t reportedDropped = 0;
+
+    while (1)
+    {
+      if (logger->drain() == 0)
+      {
+        uint32_t dropped = logger->_dropped.load(std::memory_order_relaxed);
+        if (dropped != reportedDropped)
+        {
+          logger->_out->printf("[W] Log buffer full, %u messages dropped.\n", dropped - reportedDropped);
+          reportedDropped = dropped;
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+      }
+    }
+  }
+
+public:
+  // Starts the drain task writing to out (runs on the core not used by loop()).
+  inline void begin(Print &out)
+  {
+    _out = &out;
+    xTaskCreatePinnedToCore(drainTask, "logger", 2048, this, 1, nullptr, 0);
+  }
+
+  // Writes pending bytes to the output, returns the number of bytes written.
+  inline size_t drain()
+  {
+    size_t tail = _tail.load(std::memory_order_relaxed);
+    size_t head = _head.load(std::memory_order_acquire);
+    size_t offset = tail & (bufferSize - 1);
+    size_t length = min(head - tail, bufferSize - offset);
+
+    if (length > 0)
+    {
+      _out->write((const uint8_t *)_buffer + offset, length);
+      _tail.store(tail + length, std::memory_order_release);
+    }
+    return length;
+  }
+
+  inline uint32_t dropped()
+  {
+    return _dropped.load(std::memory_order_relaxed);
+  }
+
+  // Copies a whole message into the ring buffer or drops it.
+  bool push(const char *data, size_t length)
+  {
+    size_t head = _head.load(std::memory_order_relaxed);
+    size_t tail = _tail.load(std::memory_order_acquire);
+
+    if (bufferSize - (head - tail) < length)
+    {
+      _dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+
+    size_t offset = head & (bufferSize - 1);
+    size_t first = min(length, bufferSize - offset);
+    memcpy(_buffer + offset, data, first);
+    memcpy(_buffer, data + first, length - first);
+
+    _head.store(head + length, std::memory_order_release);
+    return true;
+  }
+
+  __attribute__((format(printf, 3, 4))) void log(char level, const char *format, ...)
+  {
+    char line[lineSize];
+    int length = snprintf(line, lineSize, "[%c] ", level);
+
+    va_list args;
+    va_start(args, format);
+    int formatted = vsnprintf(line + length, lineSize - length - 1, format, args);
+    va_end(args);
+
+    length += formatted < 0 ? 0 : min((size_t)formatted, lineSize - length - 2);
+    line[length++] = '\n';
+
+    push(line, length);
+  }
+
+  // Print interface for raw dumps (e.g. serializeJson(doc, logger)).
+  size_t write(uint8_t c) override
+  {
+    return push((const char *)&c, 1) ? 1 : 0;
+  }
+
+  size_t write(const uint8_t *buffer, size_t size) override
+  {
+    return push((const char *)buffer, size) ? size : 0;
+  }
+  using Print::write;
+};
+
+extern Logger logger;
+
+#endif
@@ -10,6 +10,7 @@
 
 
 #include <Arduino.h>
+#include <limits.h>
 
 // Non-blocking millisecond timer.
 class msTimer
@@ -19,6 +20,30 @@ private:
   unsigned long _oldMillis;
   unsigned long _delay;
 
+  static unsigned long &earliestDeadline()
+  {
+    static unsigned long deadline = 0;
+    return deadline;
+  }
+
+  static bool &deadlineNoted()
+  {
+    static bool noted = false;
+    return noted;
+  }
+
+  // Compared as spans from now, millis() wraps after 49 days.
+  static inline void noteDeadline(unsigned long ms)
+  {
+    unsigned long now = millis();
+
+    if (!deadlineNoted() || (long)(ms - now) < (long)(earliestDeadline() - now))
+    {
+      earliestDeadline() = ms;
+      deadlineNoted() = true;
+    }
+  }
+
 public:
   // Default Constructor.
   msTimer()
@@ -36,20 +61,37 @@ public:
 
   // Returns true if delay has elapsed.
   // Reset delay.
+  // The span since the last reset is compared, millis() wraps after 49 days.
   inline bool elapsed()
   {
-    if ((_oldMillis + _delay) < millis())
+    if (millis() - _oldMillis > _delay)
     {
       _oldMillis = millis();
+      noteDeadline(_oldMillis + _delay + 1);
       return 1;
     }
 
+    noteDeadline(_oldMillis + _delay + 1);
     return 0;
   }
 
+  // Milliseconds until the first timer polled since the last call
+  // expires (ULONG_MAX when none was), lets loop() idle until then.
+  static unsigned long takeRemaining()
+  {
+    if (!deadlineNoted())
+    {
+      return ULONG_MAX;
+    }
+
+    long span = (long)(earliestDeadline() - millis());
+    deadlineNoted() = false;
+    return span > 0 ? span : 0;
+  }
+
   inline void ForceTrigger()
   {
-    _oldMillis = 0;
+    _oldMillis = millis() - _delay - 1;
   }
 
   // Set delay and reset timer.
@@ -69,6 +111,13 @@ public:
     }
   }
 
+  // Milliseconds until elapsed() returns true.
+  inline unsigned long remaining()
+  {
+    unsigned long passed = millis() - _oldMillis;
+    return passed > _delay ? 0 : _delay - passed + 1;
+  }
+
   // Reset timer.
   inline void resetDelay()
   {
@@ -0,0 +1,201 @@
+// overviewGrid
+//
+// Grid of location tiles (status colour, names and data age) drawn from
+// in-memory state. Each tile is composed in a sprite and pushed as one
+// image, only tiles whose contents changed since the last update are
+// redrawn.
+//
+// Two tile sprites are used in turn when the panel takes DMA transfers,
+// so a tile is composed while the previous one is sent. TFT_eSPI sends
+// 18 bit pixels to an ILI9488 over SPI and has no DMA path for it, tiles
+// are then pushed with pushImage().
+//
+// Version 1.0
+
+#ifndef OVERVIEW_GRID_H
+#define OVERVIEW_GRID_H
+
+#include <Arduino.h>
+#include <TFT_eSPI.h>
+#include <vector>
+
+struct OverviewTile
+{
+  const char *name;  // First line.
+  const char *area;  // Second line.
+  uint16_t color;    // Status colour.
+  char age[5];       // Age of the data, e.g. "3h".
+  bool stale;        // Age shown dimmed.
+  bool selected;     // Framed.
+};
+
+class OverviewGrid
+{
+
+private:
+#if defined(ILI9488_DRIVER) && !defined(TFT_PARALLEL_8_BIT)
+  static const bool dmaCapable = false;
+#else
+  static const bool dmaCapable = true;
+#endif
+
+  TFT_eSPI *_tft;
+  TFT_eSprite _spriteA;
+  TFT_eSprite _spriteB;
+  TFT_eSprite *_sprites[2] = {&_spriteA, &_spriteB};
+  int _numSprites = 0;
+  int _nextSprite = 0;
+  bool _dma = false;
+
+  int16_t _x = 0;
+  int16_t _y = 0;
+  int16_t _columns = 1;
+  int16_t _tileWidth = 0;
+  int16_t _tileHeight = 0;
+
+  std::vector<OverviewTile> _drawn;
+  std::vector<bool> _valid; // Drawn tile matches the screen.
+  uint32_t _tilesDrawn = 0;
+
+  static bool same(const OverviewTile &a, const OverviewTile &b)
+  {
+    return a.name == b.name && a.area == b.area && a.color == b.color && a.stale == b.stale && a.selected == b.selected && !strcmp(a.age, b.age);
+  }
+
+  void compose(TFT_eSprite &sprite, const OverviewTile &tile)
+  {
+    const int16_t bar = 6;
+    int16_t width = _tileWidth - 2; // Gap between tiles.
+    int16_t height = _tileHeight - 2;
+    int16_t columns = (width - bar - 4) / 6;
+
+    sprite.fillSprite(TFT_BLACK);
+    sprite.fillRect(0, 0, bar, height, tile.color);
+
+    if (tile.selected)
+    {
+      sprite.drawRect(0, 0, width, height, TFT_BLUE);
+    }
+
+    sprite.setTextSize(1);
+    sprite.setTextColor(TFT_WHITE, TFT_BLACK);
+    sprite.setCursor(bar + 3, 3);
+    sprite.printf("%.*s", columns, tile.area);
+
+    sprite.setTextColor(TFT_LIGHTGREY, TFT_BLACK);
+    sprite.setCursor(bar + 3, height - 11);
+    sprite.printf("%.*s", columns - 5, tile.name);
+
+    sprite.setTextColor(tile.stale ? TFT_DARKGREY : TFT_WHITE, TFT_BLACK);
+    sprite.setCursor(width - 3 - 6 * (int16_t)strlen(tile.age), height - 11);
+    sprite.print(tile.age);
+  }
+
+  void push(int index, TFT_eSprite &sprite)
+  {
+    int16_t x = _x + (index % _columns) * _tileWidth;
+    int16_t y = _y + (index / _columns) * _tileHeight;
+
+    if (_dma)
+    {
+      // Waits for the transfer of the other sprite.
+      _tft->pushImageDMA(x, y, _tileWidth - 2, _tileHeight - 2, (uint16_t *)sprite.getPointer());
+    }
+    else
+    {
+      sprite.pushSprite(x, y);
+    }
+  }
+
+public:
+  OverviewGrid(TFT_eSPI *tft) : _tft(tft), _spriteA(tft), _spriteB(tft)
+  {
+  }
+
+  // Lays out count tiles in columns over the given area, again when the
+  // count changes.
+  bool begin(int16_t x, int16_t y, int16_t width, int16_t height, int16_t columns, int count)
+  {
+    int16_t rows = (count + columns - 1) / columns;
+
+    _x = x;
+    _y = y;
+    _columns = columns;
+    _tileWidth = width / columns;
+    _tileHeight = rows > 0 ? height / rows : height;
+    _drawn.assign(count, OverviewTile());
+    _valid.assign(count, false);
+
+    // DMA is initialised once, a transfer may still read a sprite.
+    if (_dma)
+    {
+      _tft->dmaWait();
+    }
+    _dma = _dma || (dmaCapable && _tft->initDMA());
+    _numSprites = _dma ? 2 : 1;
+
+    for (int i = 0; i < _numSprites; i++)
+    {
+      _sprites[i]->deleteSprite();
+      _sprites[i]->setColorDepth(16);
+      if (_sprites[i]->createSprite(_tileWidth - 2, _tileHeight - 2) == nullptr)
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Redraws all tiles with the next update, e.g. after the screen was cleared.
+  void invalidate()
+  {
+    _valid.assign(_valid.size(), false);
+  }
+
+  // Redraws the tiles that changed, returns the number of tiles drawn.
+  int update(const OverviewTile *tiles, int count)
+  {
+    int drawn = 0;
+
+    count = min(count, (int)_drawn.size());
+
+    for (int i = 0; i < count; i++)
+    {
+      if (_valid[i] && same(tiles[i], _drawn[i]))
+      {
+        continue;
+      }
+
+      if (drawn == 0 && _dma)
+      {
+        _tft->startWrite();
+      }
+
+      TFT_eSprite &sprite = *_sprites[_nextSprite];
+      _nextSprite = (_nextSprite + 1) % _numSprites;
+
+      compose(sprite, tiles[i]);
+      push(i, sprite);
+
+      _drawn[i] = tiles[i];
+      _valid[i] = true;
+      drawn++;
+    }
+
+    if (drawn > 0 && _dma)
+    {
+      _tft->dmaWait();
+      _tft->endWrite();
+    }
+
+    _tilesDrawn += drawn;
+    return drawn;
+  }
+
+  inline uint32_t tilesDrawn()
+  {
+    return _tilesDrawn;
+  }
+};
+
+#endif
@@ -0,0 +1,296 @@
+// peerShare
+//
+// Shares decoded station records between dashboards on the same LAN over
+// UDP multicast, so each station is fetched from the API by one device.
+//
+// Every device sends one packet per fetch slot: the record it fetched, or
+// a hello when it had nothing to send. Devices heard within the peer
+// timeout are live, a station is owned by the live device with the
+// highest hash of (station ID, device ID) (rendezvous hashing), so
+// ownership moves only for the stations of a device that joins or leaves.
+//
+// Packets are received by the UDP task and queued, the queue and the peer
+// table are single consumer: call read() and owns() from the loop task.
+// Packets are the in-memory record, peers must run the same firmware.
+// Packets are not authenticated: one with an unterminated string or an
+// unknown safety is rejected before it is queued.
+//
+// Version 1.0
+
+#ifndef PEER_SHARE_H
+#define PEER_SHARE_H
+
+#include <Arduino.h>
+#include <AsyncUDP.h>
+#include <atomic>
+#include "locationRecord.h"
+
+struct PeerRecord
+{
+  uint32_t deviceId;     // Sender.
+  uint32_t fetchEpoch;   // When the sender fetched the record.
+  char stationId[12];
+  LocationRecord record;
+};
+
+class PeerShare
+{
+
+private:
+  static const uint32_t magic = 0x31504352; // "RCP1"
+  static const int maxPeers = 8;
+  static const size_t queueSize = 8; // Power of two.
+
+  struct Packet
+  {
+    uint32_t magic;
+    PeerRecord content; // Empty station ID for a hello.
+  };
+
+  struct Peer
+  {
+    uint32_t id;
+    unsigned long lastHeard;
+  };
+
+  AsyncUDP _udp;
+  IPAddress _group;
+  uint16_t _port = 0;
+  uint32_t _deviceId = 0;
+  unsigned long _peerTimeout = 180000;
+  TaskHandle_t _wakeTask = nullptr;
+
+  Peer _peers[maxPeers];
+  int _numPeers = 0;
+
+  PeerRecord _queue[queueSize];
+  std::atomic<uint32_t> _head{0}; // Advanced by the UDP task.
+  std::atomic<uint32_t> _tail{0}; // Advanced by read().
+  std::atomic<uint32_t> _dropped{0};
+  std::atomic<uint32_t> _rejected{0};
+  uint32_t _sent = 0;
+  uint32_t _received = 0;
+
+  void receive(AsyncUDPPacket &packet)
+  {
+    Packet incoming;
+
+    if (packet.length() != sizeof(incoming))
+    {
+      return;
+    }
+    memcpy(&incoming, packet.data(), sizeof(incoming));
+
+    if (incoming.magic != magic || incoming.content.deviceId == _deviceId)
+    {
+      return;
+    }
+
+    if (memchr(incoming.content.stationId, '\0', sizeof(incoming.content.stationId)) == nullptr ||
+        !incoming.content.record.valid())
+    {
+      _rejected.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+
+    uint32_t head = _head.load(std::memory_order_relaxed);
+
+    if (head - _tail.load(std::memory_order_acquire) == queueSize)
+    {
+      _dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+
+    _queue[head & (queueSize - 1)] = incoming.content;
+    _head.store(head + 1, std::memory_order_release);
+
+    if (_wakeTask != nullptr)
+    {
+      xTaskNotifyGive(_wakeTask);
+    }
+  }
+
+  void send(const PeerRecord &content)
+  {
+    Packet outgoing;
+
+    outgoing.magic = magic;
+    outgoing.content = content;
+    outgoing.content.deviceId = _deviceId;
+
+    if (_udp.writeTo((const uint8_t *)&outgoing, sizeof(outgoing), _group, _port) == sizeof(outgoing))
+    {
+      _sent++;
+    }
+  }
+
+  void heard(uint32_t id)
+  {
+    unsigned long now = millis();
+    int slot = -1;
+
+    // Known peer, else an expired entry or a free one.
+    for (int i = 0; i < _numPeers; i++)
+    {
+      if (_peers[i].id == id)
+      {
+        slot = i;
+        break;
+      }
+      if (slot < 0 && now - _peers[i].lastHeard >= _peerTimeout)
+      {
+        slot = i;
+      }
+    }
+
+    if (slot < 0 && _numPeers < maxPeers)
+    {
+      slot = _numPeers++;
+    }
+
+    if (slot >= 0)
+    {
+      _peers[slot] = {id, now};
+    }
+  }
+
+  // FNV-1a of the key, finished with the device ID (murmur3 finaliser).
+  static uint32_t weight(const char *key, uint32_t id)
+  {
+    uint32_t h = LocationRecord::hash(key) ^ id;
+
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+  }
+
+public:
+  // Joins the group, peers not heard for peerTimeout are dropped.
+  bool begin(uint32_t deviceId, IPAddress group, uint16_t port, unsigned long peerTimeout)
+  {
+    _deviceId = deviceId;
+    _group = group;
+    _port = port;
+    _peerTimeout = peerTimeout;
+
+    if (!_udp.listenMulticast(group, port))
+    {
+      return false;
+    }
+
+    _udp.onPacket([this](AsyncUDPPacket &packet) { receive(packet); });
+    return true;
+  }
+
+  // Task to notify when a packet arrives, so an idle loop() picks it up.
+  inline void setWakeTask(TaskHandle_t task)
+  {
+    _wakeTask = task;
+  }
+
+  void share(const char *stationId, const LocationRecord &record, uint32_t fetchEpoch)
+  {
+    PeerRecord content;
+
+    content.fetchEpoch = fetchEpoch;
+    strncpy(content.stationId, stationId, sizeof(content.stationId) - 1);
+    content.stationId[sizeof(content.stationId) - 1] = '\0';
+    content.record = record;
+    send(content);
+  }
+
+  // Announces this device in a slot without a record to share.
+  void hello()
+  {
+    PeerRecord content;
+
+    memset(&content, 0, sizeof(content));
+    send(content);
+  }
+
+  // Takes the oldest received record, hellos only update the peer table.
+  bool read(PeerRecord &content)
+  {
+    uint32_t tail = _tail.load(std::memory_order_relaxed);
+
+    while (tail != _head.load(std::memory_order_acquire))
+    {
+      content = _queue[tail & (queueSize - 1)];
+      _tail.store(++tail, std::memory_order_release);
+
+      heard(content.deviceId);
+      if (content.stationId[0] != '\0')
+      {
+        _received++;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // True when this device is the live device with the highest weight for key.
+  bool owns(const char *key)
+  {
+    unsigned long now = millis();
+    uint32_t own = weight(key, _deviceId);
+
+    for (int i = 0; i < _numPeers; i++)
+    {
+      if (now - _peers[i].lastHeard >= _peerTimeout)
+      {
+        continue;
+      }
+
+      uint32_t other = weight(key, _peers[i].id);
+      if (other > own || (other == own && _peers[i].id > _deviceId))
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Peers heard within the peer timeout.
+  int livePeers()
+  {
+    unsigned long now = millis();
+    int live = 0;
+
+    for (int i = 0; i < _numPeers; i++)
+    {
+      live += now - _peers[i].lastHeard < _peerTimeout;
+    }
+    return live;
+  }
+
+  inline uint32_t deviceId()
+  {
+    return _deviceId;
+  }
+
+  inline uint32_t sent()
+  {
+    return _sent;
+  }
+
+  inline uint32_t received()
+  {
+    return _received;
+  }
+
+  inline uint32_t dropped()
+  {
+    return _dropped.load(std::memory_order_relaxed);
+  }
+
+  // Packets from other devices failing validation.
+  inline uint32_t rejected()
+  {
+    return _rejected.load(std::memory_order_relaxed);
+  }
+};
+
+#endif
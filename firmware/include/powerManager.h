@@ -0,0 +1,256 @@
+// powerManager
+//
+// Duty cycles the CPU and the radio between scheduled work. loop() ends
+// with idle(span), which waits until the next timer expires or a wake up
+// (button edge) arrives:
+//  - radio on: at a reduced CPU clock, the loop task blocks on a task
+//    notification, the idle task clock gates the CPU and WiFi stays
+//    associated in modem sleep.
+//  - radio off and light sleep allowed: light sleep, woken by the timer or
+//    a low level on one of the wake pins. Light sleep stops the APB clock,
+//    PWM outputs kept lit must be clocked from RTC8M (see keepPwm()).
+//
+// Time spent in each state is counted, with an estimated charge from
+// nominal currents (ESP32 module only, not the display or LEDs).
+//
+// Version 1.0
+
+#ifndef POWER_MANAGER_H
+#define POWER_MANAGER_H
+
+#include <Arduino.h>
+
+#ifdef ARDUINO_ARCH_ESP32
+#include "driver/gpio.h"
+#include "driver/ledc.h"
+#include "esp_sleep.h"
+#endif
+
+enum PowerState : uint8_t
+{
+  PowerActive, // CPU running at full clock.
+  PowerIdle,   // Waiting at a reduced clock, radio may be on.
+  PowerSleep,  // Light sleep.
+  numPowerStates
+};
+
+class PowerManager
+{
+
+private:
+  static const int maxWakePins = 4;
+
+  uint8_t _wakePins[maxWakePins];
+  int _numWakePins = 0;
+  uint32_t _activeMHz = 240;
+  uint32_t _idleMHz = 80;
+  uint32_t _mhz = 0; // Current CPU clock.
+  bool _lightSleep = false;
+  bool _pwmBlocksSleep = false; // A PWM output must run on the APB clock.
+  TaskHandle_t _task = nullptr;
+
+  PowerState _state = PowerActive;
+  unsigned long _stateSince = 0;
+  bool _radioOn = false;
+  unsigned long _radioSince = 0;
+  uint64_t _residency[numPowerStates] = {0}; // Milliseconds per state.
+  uint64_t _radioOnMillis = 0;
+  uint32_t _wakeups = 0; // Waits ended early by a wake pin.
+
+  inline void setClock(uint32_t mhz)
+  {
+    if (mhz != _mhz)
+    {
+      setCpuFrequencyMhz(mhz);
+      _mhz = mhz;
+    }
+  }
+
+  void enter(PowerState state)
+  {
+    unsigned long now = millis();
+    _residency[_state] += now - _stateSince;
+    _state = state;
+    _stateSince = now;
+  }
+
+  // Waits up to span milliseconds, true when woken early.
+  bool wait(unsigned long span, bool sleep)
+  {
+#ifdef SIMULATOR
+    (void)sleep;
+    return sim::sleepUntil(millis() + span);
+#else
+    if (!sleep)
+    {
+      return ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(span)) > 0;
+    }
+
+    // Wake pins are level triggered in light sleep, their edge interrupts
+    // are restored afterwards.
+    for (int i = 0; i < _numWakePins; i++)
+    {
+      gpio_wakeup_enable((gpio_num_t)_wakePins[i], GPIO_INTR_LOW_LEVEL);
+    }
+    esp_sleep_enable_gpio_wakeup();
+    esp_sleep_enable_timer_wakeup((uint64_t)span * 1000);
+
+    esp_light_sleep_start();
+    bool woken = esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_GPIO;
+
+    for (int i = 0; i < _numWakePins; i++)
+    {
+      gpio_wakeup_disable((gpio_num_t)_wakePins[i]);
+      gpio_set_intr_type((gpio_num_t)_wakePins[i], GPIO_INTR_ANYEDGE);
+    }
+    return woken;
+#endif
+  }
+
+public:
+  // Nominal currents in mA, ESP32 datasheet typical figures.
+  float activeMilliamps = 50;
+  float idleMilliamps = 20;
+  float sleepMilliamps = 0.8;
+  float radioMilliamps = 15; // Average added while associated in modem sleep.
+
+  // Wake pins are active low (buttons), call from the task running loop().
+  void begin(const uint8_t *wakePins, int count, uint32_t activeMHz = 240, uint32_t idleMHz = 80)
+  {
+    _numWakePins = count < maxWakePins ? count : maxWakePins;
+    memcpy(_wakePins, wakePins, _numWakePins);
+    _activeMHz = activeMHz;
+    _idleMHz = idleMHz;
+    _task = xTaskGetCurrentTaskHandle();
+    _stateSince = _radioSince = millis();
+
+    setClock(_activeMHz);
+  }
+
+  // Task to notify from wake up interrupts (see ButtonEvents::setWakeTask()).
+  inline TaskHandle_t task()
+  {
+    return _task;
+  }
+
+  // Light sleep is used while the radio is off, when allowed.
+  inline void allowLightSleep(bool allow)
+  {
+    _lightSleep = allow;
+  }
+
+  // Keeps a LEDC channel set up with ledcSetup() running in light sleep by
+  // clocking its timer from RTC8M. Only low speed channels (8-15) can,
+  // light sleep is not used when another channel must keep running.
+  void keepPwm(uint8_t channel, uint32_t frequency, uint8_t resolution)
+  {
+    if (channel < 8)
+    {
+      _pwmBlocksSleep = true;
+      return;
+    }
+
+#ifdef ARDUINO_ARCH_ESP32
+    ledc_timer_config_t timer = {};
+    timer.speed_mode = LEDC_LOW_SPEED_MODE;
+    timer.duty_resolution = (ledc_timer_bit_t)resolution;
+    timer.timer_num = (ledc_timer_t)((channel / 2) % 4); // As ledcSetup().
+    timer.freq_hz = frequency;
+    timer.clk_cfg = LEDC_USE_RTC8M_CLK;
+
+    if (ledc_timer_config(&timer) != ESP_OK)
+    {
+      _pwmBlocksSleep = true;
+      return;
+    }
+    esp_sleep_pd_config(ESP_PD_DOMAIN_RTC8M, ESP_PD_OPTION_ON);
+#else
+    (void)frequency;
+    (void)resolution;
+#endif
+  }
+
+  void setRadio(bool on)
+  {
+    if (on != _radioOn)
+    {
+      unsigned long now = millis();
+      if (_radioOn)
+      {
+        _radioOnMillis += now - _radioSince;
+      }
+      _radioOn = on;
+      _radioSince = now;
+    }
+  }
+
+  // Waits span milliseconds or until a wake up, returns at once when
+  // span is less than minMillis.
+  void idle(unsigned long span, unsigned long minMillis = 5)
+  {
+    if (span < minMillis)
+    {
+      return;
+    }
+
+    bool sleep = _lightSleep && !_radioOn && !_pwmBlocksSleep;
+
+    // The clock only matters while the CPU is not in light sleep.
+    enter(sleep ? PowerSleep : PowerIdle);
+    if (!sleep)
+    {
+      setClock(_idleMHz);
+    }
+
+    if (wait(span, sleep))
+    {
+      _wakeups++;
+    }
+
+    setClock(_activeMHz);
+    enter(PowerActive);
+  }
+
+  // Milliseconds spent in a state, including the current one.
+  uint64_t residency(PowerState state)
+  {
+    return _residency[state] + (state == _state ? millis() - _stateSince : 0);
+  }
+
+  uint64_t radioOnMillis()
+  {
+    return _radioOnMillis + (_radioOn ? millis() - _radioSince : 0);
+  }
+
+  // Share of the time since begin() spent in a state, in percent.
+  float percent(PowerState state)
+  {
+    uint64_t total = 0;
+    for (int s = 0; s < numPowerStates; s++)
+    {
+      total += residency((PowerState)s);
+    }
+    return total > 0 ? 100.0f * residency(state) / total : 0;
+  }
+
+  float radioPercent()
+  {
+    uint64_t total = residency(PowerActive) + residency(PowerIdle) + residency(PowerSleep);
+    return total > 0 ? 100.0f * radioOnMillis() / total : 0;
+  }
+
+  // Estimated charge drawn since begin().
+  float milliampHours()
+  {
+    float milliampMillis = residency(PowerActive) * activeMilliamps + residency(PowerIdle) * idleMilliamps +
+                           residency(PowerSleep) * sleepMilliamps + radioOnMillis() * radioMilliamps;
+    return milliampMillis / 3600000.0f;
+  }
+
+  inline uint32_t wakeups()
+  {
+    return _wakeups;
+  }
+};
+
+#endif
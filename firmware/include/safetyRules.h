@@ -0,0 +1,147 @@
+// safetyRules
+//
+// Safety thresholds compiled into a flat rule table.
+// Each location owns a contiguous range of rules (its stations' rules,
+// then default rules for measurements its stations do not cover).
+// A location scores the worst safety of the rules its measurements match,
+// Fair when none match.
+//
+// Version 1.0
+
+#ifndef SAFETY_RULES_H
+#define SAFETY_RULES_H
+
+#include <Arduino.h>
+#include <vector>
+
+// Ordered by severity, the value is the status code used in snapshots and history.
+enum Safety : uint8_t
+{
+  SafetyNA,
+  SafetyFair,
+  SafetyCaution,
+  SafetyDanger
+};
+
+enum Measurement : uint8_t
+{
+  MeasureStreamFlow,
+  MeasureGaugeHeight,
+  MeasureWaterTemp,
+  MeasureEColi,
+  MeasureBacteria,
+  numMeasurements
+};
+
+// Keys of the measurements in location data and rules.json.
+const char *const measurementNames[numMeasurements] = {"streamFlow", "gaugeHeight", "waterTempC", "eColiConcentration", "bacteriaThreshold"};
+const char *const safetyNames[] = {"N.A.", "Fair", "Caution", "Danger"};
+
+struct SafetyRule
+{
+  float threshold;
+  Measurement measurement;
+  Safety safety;
+  bool above; // Matches values above the threshold, else below.
+};
+
+class SafetyRules
+{
+
+private:
+  struct Range
+  {
+    uint16_t first;
+    uint16_t count;
+  };
+
+  std::vector<SafetyRule> _rules;
+  std::vector<Range> _ranges;
+
+public:
+  static int findMeasurement(const char *name)
+  {
+    for (int i = 0; name != nullptr && i < numMeasurements; i++)
+    {
+      if (!strcmp(name, measurementNames[i]))
+      {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  static Safety findSafety(const char *name)
+  {
+    for (int i = SafetyDanger; name != nullptr && i > SafetyNA; i--)
+    {
+      if (!strcmp(name, safetyNames[i]))
+      {
+        return (Safety)i;
+      }
+    }
+    return SafetyNA;
+  }
+
+  void clear()
+  {
+    _rules.clear();
+    _ranges.clear();
+  }
+
+  // Starts the rule range of the next location.
+  void beginLocation()
+  {
+    _ranges.push_back({(uint16_t)_rules.size(), 0});
+  }
+
+  // Adds a rule to the current location.
+  void add(const SafetyRule &rule)
+  {
+    _rules.push_back(rule);
+    _ranges.back().count++;
+  }
+
+  inline bool hasRules(int location) const
+  {
+    return location < (int)_ranges.size() && _ranges[location].count > 0;
+  }
+
+  inline size_t size() const
+  {
+    return _rules.size();
+  }
+
+  // Scores a location's measurements (NAN when not available),
+  // N.A. when no measurement is available.
+  Safety evaluate(int location, const float *values) const
+  {
+    bool available = false;
+    for (int i = 0; i < numMeasurements; i++)
+    {
+      available |= !isnan(values[i]);
+    }
+
+    if (!available)
+    {
+      return SafetyNA;
+    }
+
+    Safety worst = SafetyFair;
+    const Range &range = _ranges[location];
+
+    for (const SafetyRule *rule = _rules.data() + range.first, *end = rule + range.count; rule < end; rule++)
+    {
+      float value = values[rule->measurement];
+
+      // Comparisons with NAN are false, missing values match no rule.
+      if (rule->safety > worst && (rule->above ? value > rule->threshold : value < rule->threshold))
+      {
+        worst = rule->safety;
+      }
+    }
+    return worst;
+  }
+};
+
+#endif
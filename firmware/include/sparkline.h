@@ -0,0 +1,206 @@
+// sparkline
+//
+// Scrolling line graph drawn in a 1 bit sprite, one column per sample.
+// New samples scroll the sprite one column and draw only the new column,
+// the whole graph is only redrawn when the cached min/max of the window
+// changes: a sample falls outside it, or the sample scrolled out held it.
+//
+// Version 1.0
+
+#ifndef SPARKLINE_H
+#define SPARKLINE_H
+
+#include <Arduino.h>
+#include <TFT_eSPI.h>
+
+class Sparkline
+{
+
+private:
+  TFT_eSprite _sprite;
+  int16_t _width = 0;
+  int16_t _height = 0;
+  float *_values = nullptr; // Ring of samples shown, one per column.
+  int16_t _start = 0;       // Ring index of the leftmost column.
+  int16_t _count = 0;
+  float _min = NAN;
+  float _max = NAN;
+
+  inline float valueAt(int16_t column)
+  {
+    return _values[(_start + column) % _width];
+  }
+
+  inline int16_t yFor(float value)
+  {
+    if (_max <= _min)
+    {
+      return _height / 2;
+    }
+    return _height - 1 - (int16_t)((value - _min) * (_height - 1) / (_max - _min));
+  }
+
+  // Draws the segment joining the previous sample to this column's sample.
+  void drawColumn(int16_t x, float previous, float value)
+  {
+    if (isnan(value))
+    {
+      return;
+    }
+
+    int16_t y = yFor(value);
+    int16_t yPrevious = isnan(previous) ? y : yFor(previous);
+    _sprite.drawFastVLine(x, min(y, yPrevious), abs(y - yPrevious) + 1, TFT_WHITE);
+  }
+
+  void updateRange()
+  {
+    _min = NAN;
+    _max = NAN;
+
+    for (int16_t i = 0; i < _count; i++)
+    {
+      float value = valueAt(i);
+      if (!isnan(value))
+      {
+        _min = isnan(_min) || value < _min ? value : _min;
+        _max = isnan(_max) || value > _max ? value : _max;
+      }
+    }
+  }
+
+  void render()
+  {
+    _sprite.fillSprite(TFT_BLACK);
+
+    // Samples are right aligned, newest in the last column.
+    int16_t offset = _width - _count;
+    float previous = NAN;
+
+    for (int16_t i = 0; i < _count; i++)
+    {
+      float value = valueAt(i);
+      drawColumn(offset + i, previous, value);
+      previous = value;
+    }
+  }
+
+public:
+  Sparkline(TFT_eSPI *tft) : _sprite(tft)
+  {
+  }
+
+  bool begin(int16_t width, int16_t height, uint16_t color)
+  {
+    _values = (float *)malloc(width * sizeof(float));
+
+    _sprite.setColorDepth(1);
+    if (_values == nullptr || _sprite.createSprite(width, height) == nullptr)
+    {
+      return false;
+    }
+
+    _sprite.setBitmapColor(color, TFT_BLACK);
+    _width = width;
+    _height = height;
+    clear();
+    return true;
+  }
+
+  inline int16_t width()
+  {
+    return _width;
+  }
+
+  // Samples shown.
+  inline int16_t count()
+  {
+    return _count;
+  }
+
+  inline float minValue()
+  {
+    return _min;
+  }
+
+  inline float maxValue()
+  {
+    return _max;
+  }
+
+  inline void clear()
+  {
+    _start = 0;
+    _count = 0;
+    _min = NAN;
+    _max = NAN;
+    _sprite.fillSprite(TFT_BLACK);
+  }
+
+  // Replaces the graph with the newest samples (oldest first).
+  void load(const float *values, size_t count)
+  {
+    if (_width == 0)
+    {
+      return;
+    }
+
+    size_t skip = count > (size_t)_width ? count - _width : 0;
+
+    _start = 0;
+    _count = count - skip;
+    memcpy(_values, values + skip, _count * sizeof(float));
+
+    updateRange();
+    render();
+  }
+
+  // Adds the newest sample.
+  void push(float value)
+  {
+    if (_width == 0)
+    {
+      return;
+    }
+
+    float previous = _count > 0 ? valueAt(_count - 1) : NAN;
+    float dropped = _count == _width ? _values[_start] : NAN;
+
+    if (_count < _width)
+    {
+      _values[(_start + _count++) % _width] = value;
+    }
+    else
+    {
+      _values[_start] = value;
+      _start = (_start + 1) % _width;
+    }
+
+    bool outOfRange = !isnan(value) && (isnan(_min) || value < _min || value > _max);
+    bool droppedLimit = !isnan(dropped) && (dropped == _min || dropped == _max);
+
+    if (outOfRange || droppedLimit)
+    {
+      float previousMin = _min;
+      float previousMax = _max;
+      updateRange();
+
+      // Scale changed, redraw the whole window.
+      if (_min != previousMin || _max != previousMax)
+      {
+        render();
+        return;
+      }
+    }
+
+    _sprite.scroll(-1, 0);
+    drawColumn(_width - 1, previous, value);
+  }
+
+  inline void pushSprite(int32_t x, int32_t y)
+  {
+    _sprite.pushSprite(x, y);
+  }
+};
+
+#endif
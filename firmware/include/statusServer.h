@@ -0,0 +1,283 @@
+// statusServer
+//
+// Small HTTP/1.0 server for read-only endpoints on the LAN. Requests are
+// served by a task on the core not running loop(), so a scrape never holds
+// up the display. Handlers print their response straight to the socket
+// through a small buffer, nothing is assembled in memory.
+//
+// Handlers read resident state without locking: a response may mix values
+// from before and after an update made by loop(). Around changes that free
+// memory handlers walk, loop() calls hold() and release(), requests in
+// between are answered with 503.
+//
+// Version 1.0
+
+#ifndef STATUS_SERVER_H
+#define STATUS_SERVER_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <atomic>
+
+class StatusServer
+{
+
+private:
+  static const int maxRoutes = 4;
+  static const size_t bufferSize = 512;
+  static const unsigned long requestTimeout = 2000;
+
+  struct Route
+  {
+    const char *path;
+    const char *contentType;
+    void (*handler)(Print &out);
+  };
+
+  // Collects small prints into TCP segments.
+  class Writer : public Print
+  {
+
+  private:
+    WiFiClient &_client;
+    uint8_t _buffer[bufferSize];
+    size_t _used = 0;
+
+  public:
+    Writer(WiFiClient &client) : _client(client)
+    {
+    }
+
+    size_t write(uint8_t c) override
+    {
+      return write(&c, 1);
+    }
+
+    size_t write(const uint8_t *data, size_t size) override
+    {
+      for (size_t done = 0; done < size;)
+      {
+        if (_used == bufferSize)
+        {
+          flush();
+        }
+        size_t n = min(size - done, bufferSize - _used);
+        memcpy(_buffer + _used, data + done, n);
+        _used += n;
+        done += n;
+      }
+      return size;
+    }
+
+    void flush() override
+    {
+      if (_used > 0)
+      {
+        _client.write(_buffer, _used);
+        _used = 0;
+      }
+    }
+  };
+
+  WiFiServer _server;
+  Route _routes[maxRoutes];
+  int _numRoutes = 0;
+  uint32_t _requests = 0;
+  uint32_t _errors = 0; // Bad requests, unknown paths and timeouts.
+  std::atomic<bool> _held{false};
+  std::atomic<bool> _serving{false};
+
+  static void task(void *parameter)
+  {
+    StatusServer *server = (StatusServer *)parameter;
+
+    while (1)
+    {
+      server->service();
+      vTaskDelay(pdMS_TO_TICKS(20));
+    }
+  }
+
+  // Reads a line without its line end, false on timeout or when too long.
+  static bool readLine(WiFiClient &client, char *line, size_t size, unsigned long start)
+  {
+    size_t length = 0;
+
+    while (millis() - start < requestTimeout)
+    {
+      if (!client.available())
+      {
+        if (!client.connected())
+        {
+          return false;
+        }
+        delay(1);
+        continue;
+      }
+
+      char c = client.read();
+      if (c == '\n')
+      {
+        line[length] = '\0';
+        return true;
+      }
+      if (c != '\r' && length + 1 < size)
+      {
+        line[length++] = c;
+      }
+    }
+    return false;
+  }
+
+  static void respond(Print &out, const char *status, const char *contentType)
+  {
+    out.printf("HTTP/1.0 %s\r\nContent-Type: %s\r\nCache-Control: no-store\r\nConnection: close\r\n\r\n", status, contentType);
+  }
+
+public:
+  StatusServer(uint16_t port = 80) : _server(port)
+  {
+  }
+
+  // Serves handler's output at path (up to maxRoutes paths).
+  void on(const char *path, const char *contentType, void (*handler)(Print &out))
+  {
+    if (_numRoutes < maxRoutes)
+    {
+      _routes[_numRoutes++] = {path, contentType, handler};
+    }
+  }
+
+  // Listens and starts the serving task on core 0.
+  void begin()
+  {
+    _server.begin();
+    _server.setNoDelay(true);
+    xTaskCreatePinnedToCore(task, "http", 4096, this, 1, nullptr, 0);
+  }
+
+  // Serves one waiting request, if any.
+  void service()
+  {
+    WiFiClient client = _server.available();
+    if (!client)
+    {
+      return;
+    }
+
+    unsigned long start = millis();
+    char request[96];
+    char header[96];
+    Writer out(client);
+
+    bool complete = readLine(client, request, sizeof(request), start);
+
+    // Headers are read and ignored, closing with unread data resets the connection.
+    while (complete && readLine(client, header, sizeof(header), start) && header[0] != '\0')
+    {
+    }
+
+    char *path = strchr(request, ' ');
+    const Route *route = nullptr;
+
+    if (complete && path != nullptr && !strncmp(request, "GET ", 4))
+    {
+      path++;
+      char *end = strpbrk(path, " ?");
+      if (end != nullptr)
+      {
+        *end = '\0';
+      }
+
+      for (int i = 0; i < _numRoutes; i++)
+      {
+        if (!strcmp(path, _routes[i].path))
+        {
+          route = &_routes[i];
+        }
+      }
+    }
+
+    _requests++;
+
+    // Flagged before checking hold(), which waits for the flag to clear.
+    _serving = true;
+
+    if (route != nullptr && _held)
+    {
+      respond(out, "503 Service Unavailable", "text/plain");
+      out.print("Busy\n");
+    }
+    else if (route != nullptr)
+    {
+      respond(out, "200 OK", route->contentType);
+      route->handler(out);
+    }
+    else if (complete)
+    {
+      _errors++;
+      respond(out, "404 Not Found", "text/plain");
+      out.print("Not found\n");
+    }
+    else
+    {
+      _errors++;
+    }
+
+    _serving = false;
+
+    out.flush();
+    client.stop();
+  }
+
+  // Waits for a handler running on the other core, handlers are not run
+  // until release().
+  void hold()
+  {
+    _held = true;
+    while (_serving)
+    {
+      delay(1);
+    }
+  }
+
+  inline void release()
+  {
+    _held = false;
+  }
+
+  // Prints text as a quoted JSON string.
+  static void printJson(Print &out, const char *text)
+  {
+    out.print('"');
+    for (const char *c = text; c != nullptr && *c != '\0'; c++)
+    {
+      if (*c == '"' || *c == '\\')
+      {
+        out.print('\\');
+        out.print(*c);
+      }
+      else if ((uint8_t)*c < 0x20)
+      {
+        out.printf("\\u%04x", *c);
+      }
+      else
+      {
+        out.print(*c);
+      }
+    }
+    out.print('"');
+  }
+
+  inline uint32_t requests()
+  {
+    return _requests;
+  }
+
+  inline uint32_t errors()
+  {
+    return _errors;
+  }
+};
+
+#endif
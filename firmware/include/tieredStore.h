@@ -0,0 +1,414 @@
+// tieredStore
+//
+// Two tier file store. The SD card (bulk tier) holds every file, mirrored
+// paths are also kept in internal flash (fast tier, e.g. LittleFS) so they
+// are read quickly and stay available when the SD card fails.
+//
+// The SD card is authoritative while it works: the first read of a
+// mirrored path goes to the SD card and updates flash when they differ,
+// later reads are served from RAM (staged writes) or flash, streamed
+// reads of staged contents from the SD card. When the SD card fails,
+// reads fall back to the flash copy.
+//
+// Writes go to the SD card at once. Flash writes are coalesced to limit
+// wear: the latest contents of a path are staged in RAM and written by
+// flush(), only when they differ from the flash copy.
+//
+// Version 1.0
+
+#ifndef TIERED_STORE_H
+#define TIERED_STORE_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include <vector>
+
+class TieredStore
+{
+
+private:
+  struct Entry
+  {
+    String path;
+    uint32_t hash;   // FNV-1a of the flash copy.
+    bool hashKnown;  // False until the flash copy was read or written.
+    bool current;    // Flash or staged contents match the SD card.
+    bool staged;     // Contents waiting for flush().
+    std::vector<uint8_t> contents;
+  };
+
+  fs::FS *_bulk = nullptr;
+  fs::FS *_fast = nullptr;
+  std::vector<String> _mirrored; // Paths, or directories when ending with '/'.
+  std::vector<Entry> _entries;
+  unsigned long _flushInterval = 600000;
+  size_t _maxStagedBytes = 16384;
+  size_t _stagedBytes = 0;
+  unsigned long _lastFlush = 0;
+
+  uint32_t _fastReads = 0;
+  uint32_t _bulkReads = 0;
+  uint32_t _fastWrites = 0;
+  uint32_t _savedWrites = 0; // Flash writes avoided (unchanged or coalesced).
+  uint32_t _bulkErrors = 0;
+
+  static uint32_t hash(const uint8_t *data, size_t size)
+  {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < size; i++)
+    {
+      h = (h ^ data[i]) * 16777619u;
+    }
+    return h;
+  }
+
+  // The SD card accepts "//locations/0.json", the entries must not.
+  static String normalize(const String &path)
+  {
+    String p = path;
+    while (p.indexOf("//") >= 0)
+    {
+      p.replace("//", "/");
+    }
+    return p;
+  }
+
+  static bool readAll(fs::FS &fs, const String &path, std::vector<uint8_t> &data)
+  {
+    File file = fs.open(path);
+    if (!file || file.isDirectory())
+    {
+      return false;
+    }
+
+    data.resize(file.size());
+    bool read = file.read(data.data(), data.size()) == data.size();
+    file.close();
+    return read;
+  }
+
+  bool isMirrored(const String &path)
+  {
+    for (const String &mirrored : _mirrored)
+    {
+      if (mirrored.endsWith("/") ? path.startsWith(mirrored) : path == mirrored)
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  Entry *find(const String &path)
+  {
+    for (Entry &entry : _entries)
+    {
+      if (entry.path == path)
+      {
+        return &entry;
+      }
+    }
+    return nullptr;
+  }
+
+  Entry &findOrAdd(const String &path)
+  {
+    Entry *entry = find(path);
+    if (entry == nullptr)
+    {
+      _entries.push_back({path, 0, false, false, false, {}});
+      entry = &_entries.back();
+    }
+    return *entry;
+  }
+
+  void unstage(Entry &entry)
+  {
+    if (entry.staged)
+    {
+      _stagedBytes -= entry.contents.size();
+      entry.staged = false;
+      std::vector<uint8_t>().swap(entry.contents);
+    }
+  }
+
+  void stage(const String &path, const uint8_t *data, size_t size)
+  {
+    Entry &entry = findOrAdd(path);
+    uint32_t h = hash(data, size);
+
+    if (!entry.hashKnown)
+    {
+      std::vector<uint8_t> current;
+      entry.hashKnown = true;
+      entry.hash = readAll(*_fast, path, current) ? hash(current.data(), current.size()) : 0;
+    }
+
+    if (entry.staged)
+    {
+      _savedWrites++; // Replaces a write not done yet.
+    }
+    unstage(entry);
+
+    entry.current = true;
+
+    if (h == entry.hash)
+    {
+      _savedWrites++; // Flash copy is current.
+      return;
+    }
+
+    entry.contents.assign(data, data + size);
+    entry.staged = true;
+    _stagedBytes += size;
+
+    if (_stagedBytes > _maxStagedBytes)
+    {
+      flush(true);
+    }
+  }
+
+  void writeFast(Entry &entry)
+  {
+    // Creates missing directories.
+    File file = _fast->open(entry.path, FILE_WRITE, true);
+    if (file && file.write(entry.contents.data(), entry.contents.size()) == entry.contents.size())
+    {
+      entry.hash = hash(entry.contents.data(), entry.contents.size());
+      _fastWrites++;
+    }
+    else
+    {
+      // Unknown contents, read from the SD card until written again.
+      entry.hash = 0;
+      entry.current = false;
+    }
+    file.close();
+    unstage(entry);
+  }
+
+  // Reads a mirrored file from the SD card, staging it for flash.
+  bool readBulk(const String &path, std::vector<uint8_t> &data)
+  {
+    if (!readAll(*_bulk, path, data))
+    {
+      return false;
+    }
+    _bulkReads++;
+    stage(path, data.data(), data.size());
+    return true;
+  }
+
+public:
+  // Without a fast tier (flash not mounted) all files are on the bulk tier.
+  void begin(fs::FS &bulk, fs::FS *fast, unsigned long flushInterval = 600000, size_t maxStagedBytes = 16384)
+  {
+    _bulk = &bulk;
+    _fast = fast;
+    _flushInterval = flushInterval;
+    _maxStagedBytes = maxStagedBytes;
+    _lastFlush = millis();
+  }
+
+  // Mirrors a file, or the files of a directory when the path ends with '/'.
+  void mirror(const String &path)
+  {
+    _mirrored.push_back(path);
+  }
+
+  inline bool hasFastTier()
+  {
+    return _fast != nullptr;
+  }
+
+  // Reads a whole file, false when it is in neither tier.
+  bool read(const String &path, std::vector<uint8_t> &data)
+  {
+    String p = normalize(path);
+
+    if (_fast == nullptr || !isMirrored(p))
+    {
+      return readAll(*_bulk, p, data);
+    }
+
+    Entry *entry = find(p);
+    if (entry != nullptr && entry->staged)
+    {
+      data = entry->contents;
+      _fastReads++;
+      return true;
+    }
+
+    if ((entry != nullptr && entry->current) || !readBulk(p, data))
+    {
+      // Current, or the SD card failed and the flash copy is all there is.
+      if (!readAll(*_fast, p, data))
+      {
+        return false;
+      }
+      _fastReads++;
+    }
+    return true;
+  }
+
+  bool read(const String &path, String *text)
+  {
+    std::vector<uint8_t> data;
+    if (!read(path, data))
+    {
+      return false;
+    }
+
+    data.push_back('\0');
+    *text = (const char *)data.data();
+    return true;
+  }
+
+  // Opens a file for streamed reading, from flash when the flash copy is
+  // current. Contents staged for flash are streamed from the SD card, the
+  // flash copy is only written early when the SD card fails.
+  File open(const String &path)
+  {
+    String p = normalize(path);
+
+    if (_fast == nullptr || !isMirrored(p))
+    {
+      return _bulk->open(p);
+    }
+
+    Entry *entry = find(p);
+    if (entry == nullptr || !entry->current)
+    {
+      std::vector<uint8_t> data;
+      readBulk(p, data);
+      entry = find(p);
+    }
+
+    if (entry != nullptr && entry->staged)
+    {
+      File file = _bulk->open(p);
+      if (file)
+      {
+        _bulkReads++;
+        return file;
+      }
+      writeFast(*entry);
+    }
+
+    File file = _fast->open(p);
+    if (file)
+    {
+      _fastReads++;
+      return file;
+    }
+    return _bulk->open(p);
+  }
+
+  // Writes a file to the SD card and stages it for flash when mirrored.
+  // True when stored in at least one tier, a failed SD card write is
+  // counted in bulkErrors().
+  bool write(const String &path, const uint8_t *data, size_t size)
+  {
+    String p = normalize(path);
+
+    File file = _bulk->open(p, FILE_WRITE);
+    bool written = file && file.write(data, size) == size;
+    file.close();
+
+    if (!written)
+    {
+      _bulkErrors++;
+    }
+
+    if (_fast != nullptr && isMirrored(p))
+    {
+      stage(p, data, size);
+      return true;
+    }
+    return written;
+  }
+
+  bool write(const String &path, const String &text)
+  {
+    return write(path, (const uint8_t *)text.c_str(), text.length());
+  }
+
+  // Reads a mirrored file from the SD card again with the next read, after
+  // it was changed on the SD card by other means than write().
+  void invalidate(const String &path)
+  {
+    Entry *entry = find(normalize(path));
+    if (entry != nullptr)
+    {
+      unstage(*entry);
+      entry->current = false;
+    }
+  }
+
+  // Removes a file from both tiers.
+  void remove(const String &path)
+  {
+    String p = normalize(path);
+
+    _bulk->remove(p);
+
+    Entry *entry = find(p);
+    if (entry != nullptr)
+    {
+      unstage(*entry);
+      entry->current = false;
+      entry->hash = 0;
+    }
+
+    if (_fast != nullptr && isMirrored(p))
+    {
+      _fast->remove(p);
+    }
+  }
+
+  // Writes staged files to flash, at most once per flush interval unless forced.
+  void flush(bool force = false)
+  {
+    if (_fast == nullptr || (!force && millis() - _lastFlush < _flushInterval))
+    {
+      return;
+    }
+    _lastFlush = millis();
+
+    for (Entry &entry : _entries)
+    {
+      if (entry.staged)
+      {
+        writeFast(entry);
+      }
+    }
+  }
+
+  inline uint32_t fastReads()
+  {
+    return _fastReads;
+  }
+
+  inline uint32_t bulkReads()
+  {
+    return _bulkReads;
+  }
+
+  inline uint32_t fastWrites()
+  {
+    return _fastWrites;
+  }
+
+  inline uint32_t savedWrites()
+  {
+    return _savedWrites;
+  }
+
+  // SD card writes that failed, check the SD card when this changes.
+  inline uint32_t bulkErrors()
+  {
+    return _bulkErrors;
+  }
+};
+
+#endif
@@ -0,0 +1,185 @@
+# Generates include/locationCatalogue.h from sd-card/locations.json.
+#
+# The header holds the strips, stations and locations as constexpr tables
+# (flash), plus the size and FNV-1a hash of the source file. At boot the
+# firmware uses the tables when the SD card's locations.json is missing or
+# identical to the source, and parses the file otherwise.
+#
+# Runs before each build (extra_scripts in platformio.ini), or by hand:
+#   python scripts/locationCatalogue.py [locations.json] [header]
+# Without a locations.json the header is removed and the firmware always
+# parses the SD card.
+
+import json
+import os
+import sys
+
+MAX_STRIPS = 8
+NUM_LEGEND_LEDS = 4
+DEFAULT_STRIP = {"pin": 27, "count": 27, "legend": 23}  # PIN_STRIP_LOCATIONS, defaultNumLEDs
+
+
+def fnv1a(data):
+    hash = 2166136261
+    for byte in data:
+        hash = ((hash ^ byte) * 16777619) & 0xFFFFFFFF
+    return hash
+
+
+def c_string(text):
+    out = '"'
+    for byte in text.encode("utf-8"):
+        char = chr(byte)
+        if char in '"\\':
+            out += "\\" + char
+        elif 32 <= byte < 127:
+            out += char
+        else:
+            out += "\\%03o" % byte
+    return out + '"'
+
+
+def fail(message):
+    raise ValueError("locations.json: " + message)
+
+
+# Same checks as InitLocationsFromSDCard(), so the tables need none at boot.
+def build_tables(catalogue):
+    strips = catalogue.get("strips") or [DEFAULT_STRIP]
+    if len(strips) > MAX_STRIPS:
+        fail("1 to %d strips required" % MAX_STRIPS)
+
+    first_leds = []
+    legend_led = -1
+    num_leds = 0
+    for index, strip in enumerate(strips):
+        if strip.get("count", 0) <= 0:
+            fail("strip %d: count required" % index)
+        if [s["pin"] for s in strips].count(strip.get("pin", 0)) > 1:
+            fail("strip %d: pin %d used twice" % (index, strip["pin"]))
+        if "legend" in strip:
+            legend = strip["legend"]
+            if legend_led >= 0 or legend < 0 or legend + NUM_LEGEND_LEDS > strip["count"]:
+                fail("strip %d: invalid legend %d" % (index, legend))
+            legend_led = num_leds + legend
+        first_leds.append(num_leds)
+        num_leds += strip["count"]
+
+    used = set(range(legend_led, legend_led + NUM_LEGEND_LEDS)) if legend_led >= 0 else set()
+    station_ids = []
+    location_stations = []
+    locations = []
+
+    for index, location in enumerate(catalogue.get("locations", [])):
+        ids = location.get("stationIds", [])
+        if not 0 < len(ids) <= 255 or not isinstance(location.get("shortName"), str):
+            fail("location %d: needs shortName and 1 to 255 stationIds" % index)
+
+        led = index
+        if "led" in location:
+            strip, pixel = location["led"]
+            led = first_leds[strip] + pixel if strip < len(strips) and pixel < strips[strip]["count"] else num_leds
+        if led >= num_leds or led in used:
+            fail("location %d: LED %d missing or used twice" % (index, led))
+        used.add(led)
+
+        first = len(location_stations)
+        for station_id in ids:
+            if station_id not in station_ids:
+                station_ids.append(station_id)
+            location_stations.append(station_ids.index(station_id))
+
+        locations.append((location["shortName"], location.get("area", ""), led, first, len(ids)))
+
+    if not locations:
+        fail("no locations")
+
+    return strips, legend_led, station_ids, location_stations, locations
+
+
+def generate(source, header):
+    with open(source, "rb") as file:
+        data = file.read()
+
+    strips, legend_led, station_ids, location_stations, locations = build_tables(json.loads(data))
+
+    lines = [
+        "// locationCatalogue",
+        "//",
+        "// Generated from %s by scripts/locationCatalogue.py, do not edit." % os.path.basename(source),
+        "",
+        "#ifndef LOCATION_CATALOGUE_H",
+        "#define LOCATION_CATALOGUE_H",
+        "",
+        "#include <Arduino.h>",
+        "",
+        "namespace catalogue",
+        "{",
+        "  struct StripEntry",
+        "  {",
+        "    uint8_t pin;",
+        "    uint16_t count;",
+        "  };",
+        "",
+        "  struct LocationEntry",
+        "  {",
+        "    const char *shortName;",
+        "    const char *area;",
+        "    uint16_t led;",
+        "    uint16_t firstStationId; // First entry in locationStations.",
+        "    uint8_t numStationIds;",
+        "  };",
+        "",
+        "  constexpr uint32_t sourceSize = %d;" % len(data),
+        "  constexpr uint32_t sourceHash = 0x%08x; // FNV-1a of the file." % fnv1a(data),
+        "",
+        "  constexpr StripEntry strips[] = {%s};" % ", ".join("{%d, %d}" % (s["pin"], s["count"]) for s in strips),
+        "  constexpr int legendLed = %d;" % legend_led,
+        "",
+        "  constexpr const char *stationIds[] = {%s};" % ", ".join(c_string(id) for id in station_ids),
+        "  constexpr uint16_t locationStations[] = {%s};" % ", ".join(str(i) for i in location_stations),
+        "",
+        "  constexpr LocationEntry locations[] = {",
+    ]
+    lines += ["    {%s, %s, %d, %d, %d}," % (c_string(name), c_string(area), led, first, count) for name, area, led, first, count in locations]
+    lines += [
+        "  };",
+        "}",
+        "",
+        "#endif",
+        "",
+    ]
+    text = "\n".join(lines)
+
+    # Unchanged headers keep their timestamp, so nothing is rebuilt.
+    if os.path.exists(header):
+        with open(header) as file:
+            if file.read() == text:
+                return
+    with open(header, "w") as file:
+        file.write(text)
+    print("Generated %s (%d locations, %d stations)" % (header, len(locations), len(station_ids)))
+
+
+def run(source, header):
+    if not os.path.exists(source):
+        if os.path.exists(header):
+            os.remove(header)
+        print("No %s, locations are read from the SD card only" % source)
+        return
+    generate(source, header)
+
+
+try:
+    Import("env")
+    project = env.subst("$PROJECT_DIR")
+    try:
+        run(os.path.join(project, "..", "sd-card", "locations.json"), os.path.join(project, "include", "locationCatalogue.h"))
+    except ValueError as error:
+        sys.stderr.write("Error: %s\n" % error)
+        env.Exit(1)
+except NameError:
+    if __name__ == "__main__":
+        here = os.path.dirname(os.path.abspath(__file__))
+        run(sys.argv[1] if len(sys.argv) > 1 else os.path.join(here, "..", "..", "sd-card", "locations.json"),
+            sys.argv[2] if len(sys.argv) > 2 else os.path.join(here, "..", "include", "locationCatalogue.h"))
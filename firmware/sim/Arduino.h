@@ -0,0 +1,369 @@
+// Host shim of the Arduino core API used by the firmware (simulator).
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <math.h>
+#include <string>
+#include <algorithm>
+
+using std::max;
+using std::min;
+
+#define IRAM_ATTR
+#define RTC_NOINIT_ATTR
+#define RTC_DATA_ATTR
+
+// esp_system.h
+typedef enum
+{
+  ESP_RST_UNKNOWN,
+  ESP_RST_POWERON,
+  ESP_RST_EXT,
+  ESP_RST_SW,
+  ESP_RST_PANIC,
+  ESP_RST_INT_WDT,
+  ESP_RST_TASK_WDT,
+  ESP_RST_WDT,
+  ESP_RST_DEEPSLEEP,
+  ESP_RST_BROWNOUT,
+  ESP_RST_SDIO
+} esp_reset_reason_t;
+
+#define F(s) (s)
+#define PROGMEM
+#define HIGH 1
+#define LOW 0
+#define INPUT 0x01
+#define OUTPUT 0x02
+#define INPUT_PULLUP 0x05
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+#define DEC 10
+#define HEX 16
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#ifndef PI
+#define PI 3.1415926535897932384626433832795
+#endif
+#define radians(deg) ((deg) * PI / 180.0)
+#define degrees(rad) ((rad) * 180.0 / PI)
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+namespace sim
+{
+  // Virtual clock in microseconds, advanced by delay() and the modelled
+  // cost of SD, display, LED and network operations.
+  extern uint64_t clockMicros;
+  void advance(uint64_t micros);
+
+  // Earliest millis() at which a simulated operation (WiFi connect, scan)
+  // completes, polled by loop() without waiting.
+  void nextDeadline(unsigned long ms);
+
+  // Idle wait of the power manager: advances the clock to ms or the next
+  // button edge, true when woken by the edge.
+  bool sleepUntil(unsigned long ms);
+}
+
+// FreeRTOS subset (the ESP32 Arduino.h includes FreeRTOS).
+typedef void *TaskHandle_t;
+typedef uint32_t TickType_t;
+typedef unsigned int UBaseType_t;
+typedef int BaseType_t;
+typedef void (*TaskFunction_t)(void *);
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define portTICK_PERIOD_MS 1
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stackDepth, void *parameter, UBaseType_t priority, TaskHandle_t *handle, BaseType_t core);
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+#define portENTER_CRITICAL_ISR(mux) ((void)(mux))
+#define portEXIT_CRITICAL_ISR(mux) ((void)(mux))
+BaseType_t xTaskCreate(TaskFunction_t task, const char *name, uint32_t stackDepth, void *parameter, UBaseType_t priority, TaskHandle_t *handle);
+void vTaskDelay(TickType_t ticks);
+void vTaskDelete(TaskHandle_t task);
+TickType_t xTaskGetTickCount();
+TaskHandle_t xTaskGetCurrentTaskHandle();
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+#define portYIELD_FROM_ISR()
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+int digitalPinToInterrupt(uint8_t pin);
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode);
+void attachInterruptArg(uint8_t pin, void (*handler)(void *), void *arg, int mode);
+void detachInterrupt(uint8_t pin);
+
+double ledcSetup(uint8_t channel, double freq, uint8_t resolution);
+void ledcAttachPin(uint8_t pin, uint8_t channel);
+void ledcWrite(uint8_t channel, uint32_t duty);
+
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+bool setCpuFrequencyMhz(uint32_t mhz);
+uint32_t getCpuFrequencyMhz();
+
+// Heap figures are nominal.
+class EspClass
+{
+public:
+  uint32_t getFreeHeap() { return 180000; }
+  uint32_t getMinFreeHeap() { return 150000; }
+  uint32_t getMaxAllocHeap() { return 110000; }
+};
+
+extern EspClass ESP;
+
+class __FlashStringHelper;
+
+class String
+{
+private:
+  std::string _s;
+
+public:
+  String() {}
+  String(const char *s) : _s(s ? s : "") {}
+  String(const char *s, size_t n) : _s(s, n) {}
+  String(const std::string &s) : _s(s) {}
+  explicit String(char c) : _s(1, c) {}
+  explicit String(int v, unsigned char base = 10);
+  explicit String(unsigned int v, unsigned char base = 10);
+  explicit String(long v, unsigned char base = 10);
+  explicit String(unsigned long v, unsigned char base = 10);
+  explicit String(float v, unsigned int decimals = 2);
+  explicit String(double v, unsigned int decimals = 2);
+
+  unsigned int length() const { return _s.size(); }
+  bool isEmpty() const { return _s.empty(); }
+  const char *c_str() const { return _s.c_str(); }
+  char *begin() { return &_s[0]; }
+  char *end() { return &_s[0] + _s.size(); }
+  bool reserve(unsigned int size)
+  {
+    _s.reserve(size);
+    return true;
+  }
+
+  String &operator=(const char *s)
+  {
+    _s = s ? s : "";
+    return *this;
+  }
+  String &operator+=(const String &rhs)
+  {
+    _s += rhs._s;
+    return *this;
+  }
+  String &operator+=(const char *rhs)
+  {
+    _s += rhs;
+    return *this;
+  }
+  String &operator+=(char c)
+  {
+    _s += c;
+    return *this;
+  }
+  String &operator+=(int v) { return *this += String(v); }
+  String &operator+=(unsigned int v) { return *this += String(v); }
+  String &operator+=(long v) { return *this += String(v); }
+  String &operator+=(unsigned long v) { return *this += String(v); }
+  bool concat(const char *s, unsigned int n)
+  {
+    _s.append(s, n);
+    return true;
+  }
+  bool concat(const String &s)
+  {
+    _s += s._s;
+    return true;
+  }
+  bool concat(char c)
+  {
+    _s += c;
+    return true;
+  }
+
+  friend String operator+(const String &a, const String &b) { return String(a._s + b._s); }
+  friend String operator+(const String &a, const char *b) { return String(a._s + b); }
+  friend String operator+(const char *a, const String &b) { return String(a + b._s); }
+  friend String operator+(const String &a, char b) { return String(a._s + b); }
+  friend String operator+(const String &a, int b) { return a + String(b); }
+  friend String operator+(const String &a, unsigned int b) { return a + String(b); }
+  friend String operator+(const String &a, long b) { return a + String(b); }
+  friend String operator+(const String &a, unsigned long b) { return a + String(b); }
+
+  bool operator==(const String &rhs) const { return _s == rhs._s; }
+  bool operator==(const char *rhs) const { return _s == rhs; }
+  bool operator!=(const String &rhs) const { return _s != rhs._s; }
+  bool operator!=(const char *rhs) const { return _s != rhs; }
+  bool operator<(const String &rhs) const { return _s < rhs._s; }
+  bool equals(const String &rhs) const { return _s == rhs._s; }
+  bool equalsIgnoreCase(const String &rhs) const;
+  int compareTo(const String &rhs) const { return _s.compare(rhs._s); }
+  bool startsWith(const String &prefix) const { return _s.compare(0, prefix._s.size(), prefix._s) == 0; }
+  bool endsWith(const String &suffix) const
+  {
+    return _s.size() >= suffix._s.size() && _s.compare(_s.size() - suffix._s.size(), suffix._s.size(), suffix._s) == 0;
+  }
+
+  char charAt(unsigned int i) const { return i < _s.size() ? _s[i] : 0; }
+  char operator[](unsigned int i) const { return charAt(i); }
+  char &operator[](unsigned int i) { return _s[i]; }
+
+  int indexOf(char c, unsigned int from = 0) const;
+  int indexOf(const String &s, unsigned int from = 0) const;
+  int lastIndexOf(char c) const;
+  String substring(unsigned int from) const;
+  String substring(unsigned int from, unsigned int to) const;
+  void trim();
+  void toLowerCase();
+  void toUpperCase();
+  void replace(const String &find, const String &with);
+  void remove(unsigned int index);
+  void remove(unsigned int index, unsigned int count);
+  long toInt() const { return atol(_s.c_str()); }
+  float toFloat() const { return (float)atof(_s.c_str()); }
+  double toDouble() const { return atof(_s.c_str()); }
+  void getBytes(unsigned char *buf, unsigned int len, unsigned int index = 0) const;
+
+  // ArduinoJson writer/reader support.
+  size_t write(uint8_t c)
+  {
+    _s += (char)c;
+    return 1;
+  }
+  size_t write(const uint8_t *buf, size_t n)
+  {
+    _s.append((const char *)buf, n);
+    return n;
+  }
+};
+
+class Print
+{
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buf, size_t size);
+  size_t write(const char *str) { return str ? write((const uint8_t *)str, strlen(str)) : 0; }
+  size_t write(const char *buf, size_t size) { return write((const uint8_t *)buf, size); }
+
+  size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+  size_t vprintf(const char *format, va_list args);
+  size_t print(const String &s) { return write(s.c_str(), s.length()); }
+  size_t print(const char *s) { return write(s); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int v, int base = DEC);
+  size_t print(unsigned int v, int base = DEC);
+  size_t print(long v, int base = DEC);
+  size_t print(unsigned long v, int base = DEC);
+  size_t print(double v, int digits = 2);
+  size_t println() { return print("\r\n"); }
+  template <typename T>
+  size_t println(const T &v)
+  {
+    size_t n = print(v);
+    return n + println();
+  }
+  template <typename T>
+  size_t println(const T &v, int fmt)
+  {
+    size_t n = print(v, fmt);
+    return n + println();
+  }
+  virtual void flush() {}
+};
+
+class Stream : public Print
+{
+protected:
+  unsigned long _timeout = 1000;
+  int timedRead();
+  int timedPeek();
+
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  virtual size_t readBytes(char *buffer, size_t length);
+  virtual size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *)buffer, length); }
+  void setTimeout(unsigned long timeout) { _timeout = timeout; }
+  unsigned long getTimeout() const { return _timeout; }
+  bool find(const char *target);
+  bool findUntil(const char *target, const char *terminator);
+  String readString();
+  String readStringUntil(char terminator);
+};
+
+class HardwareSerial : public Stream
+{
+public:
+  void begin(unsigned long baud) { (void)baud; }
+  void end() {}
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+  int availableForWrite() { return 4096; }
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t *buf, size_t size) override;
+  using Print::write;
+  operator bool() const { return true; }
+};
+
+extern HardwareSerial Serial;
+
+class IPAddress : public Print
+{
+private:
+  uint8_t _octets[4] = {0, 0, 0, 0};
+
+public:
+  IPAddress() {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+  {
+    _octets[0] = a;
+    _octets[1] = b;
+    _octets[2] = c;
+    _octets[3] = d;
+  }
+  IPAddress(uint32_t address) { memcpy(_octets, &address, 4); }
+  operator uint32_t() const
+  {
+    uint32_t address;
+    memcpy(&address, _octets, 4);
+    return address;
+  }
+  uint8_t operator[](int i) const { return _octets[i]; }
+  uint8_t &operator[](int i) { return _octets[i]; }
+  bool operator==(const IPAddress &rhs) const { return memcmp(_octets, rhs._octets, 4) == 0; }
+  bool fromString(const char *address);
+  String toString() const;
+  size_t write(uint8_t) override { return 0; }
+};
+
+#endif
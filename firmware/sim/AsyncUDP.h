@@ -0,0 +1,43 @@
+// Host shim of the ESP32 AsyncUDP library (simulator).
+#ifndef SIM_ASYNCUDP_H
+#define SIM_ASYNCUDP_H
+
+#include <Arduino.h>
+#include <functional>
+
+class AsyncUDPPacket
+{
+public:
+  AsyncUDPPacket(const uint8_t *data, size_t length, IPAddress remote) : _data(data), _length(length), _remote(remote) {}
+  const uint8_t *data() { return _data; }
+  size_t length() { return _length; }
+  IPAddress remoteIP() { return _remote; }
+
+private:
+  const uint8_t *_data;
+  size_t _length;
+  IPAddress _remote;
+};
+
+typedef std::function<void(AsyncUDPPacket &packet)> AuPacketHandlerFunction;
+
+class AsyncUDP
+{
+public:
+  ~AsyncUDP() { close(); }
+  bool listenMulticast(const IPAddress &address, uint16_t port, uint8_t ttl = 1);
+  void onPacket(AuPacketHandlerFunction callback) { _handler = callback; }
+  size_t writeTo(const uint8_t *data, size_t length, const IPAddress &address, uint16_t port);
+  void close();
+
+  // Simulator hook: hands queued host datagrams to the handler (the UDP
+  // task on the device).
+  void poll();
+
+private:
+  AuPacketHandlerFunction _handler;
+  int _fd = -1;
+  bool _listening = false;
+};
+
+#endif
@@ -0,0 +1,84 @@
+// Host shim of the FastLED library capturing LED frames (simulator).
+#ifndef SIM_FASTLED_H
+#define SIM_FASTLED_H
+
+#include <Arduino.h>
+
+struct CRGB
+{
+  union
+  {
+    struct
+    {
+      uint8_t r, g, b;
+    };
+    uint8_t raw[3];
+  };
+
+  enum HTMLColorCode
+  {
+    Black = 0x000000,
+    Blue = 0x0000FF,
+    Green = 0x008000,
+    Red = 0xFF0000,
+    Yellow = 0xFFFF00,
+    White = 0xFFFFFF
+  };
+
+  CRGB() : r(0), g(0), b(0) {}
+  CRGB(uint8_t ir, uint8_t ig, uint8_t ib) : r(ir), g(ig), b(ib) {}
+  CRGB(uint32_t colorcode) : r((colorcode >> 16) & 0xFF), g((colorcode >> 8) & 0xFF), b(colorcode & 0xFF) {}
+  CRGB(HTMLColorCode colorcode) : CRGB((uint32_t)colorcode) {}
+  CRGB &operator=(uint32_t colorcode)
+  {
+    r = (colorcode >> 16) & 0xFF;
+    g = (colorcode >> 8) & 0xFF;
+    b = colorcode & 0xFF;
+    return *this;
+  }
+  bool operator==(const CRGB &rhs) const { return r == rhs.r && g == rhs.g && b == rhs.b; }
+  bool operator!=(const CRGB &rhs) const { return !(*this == rhs); }
+};
+
+enum EOrder
+{
+  RGB = 0012,
+  GRB = 0102
+};
+
+class APA106
+{
+};
+
+class CLEDController
+{
+public:
+  CRGB *leds = nullptr;
+  int count = 0;
+  uint8_t pin = 0;
+};
+
+class CFastLED
+{
+public:
+  template <typename CHIPSET, uint8_t DATA_PIN>
+  CLEDController &addLeds(CRGB *data, int nLedsOrOffset, int nLedsIfOffset = 0)
+  {
+    return addController(DATA_PIN, data, nLedsIfOffset > 0 ? nLedsIfOffset : nLedsOrOffset);
+  }
+  void setBrightness(uint8_t scale) { _brightness = scale; }
+  uint8_t getBrightness() const { return _brightness; }
+  void show();
+  int count() const { return _count; }
+  CLEDController &operator[](int i) { return _controllers[i]; }
+
+private:
+  CLEDController &addController(uint8_t pin, CRGB *data, int count);
+  CLEDController _controllers[8];
+  int _count = 0;
+  uint8_t _brightness = 255;
+};
+
+extern CFastLED FastLED;
+
+#endif
@@ -0,0 +1,55 @@
+// Host shim of the ESP32 HTTPClient library (simulator).
+#ifndef SIM_HTTPCLIENT_H
+#define SIM_HTTPCLIENT_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <vector>
+
+#define HTTPC_ERROR_CONNECTION_REFUSED (-1)
+#define HTTPC_ERROR_SEND_HEADER_FAILED (-2)
+#define HTTPC_ERROR_SEND_PAYLOAD_FAILED (-3)
+#define HTTPC_ERROR_NOT_CONNECTED (-4)
+#define HTTPC_ERROR_CONNECTION_LOST (-5)
+#define HTTPC_ERROR_NO_STREAM (-6)
+#define HTTPC_ERROR_NO_HTTP_SERVER (-7)
+#define HTTPC_ERROR_TOO_LESS_RAM (-8)
+#define HTTPC_ERROR_ENCODING (-9)
+#define HTTPC_ERROR_STREAM_WRITE (-10)
+#define HTTPC_ERROR_READ_TIMEOUT (-11)
+
+#define HTTP_CODE_OK 200
+#define HTTP_CODE_NOT_MODIFIED 304
+#define HTTP_CODE_NOT_FOUND 404
+
+class HTTPClient
+{
+public:
+  HTTPClient();
+  ~HTTPClient();
+  bool begin(String url);
+  bool begin(WiFiClient &client, String url);
+  bool begin(WiFiClient &client, String host, uint16_t port, String uri = "/", bool https = false);
+  void end();
+  bool connected();
+  void setReuse(bool reuse);
+  void setTimeout(uint16_t timeout);
+  void setConnectTimeout(int32_t connectTimeout);
+  void useHTTP10(bool usehttp10 = true);
+  void addHeader(const String &name, const String &value, bool first = false, bool replace = true);
+  void collectHeaders(const char *headerKeys[], const size_t headerKeysCount);
+  String header(const char *name);
+  bool hasHeader(const char *name);
+  int GET();
+  int getSize();
+  WiFiClient &getStream();
+  WiFiClient *getStreamPtr();
+  String getString();
+  static String errorToString(int error);
+
+private:
+  struct Impl;
+  Impl *_impl;
+};
+
+#endif
@@ -0,0 +1,24 @@
+// Host shim of the ESP32 LittleFS library backed by an in-memory filesystem (simulator).
+#ifndef SIM_LITTLEFS_H
+#define SIM_LITTLEFS_H
+
+#include "FS.h"
+
+namespace fs
+{
+  class LittleFSFS : public FS
+  {
+  public:
+    LittleFSFS();
+    bool begin(bool formatOnFail = false, const char *basePath = "/littlefs", uint8_t maxOpenFiles = 10, const char *partitionLabel = "spiffs");
+    void end();
+    bool format();
+    size_t totalBytes();
+    size_t usedBytes();
+  };
+}
+
+extern fs::LittleFSFS LittleFS;
+using namespace fs;
+
+#endif
@@ -0,0 +1,28 @@
+// Host shim of the ESP32 Preferences (NVS) library (simulator).
+#ifndef SIM_PREFERENCES_H
+#define SIM_PREFERENCES_H
+
+#include <Arduino.h>
+
+class Preferences
+{
+public:
+  bool begin(const char *name, bool readOnly = false);
+  void end();
+  bool clear();
+  bool remove(const char *key);
+  size_t putInt(const char *key, int32_t value);
+  size_t putUInt(const char *key, uint32_t value);
+  size_t putString(const char *key, const String &value);
+  size_t putBytes(const char *key, const void *value, size_t len);
+  int32_t getInt(const char *key, int32_t defaultValue = 0);
+  uint32_t getUInt(const char *key, uint32_t defaultValue = 0);
+  String getString(const char *key, String defaultValue = String());
+  size_t getBytes(const char *key, void *buf, size_t maxLen);
+  bool isKey(const char *key);
+
+private:
+  String _namespace;
+};
+
+#endif
@@ -0,0 +1,24 @@
+// Host shim of the ESP32 SD library backed by an in-memory filesystem (simulator).
+#ifndef SIM_SD_H
+#define SIM_SD_H
+
+#include "FS.h"
+
+namespace fs
+{
+  class SDFS : public FS
+  {
+  public:
+    SDFS();
+    bool begin(uint8_t ssPin = 5);
+    void end();
+    uint64_t cardSize();
+    uint64_t totalBytes();
+    uint64_t usedBytes();
+  };
+}
+
+extern fs::SDFS SD;
+using namespace fs;
+
+#endif
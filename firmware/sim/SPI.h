@@ -0,0 +1 @@
+// Host shim of the Arduino SPI library (simulator).
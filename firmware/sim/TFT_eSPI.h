@@ -0,0 +1,132 @@
+// Host shim of the TFT_eSPI library rendering into a framebuffer (simulator).
+// Text is drawn as solid glyph boxes, the printed strings are kept per
+// cursor position so screens can be reported as text.
+#ifndef SIM_TFT_ESPI_H
+#define SIM_TFT_ESPI_H
+
+#include <Arduino.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#define ILI9488_DRIVER
+#define TFT_WIDTH 320
+#define TFT_HEIGHT 480
+
+#define TFT_BLACK 0x0000
+#define TFT_NAVY 0x000F
+#define TFT_DARKGREEN 0x03E0
+#define TFT_DARKCYAN 0x03EF
+#define TFT_MAROON 0x7800
+#define TFT_PURPLE 0x780F
+#define TFT_OLIVE 0x7BE0
+#define TFT_LIGHTGREY 0xD69A
+#define TFT_DARKGREY 0x7BEF
+#define TFT_BLUE 0x001F
+#define TFT_GREEN 0x07E0
+#define TFT_CYAN 0x07FF
+#define TFT_RED 0xF800
+#define TFT_MAGENTA 0xF81F
+#define TFT_YELLOW 0xFFE0
+#define TFT_WHITE 0xFFFF
+#define TFT_ORANGE 0xFDA0
+
+#define TL_DATUM 0
+#define TC_DATUM 1
+#define MC_DATUM 4
+
+class TFT_eSPI : public Print
+{
+public:
+  TFT_eSPI(int16_t w = TFT_WIDTH, int16_t h = TFT_HEIGHT);
+  virtual ~TFT_eSPI() {}
+  void begin() { init(); }
+  void init();
+  void setRotation(uint8_t r);
+  int16_t width() const { return _width; }
+  int16_t height() const { return _height; }
+  void fillScreen(uint32_t color) { fillRect(0, 0, _width, _height, color); }
+  void drawPixel(int32_t x, int32_t y, uint32_t color) { fillRect(x, y, 1, 1, color); }
+  void fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color);
+  void drawRect(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color);
+  void drawFastVLine(int32_t x, int32_t y, int32_t h, uint32_t color) { fillRect(x, y, 1, h, color); }
+  void drawFastHLine(int32_t x, int32_t y, int32_t w, uint32_t color) { fillRect(x, y, w, 1, color); }
+  void drawLine(int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint32_t color);
+  uint16_t readPixel(int32_t x, int32_t y);
+  void setTextSize(uint8_t size) { textsize = size > 0 ? size : 1; }
+  void setTextColor(uint16_t color) { textcolor = textbgcolor = color; }
+  void setTextColor(uint16_t fg, uint16_t bg) { textcolor = fg; textbgcolor = bg; }
+  void setTextPadding(uint16_t width) { padX = width; }
+  void setTextDatum(uint8_t datum) { textdatum = datum; }
+  void setCursor(int16_t x, int16_t y) { cursor_x = x; cursor_y = y; }
+  int16_t drawString(const char *string, int32_t x, int32_t y);
+  int16_t drawString(const String &string, int32_t x, int32_t y) { return drawString(string.c_str(), x, y); }
+  int16_t textWidth(const char *string) { return strlen(string) * 6 * textsize; }
+  int16_t fontHeight() { return 8 * textsize; }
+  size_t write(uint8_t c) override;
+  using Print::write;
+
+  void startWrite() {}
+  void endWrite() {}
+  bool initDMA(bool ctrl_cs = false) { return true; }
+  void deInitDMA() {}
+  bool dmaBusy() { return false; }
+  void dmaWait() {}
+  void pushImage(int32_t x, int32_t y, int32_t w, int32_t h, const uint16_t *data);
+  void pushImageDMA(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t *data, uint16_t *buffer = nullptr) { pushImage(x, y, w, h, data); }
+  void setSwapBytes(bool swap) { _swapBytes = swap; }
+  bool getSwapBytes() const { return _swapBytes; }
+  uint16_t color565(uint8_t r, uint8_t g, uint8_t b) { return ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3); }
+
+  int16_t textsize = 1;
+  uint16_t textcolor = TFT_WHITE, textbgcolor = TFT_WHITE;
+  int32_t cursor_x = 0, cursor_y = 0, padX = 0;
+  uint8_t textdatum = TL_DATUM;
+
+  // Simulator: frame and printed text.
+  const std::vector<uint16_t> &frame() const { return _frame; }
+  std::string text() const;
+  void copyText(const TFT_eSPI &source, int32_t x, int32_t y);
+
+protected:
+  int16_t _width, _height;
+  bool _isSprite = false;
+  bool _swapBytes = false;
+  std::vector<uint16_t> _frame;
+
+  // Text runs by (y, x) of their first character.
+  std::map<std::pair<int32_t, int32_t>, std::string> _text;
+  int32_t _runX = -1, _runY = -1, _runNextX = -1;
+
+  virtual uint16_t mapColor(uint32_t color) { return color; }
+  bool clip(int32_t &x, int32_t &y, int32_t &w, int32_t &h);
+  void paint(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color);
+  void countPixels(uint64_t pixels);
+};
+
+class TFT_eSprite : public TFT_eSPI
+{
+public:
+  explicit TFT_eSprite(TFT_eSPI *tft) : TFT_eSPI(0, 0), _tft(tft) { _isSprite = true; }
+  void *createSprite(int16_t w, int16_t h, uint8_t frames = 1);
+  void deleteSprite();
+  bool created() const { return _created; }
+  void *getPointer() { return _created ? (void *)_frame.data() : nullptr; }
+  void setColorDepth(int8_t bpp) { _bpp = bpp; }
+  int8_t getColorDepth() const { return _bpp; }
+  void setBitmapColor(uint16_t fg, uint16_t bg) { _fg = fg; _bg = bg; }
+  void fillSprite(uint32_t color) { fillScreen(color); }
+  void scroll(int16_t dx, int16_t dy = 0);
+  void pushSprite(int32_t x, int32_t y);
+
+private:
+  TFT_eSPI *_tft;
+  bool _created = false;
+  int8_t _bpp = 16;
+  uint16_t _fg = TFT_WHITE, _bg = TFT_BLACK;
+
+  // 1 bit sprites store 0 or 1 per pixel.
+  uint16_t mapColor(uint32_t color) override { return _bpp == 1 ? color != 0 : color; }
+};
+
+#endif
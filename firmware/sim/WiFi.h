@@ -0,0 +1,114 @@
+// Host shim of the ESP32 WiFi library (simulator).
+#ifndef SIM_WIFI_H
+#define SIM_WIFI_H
+
+#include <Arduino.h>
+
+typedef enum
+{
+  WL_NO_SHIELD = 255,
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_SCAN_COMPLETED = 2,
+  WL_CONNECTED = 3,
+  WL_CONNECT_FAILED = 4,
+  WL_CONNECTION_LOST = 5,
+  WL_DISCONNECTED = 6
+} wl_status_t;
+
+#define WIFI_SCAN_RUNNING (-1)
+#define WIFI_SCAN_FAILED (-2)
+
+typedef enum
+{
+  WIFI_OFF = 0,
+  WIFI_STA = 1,
+  WIFI_AP = 2,
+  WIFI_AP_STA = 3
+} wifi_mode_t;
+
+typedef enum
+{
+  WIFI_PS_NONE,
+  WIFI_PS_MIN_MODEM,
+  WIFI_PS_MAX_MODEM
+} wifi_ps_type_t;
+
+class WiFiClient : public Stream
+{
+public:
+  WiFiClient();
+  explicit WiFiClient(int fd) : _fd(fd) {}
+  virtual ~WiFiClient();
+  virtual int connect(IPAddress ip, uint16_t port);
+  virtual int connect(const char *host, uint16_t port);
+  int connect(IPAddress ip, uint16_t port, int32_t timeout) { return connect(ip, port); }
+  int connect(const char *host, uint16_t port, int32_t timeout) { return connect(host, port); }
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t *buf, size_t size) override;
+  using Print::write;
+  int available() override;
+  int read() override;
+  int read(uint8_t *buf, size_t size);
+  int peek() override;
+  void flush() override {}
+  virtual void stop();
+  virtual uint8_t connected();
+  operator bool() { return connected(); }
+  int fd() const { return _fd; }
+  int setNoDelay(bool nodelay) { return 0; }
+  IPAddress remoteIP() const;
+
+  // Simulator hooks: a host socket accepted by WiFiServer, or a connected
+  // in-process peer.
+  int _fd = -1;
+  void *_sim = nullptr;
+};
+
+class WiFiServer
+{
+public:
+  WiFiServer(uint16_t port = 80, uint8_t maxClients = 4) : _port(port) {}
+  void begin(uint16_t port = 0);
+  WiFiClient available();
+  void setNoDelay(bool nodelay) {}
+  void end();
+
+private:
+  uint16_t _port;
+  int _fd = -1;
+};
+
+class WiFiClass
+{
+public:
+  wl_status_t begin(const char *ssid, const char *passphrase = NULL, int32_t channel = 0, const uint8_t *bssid = NULL, bool connect = true);
+  wl_status_t status();
+  bool disconnect(bool wifioff = false, bool eraseap = false);
+  bool reconnect();
+  bool mode(wifi_mode_t mode);
+  bool setAutoReconnect(bool autoReconnect);
+  bool setSleep(bool enable);
+  bool setSleep(wifi_ps_type_t type);
+  bool persistent(bool persistent) { return true; }
+  IPAddress localIP();
+  String macAddress();
+  uint8_t *macAddress(uint8_t *mac);
+  int8_t RSSI();
+  uint8_t *BSSID();
+  String BSSIDstr();
+  int32_t channel();
+  String SSID() const;
+  int16_t scanNetworks(bool async = false, bool show_hidden = false, bool passive = false, uint32_t max_ms_per_chan = 300, uint8_t channel = 0);
+  int16_t scanComplete();
+  void scanDelete();
+  String SSID(uint8_t networkItem);
+  int32_t RSSI(uint8_t networkItem);
+  uint8_t *BSSID(uint8_t networkItem);
+  int32_t channel(uint8_t networkItem);
+  int hostByName(const char *host, IPAddress &result);
+};
+
+extern WiFiClass WiFi;
+
+#endif
@@ -0,0 +1,16 @@
+// Host shim of the ESP32 WiFiClientSecure (simulator): plain connections,
+// the TLS handshake costs two more round trips.
+#ifndef SIM_WIFICLIENTSECURE_H
+#define SIM_WIFICLIENTSECURE_H
+
+#include <WiFi.h>
+
+class WiFiClientSecure : public WiFiClient
+{
+public:
+  void setInsecure() {}
+  void setCACert(const char *rootCA) {}
+  int connect(const char *host, uint16_t port, int32_t timeout);
+};
+
+#endif
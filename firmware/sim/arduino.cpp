@@ -0,0 +1,574 @@
+// Arduino core for the simulator: virtual clock, GPIO, String, Print and Stream.
+
+#include "sim.h"
+#include <limits.h>
+
+namespace sim
+{
+  uint64_t clockMicros = 0;
+  uint64_t endMicros = UINT64_MAX;
+  static unsigned long deadline = ULONG_MAX;
+
+  void advance(uint64_t micros)
+  {
+    clockMicros += micros;
+
+    if (clockMicros >= endMicros)
+    {
+      finish();
+    }
+  }
+
+  void nextDeadline(unsigned long ms)
+  {
+    deadline = min(deadline, ms);
+  }
+
+  unsigned long takeDeadline()
+  {
+    unsigned long ms = deadline;
+    deadline = ULONG_MAX;
+    return ms;
+  }
+
+  struct Interrupt
+  {
+    void (*handler)(void *);
+    void *arg;
+    int mode;
+  };
+
+  static std::map<uint8_t, int> levels;
+  static std::map<uint8_t, Interrupt> interrupts;
+
+  void setPinLevel(uint8_t pin, int level)
+  {
+    int old = digitalRead(pin);
+    levels[pin] = level;
+
+    auto it = interrupts.find(pin);
+    if (it == interrupts.end() || old == level)
+    {
+      return;
+    }
+
+    int mode = it->second.mode;
+    if (mode == CHANGE || (mode == RISING && level == HIGH) || (mode == FALLING && level == LOW))
+    {
+      it->second.handler(it->second.arg);
+    }
+  }
+}
+
+unsigned long millis()
+{
+  return sim::clockMicros / 1000;
+}
+
+unsigned long micros()
+{
+  return sim::clockMicros;
+}
+
+void delay(unsigned long ms)
+{
+  sim::advance((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  sim::advance(us);
+}
+
+void yield()
+{
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+  sim::levels[pin] = val;
+}
+
+// Inputs idle high (buttons are active low with external pull-ups).
+int digitalRead(uint8_t pin)
+{
+  auto it = sim::levels.find(pin);
+  return it == sim::levels.end() ? HIGH : it->second;
+}
+
+int digitalPinToInterrupt(uint8_t pin)
+{
+  return pin;
+}
+
+static void callHandler(void *arg)
+{
+  ((void (*)(void))arg)();
+}
+
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode)
+{
+  sim::interrupts[pin] = {callHandler, (void *)handler, mode};
+}
+
+void attachInterruptArg(uint8_t pin, void (*handler)(void *), void *arg, int mode)
+{
+  sim::interrupts[pin] = {handler, arg, mode};
+}
+
+void detachInterrupt(uint8_t pin)
+{
+  sim::interrupts.erase(pin);
+}
+
+double ledcSetup(uint8_t channel, double freq, uint8_t resolution)
+{
+  return freq;
+}
+
+void ledcAttachPin(uint8_t pin, uint8_t channel)
+{
+}
+
+void ledcWrite(uint8_t channel, uint32_t duty)
+{
+}
+
+// Deterministic pseudo random numbers.
+static uint32_t randomState = 1;
+
+long random(long max)
+{
+  randomState = randomState * 1103515245 + 12345;
+  return max > 0 ? (randomState >> 1) % max : 0;
+}
+
+long random(long min, long max)
+{
+  return max > min ? min + random(max - min) : min;
+}
+
+void randomSeed(unsigned long seed)
+{
+  randomState = seed;
+}
+
+EspClass ESP;
+
+static uint32_t cpuFrequencyMhz = 240;
+
+bool setCpuFrequencyMhz(uint32_t mhz)
+{
+  cpuFrequencyMhz = mhz;
+  return true;
+}
+
+uint32_t getCpuFrequencyMhz()
+{
+  return cpuFrequencyMhz;
+}
+
+// Tasks are not run, the simulator drains the logger after every loop() pass.
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stackDepth, void *parameter, UBaseType_t priority, TaskHandle_t *handle, BaseType_t core)
+{
+  return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task, const char *name, uint32_t stackDepth, void *parameter, UBaseType_t priority, TaskHandle_t *handle)
+{
+  return pdPASS;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+  delay(ticks);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+}
+
+TickType_t xTaskGetTickCount()
+{
+  return millis();
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+  return (TaskHandle_t)&sim::clockMicros;
+}
+
+// Idle waits end at button edges in sim::sleepUntil().
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken)
+{
+}
+
+// Peer packets are handed over between loop() passes.
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+  return pdPASS;
+}
+
+// String
+
+static std::string numberToString(unsigned long long value, unsigned char base)
+{
+  char buf[70];
+  char *p = buf + sizeof(buf) - 1;
+  *p = '\0';
+
+  do
+  {
+    int digit = value % base;
+    *--p = digit < 10 ? '0' + digit : 'a' + digit - 10;
+    value /= base;
+  } while (value);
+
+  return p;
+}
+
+String::String(int v, unsigned char base) : _s(base == 10 ? std::to_string(v) : numberToString((unsigned int)v, base)) {}
+String::String(unsigned int v, unsigned char base) : _s(numberToString(v, base)) {}
+String::String(long v, unsigned char base) : _s(base == 10 ? std::to_string(v) : numberToString((unsigned long)v, base)) {}
+String::String(unsigned long v, unsigned char base) : _s(numberToString(v, base)) {}
+
+String::String(float v, unsigned int decimals) : String((double)v, decimals) {}
+
+String::String(double v, unsigned int decimals)
+{
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%.*f", decimals, v);
+  _s = buf;
+}
+
+bool String::equalsIgnoreCase(const String &rhs) const
+{
+  return strcasecmp(_s.c_str(), rhs._s.c_str()) == 0;
+}
+
+int String::indexOf(char c, unsigned int from) const
+{
+  size_t i = _s.find(c, from);
+  return i == std::string::npos ? -1 : i;
+}
+
+int String::indexOf(const String &s, unsigned int from) const
+{
+  size_t i = _s.find(s._s, from);
+  return i == std::string::npos ? -1 : i;
+}
+
+int String::lastIndexOf(char c) const
+{
+  size_t i = _s.rfind(c);
+  return i == std::string::npos ? -1 : i;
+}
+
+String String::substring(unsigned int from) const
+{
+  return from < _s.size() ? String(_s.substr(from)) : String();
+}
+
+String String::substring(unsigned int from, unsigned int to) const
+{
+  if (from > to)
+  {
+    std::swap(from, to);
+  }
+  return from < _s.size() ? String(_s.substr(from, to - from)) : String();
+}
+
+void String::trim()
+{
+  size_t start = _s.find_first_not_of(" \t\r\n");
+  size_t end = _s.find_last_not_of(" \t\r\n");
+  _s = start == std::string::npos ? "" : _s.substr(start, end - start + 1);
+}
+
+void String::toLowerCase()
+{
+  for (char &c : _s)
+  {
+    c = tolower(c);
+  }
+}
+
+void String::toUpperCase()
+{
+  for (char &c : _s)
+  {
+    c = toupper(c);
+  }
+}
+
+void String::replace(const String &find, const String &with)
+{
+  if (find._s.empty())
+  {
+    return;
+  }
+
+  for (size_t i = _s.find(find._s); i != std::string::npos; i = _s.find(find._s, i + with._s.size()))
+  {
+    _s.replace(i, find._s.size(), with._s);
+  }
+}
+
+void String::remove(unsigned int index)
+{
+  if (index < _s.size())
+  {
+    _s.erase(index);
+  }
+}
+
+void String::remove(unsigned int index, unsigned int count)
+{
+  if (index < _s.size())
+  {
+    _s.erase(index, count);
+  }
+}
+
+void String::getBytes(unsigned char *buf, unsigned int len, unsigned int index) const
+{
+  if (len == 0)
+  {
+    return;
+  }
+
+  size_t n = index < _s.size() ? min((size_t)len - 1, _s.size() - index) : 0;
+  memcpy(buf, _s.data() + index, n);
+  buf[n] = '\0';
+}
+
+// Print
+
+size_t Print::write(const uint8_t *buf, size_t size)
+{
+  size_t n = 0;
+  while (size--)
+  {
+    n += write(*buf++);
+  }
+  return n;
+}
+
+size_t Print::printf(const char *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  size_t n = vprintf(format, args);
+  va_end(args);
+  return n;
+}
+
+size_t Print::vprintf(const char *format, va_list args)
+{
+  va_list copy;
+  va_copy(copy, args);
+  int length = vsnprintf(nullptr, 0, format, copy);
+  va_end(copy);
+
+  if (length <= 0)
+  {
+    return 0;
+  }
+
+  std::string buf(length + 1, '\0');
+  vsnprintf(&buf[0], buf.size(), format, args);
+  return write((const uint8_t *)buf.data(), length);
+}
+
+size_t Print::print(int v, int base)
+{
+  return print(String(v, base));
+}
+
+size_t Print::print(unsigned int v, int base)
+{
+  return print(String(v, base));
+}
+
+size_t Print::print(long v, int base)
+{
+  return print(String(v, base));
+}
+
+size_t Print::print(unsigned long v, int base)
+{
+  return print(String(v, base));
+}
+
+size_t Print::print(double v, int digits)
+{
+  return print(String(v, digits));
+}
+
+// Stream, reads never wait: simulated peers deliver data immediately.
+
+int Stream::timedRead()
+{
+  return read();
+}
+
+int Stream::timedPeek()
+{
+  return peek();
+}
+
+size_t Stream::readBytes(char *buffer, size_t length)
+{
+  size_t count = 0;
+  int c;
+
+  while (count < length && (c = timedRead()) >= 0)
+  {
+    buffer[count++] = c;
+  }
+  return count;
+}
+
+bool Stream::find(const char *target)
+{
+  return findUntil(target, nullptr);
+}
+
+bool Stream::findUntil(const char *target, const char *terminator)
+{
+  size_t targetLength = strlen(target);
+  size_t terminatorLength = terminator ? strlen(terminator) : 0;
+  size_t targetIndex = 0;
+  size_t terminatorIndex = 0;
+  int c;
+
+  while ((c = timedRead()) >= 0)
+  {
+    targetIndex = c == target[targetIndex] ? targetIndex + 1 : c == target[0] ? 1 : 0;
+    if (targetIndex == targetLength)
+    {
+      return true;
+    }
+
+    if (terminatorLength > 0)
+    {
+      terminatorIndex = c == terminator[terminatorIndex] ? terminatorIndex + 1 : c == terminator[0] ? 1 : 0;
+      if (terminatorIndex == terminatorLength)
+      {
+        return false;
+      }
+    }
+  }
+  return false;
+}
+
+String Stream::readString()
+{
+  String s;
+  int c;
+
+  while ((c = timedRead()) >= 0)
+  {
+    s += (char)c;
+  }
+  return s;
+}
+
+String Stream::readStringUntil(char terminator)
+{
+  String s;
+  int c;
+
+  while ((c = timedRead()) >= 0 && c != terminator)
+  {
+    s += (char)c;
+  }
+  return s;
+}
+
+// Serial, lines are stamped with the virtual time.
+
+HardwareSerial Serial;
+
+static FILE *serialLog()
+{
+  static FILE *file = nullptr;
+  static bool opened = false;
+
+  if (!opened)
+  {
+    opened = true;
+    if (!sim::config.logPath.empty())
+    {
+      file = fopen(sim::config.logPath.c_str(), "w");
+    }
+  }
+  return file;
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+  static std::string line;
+
+  if (c != '\n')
+  {
+    if (c != '\r')
+    {
+      line += (char)c;
+    }
+    return 1;
+  }
+
+  sim::stats.logLines++;
+  sim::stats.logWarnings += line.compare(0, 3, "[W]") == 0;
+  sim::stats.logErrors += line.compare(0, 3, "[E]") == 0;
+
+  unsigned long long ms = millis();
+  char stamp[32];
+  snprintf(stamp, sizeof(stamp), "%3llud %02llu:%02llu:%02llu.%03llu ", ms / 86400000, ms / 3600000 % 24, ms / 60000 % 60, ms / 1000 % 60, ms % 1000);
+
+  if (serialLog())
+  {
+    fprintf(serialLog(), "%s%s\n", stamp, line.c_str());
+  }
+  if (sim::config.verbose)
+  {
+    printf("%s%s\n", stamp, line.c_str());
+  }
+
+  line.clear();
+  return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t *buf, size_t size)
+{
+  for (size_t i = 0; i < size; i++)
+  {
+    write(buf[i]);
+  }
+  return size;
+}
+
+// IPAddress
+
+bool IPAddress::fromString(const char *address)
+{
+  unsigned int a, b, c, d;
+  if (sscanf(address, "%u.%u.%u.%u", &a, &b, &c, &d) != 4)
+  {
+    return false;
+  }
+  *this = IPAddress(a, b, c, d);
+  return true;
+}
+
+String IPAddress::toString() const
+{
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%u.%u.%u.%u", _octets[0], _octets[1], _octets[2], _octets[3]);
+  return buf;
+}
@@ -0,0 +1,329 @@
+// Host benchmarks of location payload decoding: the chained lookups the
+// renderer and ingest used before LocationRecord against a single
+// LocationRecord::decode() pass. Both start from a parsed document, so
+// only the field access is measured.
+//
+// The gzip benchmark inflates the replayed responses as the firmware
+// receives them: gzip encoded with a 4 KB window and read through
+// InflateStream, checking the output against the original body.
+//
+// The trend benchmark times the switch to the trend screen with a week
+// of history samples, as DrawTrend() does it: read the window of the
+// history log from the SD card, load both sparklines and push them to
+// the panel. Virtual time includes the modelled SD card and SPI costs.
+
+#include "sim.h"
+#include <ArduinoJson.h>
+#include <SD.h>
+#include <TFT_eSPI.h>
+#include <historyLog.h>
+#include <inflateStream.h>
+#include <locationRecord.h>
+#include <sparkline.h>
+#include <chrono>
+#include <dirent.h>
+#include <fstream>
+#include <sstream>
+
+namespace sim
+{
+  // The lookups of one render and one ingest of a location payload.
+  static uint32_t chainedLookups(JsonDocument &doc)
+  {
+    uint32_t sum = 0;
+
+    sum += strlen(doc["station"]["usgsId"] | "");
+    sum += strlen(doc["station"]["wrId"] | "");
+    sum += strlen(doc["station"]["recordTime"] | "");
+    sum += SafetyRules::findSafety(doc["station"]["locationStatus"]);
+
+    for (int m = 0; m < numMeasurements; m++)
+    {
+      const char *value = doc["data"][measurementNames[m]]["value"] | "";
+      sum += strlen(value) + (*value != '\0' && strcmp(value, "N.A.") ? (uint32_t)atof(value) : 0);
+      sum += SafetyRules::findSafety(doc["data"][measurementNames[m]]["safety"]);
+      sum += strlen(doc["data"][measurementNames[m]]["date"] | "");
+    }
+    return sum;
+  }
+
+  static uint32_t recordDecode(JsonDocument &doc, LocationRecord &record)
+  {
+    uint32_t sum = 0;
+
+    record.decode(doc.as<JsonVariantConst>());
+    sum += strlen(record.usgsId) + strlen(record.wrId) + strlen(record.recordTime) + record.status;
+
+    for (const MeasurementRecord &data : record.data)
+    {
+      sum += strlen(data.value) + (isnan(data.number) ? 0 : (uint32_t)data.number) + data.safety + strlen(data.date);
+    }
+    return sum;
+  }
+
+  template <typename Decode>
+  static double nanosPerPayload(std::vector<DynamicJsonDocument> &docs, int iterations, Decode decode, uint32_t &sum)
+  {
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < iterations; i++)
+    {
+      for (DynamicJsonDocument &doc : docs)
+      {
+        sum += decode(doc);
+      }
+    }
+
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / ((double)iterations * docs.size());
+  }
+
+  int runBench(int iterations)
+  {
+    std::string directory = config.sdCardPath + "/locations";
+    std::vector<DynamicJsonDocument> docs;
+
+    DIR *dir = opendir(directory.c_str());
+    if (dir == nullptr)
+    {
+      fprintf(stderr, "Cannot read %s\n", directory.c_str());
+      return 1;
+    }
+    for (dirent *entry; (entry = readdir(dir)) != nullptr;)
+    {
+      std::ifstream in(directory + "/" + entry->d_name);
+      std::stringstream text;
+      text << in.rdbuf();
+
+      docs.emplace_back(2048);
+      if (entry->d_name[0] == '.' || deserializeJson(docs.back(), text.str()))
+      {
+        docs.pop_back();
+      }
+    }
+    closedir(dir);
+
+    if (docs.empty())
+    {
+      fprintf(stderr, "No location payloads in %s\n", directory.c_str());
+      return 1;
+    }
+
+    LocationRecord record;
+    uint32_t chainedSum = 0;
+    uint32_t recordSum = 0;
+
+    double chained = nanosPerPayload(docs, iterations, chainedLookups, chainedSum);
+    double decoded = nanosPerPayload(docs, iterations, [&record](JsonDocument &doc) { return recordDecode(doc, record); }, recordSum);
+
+    printf("Decoded %u payloads %d times.\n", (unsigned int)docs.size(), iterations);
+    printf("  chained lookups   %8.0f ns per payload\n", chained);
+    printf("  LocationRecord    %8.0f ns per payload (%.1fx)\n", decoded, decoded > 0 ? chained / decoded : 0);
+    printf("  sizeof(LocationRecord) %u bytes\n", (unsigned int)sizeof(LocationRecord));
+
+    // Both read the same fields.
+    if (chainedSum != recordSum)
+    {
+      fprintf(stderr, "Decoders disagree (%u, %u).\n", chainedSum, recordSum);
+      return 2;
+    }
+    return 0;
+  }
+
+  // Compressed body read from memory.
+  class BufferStream : public Stream
+  {
+
+  private:
+    const std::string &_data;
+    size_t _pos = 0;
+
+  public:
+    BufferStream(const std::string &data) : _data(data)
+    {
+    }
+
+    int available() override
+    {
+      return _data.size() - _pos;
+    }
+
+    int read() override
+    {
+      return _pos < _data.size() ? (uint8_t)_data[_pos++] : -1;
+    }
+
+    int peek() override
+    {
+      return _pos < _data.size() ? (uint8_t)_data[_pos] : -1;
+    }
+
+    size_t readBytes(char *buffer, size_t length) override
+    {
+      size_t n = std::min(length, _data.size() - _pos);
+      memcpy(buffer, _data.data() + _pos, n);
+      _pos += n;
+      return n;
+    }
+
+    size_t write(uint8_t) override
+    {
+      return 0;
+    }
+  };
+
+  // Inflates a body, false when it differs from the original.
+  static bool inflateBody(const std::string &encoded, const std::string &original)
+  {
+    BufferStream source(encoded);
+    InflateStream inflater(source);
+    std::string inflated;
+    char buffer[100]; // Not a divisor of the window, reads cross its end.
+
+    for (size_t n; (n = inflater.readBytes(buffer, sizeof(buffer))) > 0;)
+    {
+      inflated.append(buffer, n);
+    }
+    return !inflater.error() && inflated == original;
+  }
+
+  struct GzipSet
+  {
+    std::string name;
+    int windowBits; // Of the host's encoder.
+    std::vector<std::string> bodies;
+  };
+
+  int runGzipBench(int iterations)
+  {
+    std::vector<GzipSet> sets = {{"midpoint", 12, replayBodies()}, {"USGS", 15, {}}};
+    std::ifstream in(config.usgsReplayPath);
+    std::stringstream usgs;
+    usgs << in.rdbuf();
+
+    if (!usgs.str().empty())
+    {
+      sets[1].bodies.push_back(usgs.str());
+    }
+
+    printf("Inflated the replayed responses %d times (4 KB window).\n", iterations);
+
+    for (auto &set : sets)
+    {
+      std::vector<std::string> encoded;
+      size_t plainBytes = 0;
+      size_t gzipBytes = 0;
+
+      for (const std::string &body : set.bodies)
+      {
+        encoded.push_back(gzipEncode(body, set.windowBits));
+        plainBytes += body.size();
+        gzipBytes += encoded.back().size();
+      }
+
+      if (set.bodies.empty())
+      {
+        continue;
+      }
+
+      printf("  %-8s %4u responses %8u bytes, gzip %7u bytes (%.0f%% saved)\n", set.name.c_str(), (unsigned int)set.bodies.size(), (unsigned int)plainBytes, (unsigned int)gzipBytes, 100.0 * (plainBytes - gzipBytes) / plainBytes);
+
+      // A larger encoder window than InflateStream's is not safe to decode.
+      if (set.windowBits > 12)
+      {
+        printf("           %u KB encoder window, larger than the inflate window: fetched without gzip\n", 1u << (set.windowBits - 10));
+        continue;
+      }
+
+      auto start = std::chrono::steady_clock::now();
+      for (int i = 0; i < iterations; i++)
+      {
+        for (size_t b = 0; b < encoded.size(); b++)
+        {
+          if (!inflateBody(encoded[b], set.bodies[b]))
+          {
+            fprintf(stderr, "%s response %u does not inflate to its body.\n", set.name.c_str(), (unsigned int)b);
+            return 2;
+          }
+        }
+      }
+      std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+      double micros = elapsed.count() / iterations;
+      size_t saved = plainBytes - gzipBytes;
+
+      printf("           inflate %8.0f us per pass, %.1f ns per byte, pays off below %.1f Mbit/s on this host\n", micros, 1000 * micros / plainBytes, micros > 0 ? 8 * saved / micros : 0);
+    }
+    return 0;
+  }
+
+  int runTrendBench(int iterations)
+  {
+    const int trendWidth = 448; // As in main.cpp.
+    const int trendHeight = 60;
+    const uint32_t weekSamples = 7 * 24 * 4; // One per 15 minutes.
+    const unsigned long budgetMillis = 50;
+
+    HistoryLog history;
+    SD.mkdir("/bench");
+    SD.remove("/bench/trend.bin");
+    history.begin(SD, "/bench/trend.bin", 1024);
+
+    for (uint32_t i = 0; i < weekSamples; i++)
+    {
+      HistorySample sample = {};
+      sample.time = config.startEpoch + i * 900;
+      sample.streamFlow = 1500 + 500 * sinf(i / 40.0f);
+      sample.gaugeHeight = 4 + cosf(i / 30.0f);
+      sample.waterTempC = NAN;
+      sample.eColi = NAN;
+      history.append(sample);
+    }
+    history.flush(true);
+
+    TFT_eSPI panel;
+    Sparkline flow(&panel);
+    Sparkline gauge(&panel);
+    panel.begin();
+    panel.setRotation(1);
+
+    if (!flow.begin(trendWidth, trendHeight, TFT_CYAN) || !gauge.begin(trendWidth, trendHeight, TFT_CYAN))
+    {
+      fprintf(stderr, "Cannot create the trend sprites.\n");
+      return 1;
+    }
+
+    std::vector<HistorySample> samples(trendWidth);
+    std::vector<float> values(trendWidth);
+    size_t count = 0;
+    unsigned long startMicros = micros();
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < iterations; i++)
+    {
+      count = history.readLast(samples.data(), trendWidth);
+
+      for (size_t s = 0; s < count; s++)
+      {
+        values[s] = samples[s].streamFlow;
+      }
+      flow.load(values.data(), count);
+      for (size_t s = 0; s < count; s++)
+      {
+        values[s] = samples[s].gaugeHeight;
+      }
+      gauge.load(values.data(), count);
+
+      flow.pushSprite(5, 108);
+      gauge.pushSprite(5, 192);
+    }
+
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+    double virtualMillis = (micros() - startMicros) / 1000.0 / iterations;
+
+    printf("Switched to the trend screen %d times, %u of %u samples shown.\n", iterations, (unsigned int)count, (unsigned int)weekSamples);
+    printf("  %6.1f ms per switch in virtual time (SD card and SPI modelled, budget %lu ms)\n", virtualMillis, budgetMillis);
+    printf("  %6.0f us per switch on this host\n", elapsed.count() / iterations);
+
+    return virtualMillis < budgetMillis ? 0 : 2;
+  }
+}
@@ -0,0 +1,421 @@
+// Display and LED strips for the simulator.
+
+#include "sim.h"
+#include <TFT_eSPI.h>
+#include <FastLED.h>
+
+extern TFT_eSPI tft;
+
+// Sprite buffers, so images pushed from a sprite carry its text.
+static std::map<const uint16_t *, const TFT_eSprite *> spriteBuffers;
+
+// TFT_eSPI
+
+TFT_eSPI::TFT_eSPI(int16_t w, int16_t h) : _width(w), _height(h)
+{
+}
+
+void TFT_eSPI::init()
+{
+  _frame.assign((size_t)TFT_WIDTH * TFT_HEIGHT, TFT_BLACK);
+  _text.clear();
+}
+
+void TFT_eSPI::setRotation(uint8_t r)
+{
+  _width = r & 1 ? TFT_HEIGHT : TFT_WIDTH;
+  _height = r & 1 ? TFT_WIDTH : TFT_HEIGHT;
+}
+
+bool TFT_eSPI::clip(int32_t &x, int32_t &y, int32_t &w, int32_t &h)
+{
+  if (x < 0)
+  {
+    w += x;
+    x = 0;
+  }
+  if (y < 0)
+  {
+    h += y;
+    y = 0;
+  }
+  w = min(w, (int32_t)_width - x);
+  h = min(h, (int32_t)_height - y);
+  return w > 0 && h > 0 && !_frame.empty();
+}
+
+// Charges SPI transfer time for pixels sent to the panel, sprites are in RAM.
+void TFT_eSPI::countPixels(uint64_t pixels)
+{
+  static uint64_t nanos = 0;
+
+  if (_isSprite)
+  {
+    return;
+  }
+
+  sim::stats.tftPixels += pixels;
+  nanos += pixels * sim::tftNanosPerPixel;
+  sim::advance(nanos / 1000);
+  nanos %= 1000;
+}
+
+void TFT_eSPI::paint(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color)
+{
+  if (!clip(x, y, w, h))
+  {
+    return;
+  }
+
+  uint16_t value = mapColor(color);
+  for (int32_t row = y; row < y + h; row++)
+  {
+    std::fill_n(&_frame[row * _width + x], w, value);
+  }
+  countPixels((uint64_t)w * h);
+}
+
+// Filling erases the text runs that start inside the rectangle.
+void TFT_eSPI::fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color)
+{
+  for (auto it = _text.begin(); it != _text.end();)
+  {
+    bool inside = it->first.first >= y && it->first.first < y + h && it->first.second >= x && it->first.second < x + w;
+    it = inside ? _text.erase(it) : std::next(it);
+  }
+  _runNextX = -1;
+
+  paint(x, y, w, h, color);
+}
+
+void TFT_eSPI::drawRect(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color)
+{
+  paint(x, y, w, 1, color);
+  paint(x, y + h - 1, w, 1, color);
+  paint(x, y + 1, 1, h - 2, color);
+  paint(x + w - 1, y + 1, 1, h - 2, color);
+}
+
+void TFT_eSPI::drawLine(int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint32_t color)
+{
+  int32_t dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+  int32_t dy = -abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+  int32_t error = dx + dy;
+
+  while (true)
+  {
+    paint(x0, y0, 1, 1, color);
+    if (x0 == x1 && y0 == y1)
+    {
+      break;
+    }
+
+    int32_t e2 = 2 * error;
+    if (e2 >= dy)
+    {
+      error += dy;
+      x0 += sx;
+    }
+    if (e2 <= dx)
+    {
+      error += dx;
+      y0 += sy;
+    }
+  }
+}
+
+uint16_t TFT_eSPI::readPixel(int32_t x, int32_t y)
+{
+  return x >= 0 && y >= 0 && x < _width && y < _height && !_frame.empty() ? _frame[y * _width + x] : 0;
+}
+
+// Glyphs are drawn as a background cell with a solid box for printable characters.
+size_t TFT_eSPI::write(uint8_t c)
+{
+  int32_t w = 6 * textsize;
+  int32_t h = 8 * textsize;
+
+  if (c == '\r')
+  {
+    return 1;
+  }
+  if (c == '\n')
+  {
+    cursor_x = 0;
+    cursor_y += h;
+    _runNextX = -1;
+    return 1;
+  }
+
+  if (cursor_y != _runY || cursor_x != _runNextX)
+  {
+    _runX = cursor_x;
+    _runY = cursor_y;
+    _text[{_runY, _runX}].clear();
+  }
+  _text[{_runY, _runX}] += (char)c;
+
+  if (textbgcolor != textcolor)
+  {
+    paint(cursor_x, cursor_y, w, h, textbgcolor);
+  }
+  if (c != ' ')
+  {
+    paint(cursor_x + textsize, cursor_y + textsize, w - 2 * textsize, h - 2 * textsize, textcolor);
+  }
+
+  cursor_x += w;
+  _runNextX = cursor_x;
+  return 1;
+}
+
+int16_t TFT_eSPI::drawString(const char *string, int32_t x, int32_t y)
+{
+  int32_t width = textWidth(string);
+  int32_t savedX = cursor_x, savedY = cursor_y;
+
+  if (textdatum == TC_DATUM || textdatum == MC_DATUM)
+  {
+    x -= width / 2;
+  }
+  if (textdatum == MC_DATUM)
+  {
+    y -= fontHeight() / 2;
+  }
+
+  if (padX > width && textbgcolor != textcolor)
+  {
+    paint(x + width, y, padX - width, fontHeight(), textbgcolor);
+  }
+
+  cursor_x = x;
+  cursor_y = y;
+  print(string);
+  cursor_x = savedX;
+  cursor_y = savedY;
+  return width;
+}
+
+void TFT_eSPI::pushImage(int32_t x, int32_t y, int32_t w, int32_t h, const uint16_t *data)
+{
+  int32_t cx = x, cy = y, cw = w, ch = h;
+
+  auto sprite = spriteBuffers.find(data);
+  if (sprite != spriteBuffers.end())
+  {
+    copyText(*sprite->second, x, y);
+  }
+
+  if (!clip(cx, cy, cw, ch))
+  {
+    return;
+  }
+
+  for (int32_t row = 0; row < ch; row++)
+  {
+    const uint16_t *source = data + (cy - y + row) * w + (cx - x);
+    uint16_t *target = &_frame[(cy + row) * _width + cx];
+
+    for (int32_t col = 0; col < cw; col++)
+    {
+      target[col] = _swapBytes ? (uint16_t)(source[col] << 8 | source[col] >> 8) : source[col];
+    }
+  }
+  countPixels((uint64_t)cw * ch);
+}
+
+std::string TFT_eSPI::text() const
+{
+  std::string result;
+  int32_t lastY = INT32_MIN;
+
+  for (auto &run : _text)
+  {
+    if (run.second.find_first_not_of(' ') == std::string::npos)
+    {
+      continue;
+    }
+    if (run.first.first != lastY && lastY != INT32_MIN)
+    {
+      result += '\n';
+    }
+    else if (lastY != INT32_MIN)
+    {
+      result += "  ";
+    }
+    result += run.second;
+    lastY = run.first.first;
+  }
+  return result.empty() ? result : result + '\n';
+}
+
+// Replaces the text runs in the source's rectangle by the source's runs.
+void TFT_eSPI::copyText(const TFT_eSPI &source, int32_t x, int32_t y)
+{
+  for (auto it = _text.begin(); it != _text.end();)
+  {
+    bool inside = it->first.first >= y && it->first.first < y + source._height && it->first.second >= x && it->first.second < x + source._width;
+    it = inside ? _text.erase(it) : std::next(it);
+  }
+  for (auto &run : source._text)
+  {
+    _text[{run.first.first + y, run.first.second + x}] = run.second;
+  }
+  _runNextX = -1;
+}
+
+// TFT_eSprite
+
+void *TFT_eSprite::createSprite(int16_t w, int16_t h, uint8_t frames)
+{
+  spriteBuffers.erase(_frame.data());
+  _width = w;
+  _height = h;
+  _frame.assign((size_t)w * h, 0);
+  _created = true;
+  spriteBuffers[_frame.data()] = this;
+  return _frame.data();
+}
+
+void TFT_eSprite::deleteSprite()
+{
+  spriteBuffers.erase(_frame.data());
+  _frame.clear();
+  _frame.shrink_to_fit();
+  _width = _height = 0;
+  _created = false;
+}
+
+// Scrolls the sprite contents, vacated pixels are cleared.
+void TFT_eSprite::scroll(int16_t dx, int16_t dy)
+{
+  if (!_created)
+  {
+    return;
+  }
+
+  std::vector<uint16_t> scrolled(_frame.size(), 0);
+  for (int32_t y = 0; y < _height; y++)
+  {
+    for (int32_t x = 0; x < _width; x++)
+    {
+      int32_t sx = x - dx, sy = y - dy;
+      if (sx >= 0 && sy >= 0 && sx < _width && sy < _height)
+      {
+        scrolled[y * _width + x] = _frame[sy * _width + sx];
+      }
+    }
+  }
+  _frame.swap(scrolled);
+}
+
+void TFT_eSprite::pushSprite(int32_t x, int32_t y)
+{
+  if (!_created)
+  {
+    return;
+  }
+
+  std::vector<uint16_t> image(_frame);
+  if (_bpp == 1)
+  {
+    for (uint16_t &pixel : image)
+    {
+      pixel = pixel ? _fg : _bg;
+    }
+  }
+
+  bool swap = _tft->getSwapBytes();
+  _tft->setSwapBytes(false);
+  _tft->pushImage(x, y, _width, _height, image.data());
+  _tft->setSwapBytes(swap);
+  _tft->copyText(*this, x, y);
+}
+
+// FastLED, strips are sent in parallel so a frame costs the longest strip.
+
+CFastLED FastLED;
+
+CLEDController &CFastLED::addController(uint8_t pin, CRGB *data, int count)
+{
+  CLEDController &controller = _controllers[_count < 8 ? _count++ : 7];
+  controller.leds = data;
+  controller.count = count;
+  controller.pin = pin;
+  return controller;
+}
+
+void CFastLED::show()
+{
+  static std::vector<uint8_t> lastFrame;
+  std::vector<uint8_t> frame;
+  int longest = 0;
+
+  for (int i = 0; i < _count; i++)
+  {
+    const CLEDController &controller = _controllers[i];
+    for (int j = 0; j < controller.count; j++)
+    {
+      frame.insert(frame.end(), controller.leds[j].raw, controller.leds[j].raw + 3);
+    }
+    longest = max(longest, controller.count);
+  }
+  frame.push_back(_brightness);
+
+  sim::stats.ledFrames++;
+  if (frame != lastFrame)
+  {
+    sim::stats.ledChangedFrames++;
+    lastFrame.swap(frame);
+  }
+  sim::advance((uint64_t)longest * sim::ledMicrosPerPixel);
+}
+
+namespace sim
+{
+  // Writes the display as a binary PPM image.
+  void writeFrame(const std::string &path)
+  {
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == nullptr)
+    {
+      return;
+    }
+
+    fprintf(file, "P6\n%d %d\n255\n", tft.width(), tft.height());
+    for (uint16_t pixel : tft.frame())
+    {
+      uint8_t rgb[3] = {(uint8_t)((pixel >> 8) & 0xF8), (uint8_t)((pixel >> 3) & 0xFC), (uint8_t)(pixel << 3)};
+      fwrite(rgb, 1, 3, file);
+    }
+    fclose(file);
+  }
+
+  std::string screenText()
+  {
+    return tft.text();
+  }
+
+  // One line per strip, a colour name initial per LED ('.' when off).
+  std::string ledSummary()
+  {
+    std::string result;
+
+    for (int i = 0; i < FastLED.count(); i++)
+    {
+      CLEDController &controller = FastLED[i];
+      char header[32];
+      snprintf(header, sizeof(header), "pin %2u: ", controller.pin);
+      result += header;
+
+      for (int j = 0; j < controller.count; j++)
+      {
+        const CRGB &led = controller.leds[j];
+        char c = led == CRGB(CRGB::Black) ? '.' : led.b > led.r && led.b > led.g ? 'B' : led.r > 0 && led.g > 0 ? 'Y' : led.r > 0 ? 'R' : led.g > 0 ? 'G' : 'W';
+        result += c;
+      }
+      result += '\n';
+    }
+    return result;
+  }
+}
@@ -0,0 +1,475 @@
+// In-memory SD card and internal flash (LittleFS) for the simulator, the
+// SD card is seeded from a host directory.
+
+#include "sim.h"
+#include <LittleFS.h>
+#include <SD.h>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+namespace fs
+{
+  struct Node
+  {
+    bool isDirectory;
+    std::string data;
+    time_t lastWrite;
+  };
+
+  class FSImpl
+  {
+  public:
+    std::map<std::string, std::shared_ptr<Node>> nodes;
+    bool flash; // Internal flash, else the SD card.
+
+    FSImpl(bool flash = false) : flash(flash)
+    {
+      nodes["/"] = std::make_shared<Node>(Node{true, "", 0});
+    }
+
+    static std::string normalize(const char *path)
+    {
+      std::string p = path[0] == '/' ? path : std::string("/") + path;
+
+      // The SD card VFS accepts repeated slashes ("//locations/0.json").
+      for (size_t slash; (slash = p.find("//")) != std::string::npos;)
+      {
+        p.erase(slash, 1);
+      }
+      while (p.size() > 1 && p.back() == '/')
+      {
+        p.pop_back();
+      }
+      return p;
+    }
+
+    static std::string parent(const std::string &path)
+    {
+      size_t slash = path.rfind('/');
+      return slash == 0 ? "/" : path.substr(0, slash);
+    }
+
+    std::shared_ptr<Node> find(const std::string &path)
+    {
+      auto it = nodes.find(path);
+      return it == nodes.end() ? nullptr : it->second;
+    }
+
+    bool parentExists(const std::string &path)
+    {
+      std::shared_ptr<Node> node = find(parent(path));
+      return node && node->isDirectory;
+    }
+
+    std::vector<std::string> children(const std::string &path)
+    {
+      std::string prefix = path == "/" ? "/" : path + "/";
+      std::vector<std::string> result;
+
+      for (auto it = nodes.lower_bound(prefix); it != nodes.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it)
+      {
+        if (it->first.size() > prefix.size() && it->first.find('/', prefix.size()) == std::string::npos)
+        {
+          result.push_back(it->first);
+        }
+      }
+      return result;
+    }
+  };
+
+  class FileImpl
+  {
+  public:
+    FSImpl *fs;
+    std::shared_ptr<Node> node;
+    std::string path;
+    size_t pos = 0;
+    bool readable = false;
+    bool writable = false;
+    bool append = false;
+    bool open = true;
+    size_t nextChild = 0;
+  };
+
+  static void chargeRead(FSImpl *fs, size_t bytes)
+  {
+    (fs->flash ? sim::stats.flashBytesRead : sim::stats.sdBytesRead) += bytes;
+    sim::advance((uint64_t)bytes * (fs->flash ? sim::flashReadNanosPerByte : sim::sdReadNanosPerByte) / 1000);
+  }
+
+  static void chargeWrite(FSImpl *fs, size_t bytes)
+  {
+    (fs->flash ? sim::stats.flashBytesWritten : sim::stats.sdBytesWritten) += bytes;
+    sim::advance((uint64_t)bytes * (fs->flash ? sim::flashWriteNanosPerByte : sim::sdWriteNanosPerByte) / 1000);
+  }
+
+  // A removed or failing SD card fails all operations.
+  static bool failing(FSImpl *fs)
+  {
+    return !fs->flash && sim::inSDFault();
+  }
+
+  size_t File::write(uint8_t c)
+  {
+    return write(&c, 1);
+  }
+
+  size_t File::write(const uint8_t *buf, size_t size)
+  {
+    if (!*this || !_p->writable || _p->node->isDirectory || failing(_p->fs))
+    {
+      return 0;
+    }
+
+    std::string &data = _p->node->data;
+    if (_p->append)
+    {
+      _p->pos = data.size();
+    }
+    if (_p->pos + size > data.size())
+    {
+      data.resize(_p->pos + size);
+    }
+
+    memcpy(&data[_p->pos], buf, size);
+    _p->pos += size;
+    _p->node->lastWrite = sim::epoch();
+
+    chargeWrite(_p->fs, size);
+    return size;
+  }
+
+  int File::available()
+  {
+    return *this && _p->readable && !_p->node->isDirectory && !failing(_p->fs) ? _p->node->data.size() - _p->pos : 0;
+  }
+
+  int File::read()
+  {
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+  }
+
+  int File::peek()
+  {
+    return available() > 0 ? (uint8_t)_p->node->data[_p->pos] : -1;
+  }
+
+  size_t File::read(uint8_t *buf, size_t size)
+  {
+    size_t n = min(size, (size_t)available());
+
+    if (n > 0)
+    {
+      memcpy(buf, _p->node->data.data() + _p->pos, n);
+      _p->pos += n;
+      chargeRead(_p->fs, n);
+    }
+    return n;
+  }
+
+  bool File::seek(uint32_t pos, SeekMode mode)
+  {
+    if (!*this)
+    {
+      return false;
+    }
+
+    size_t size = _p->node->data.size();
+    size_t target = mode == SeekSet ? pos : mode == SeekCur ? _p->pos + pos : size + pos;
+
+    if (target > size)
+    {
+      return false;
+    }
+    _p->pos = target;
+    return true;
+  }
+
+  size_t File::position() const
+  {
+    return _p ? _p->pos : 0;
+  }
+
+  size_t File::size() const
+  {
+    return _p ? _p->node->data.size() : 0;
+  }
+
+  void File::close()
+  {
+    if (_p)
+    {
+      _p->open = false;
+    }
+  }
+
+  File::operator bool() const
+  {
+    return _p && _p->open;
+  }
+
+  time_t File::getLastWrite()
+  {
+    return _p ? _p->node->lastWrite : 0;
+  }
+
+  const char *File::name() const
+  {
+    return _p ? _p->path.c_str() + _p->path.rfind('/') + 1 : "";
+  }
+
+  const char *File::path() const
+  {
+    return _p ? _p->path.c_str() : "";
+  }
+
+  bool File::isDirectory()
+  {
+    return *this && _p->node->isDirectory;
+  }
+
+  File File::openNextFile(const char *mode)
+  {
+    if (!isDirectory())
+    {
+      return File();
+    }
+
+    std::vector<std::string> children = _p->fs->children(_p->path);
+    if (_p->nextChild >= children.size())
+    {
+      return File();
+    }
+
+    FS fs(std::shared_ptr<FSImpl>(std::shared_ptr<FSImpl>(), _p->fs));
+    return fs.open(children[_p->nextChild++].c_str(), mode);
+  }
+
+  void File::rewindDirectory()
+  {
+    if (_p)
+    {
+      _p->nextChild = 0;
+    }
+  }
+
+  File FS::open(const char *path, const char *mode, const bool create)
+  {
+    std::string p = FSImpl::normalize(path);
+    std::shared_ptr<Node> node = _impl->find(p);
+    bool plus = strchr(mode, '+') != nullptr;
+
+    (_impl->flash ? sim::stats.flashOpens : sim::stats.sdOpens)++;
+    sim::advance(_impl->flash ? sim::flashOpenMicros : sim::sdOpenMicros);
+
+    if (failing(_impl.get()) || (mode[0] == 'r' && !node))
+    {
+      return File();
+    }
+
+    if (mode[0] != 'r')
+    {
+      if (node && node->isDirectory)
+      {
+        return File();
+      }
+      if (!node)
+      {
+        // Creates missing directories when asked to.
+        for (size_t slash = 1; create && (slash = p.find('/', slash)) != std::string::npos; slash++)
+        {
+          mkdir(p.substr(0, slash).c_str());
+        }
+        if (!_impl->parentExists(p))
+        {
+          return File();
+        }
+        node = std::make_shared<Node>(Node{false, "", (time_t)sim::epoch()});
+        _impl->nodes[p] = node;
+      }
+      if (mode[0] == 'w')
+      {
+        node->data.clear();
+        node->lastWrite = sim::epoch();
+      }
+    }
+
+    FileImplPtr impl = std::make_shared<FileImpl>();
+    impl->fs = _impl.get();
+    impl->node = node;
+    impl->path = p;
+    impl->readable = mode[0] == 'r' || plus;
+    impl->writable = mode[0] != 'r' || plus;
+    impl->append = mode[0] == 'a';
+    return File(impl);
+  }
+
+  bool FS::exists(const char *path)
+  {
+    return !failing(_impl.get()) && _impl->find(FSImpl::normalize(path)) != nullptr;
+  }
+
+  bool FS::remove(const char *path)
+  {
+    std::string p = FSImpl::normalize(path);
+    std::shared_ptr<Node> node = _impl->find(p);
+
+    if (!node || node->isDirectory)
+    {
+      return false;
+    }
+    _impl->nodes.erase(p);
+    return true;
+  }
+
+  bool FS::rename(const char *from, const char *to)
+  {
+    std::string f = FSImpl::normalize(from);
+    std::string t = FSImpl::normalize(to);
+    std::shared_ptr<Node> node = _impl->find(f);
+
+    if (!node || node->isDirectory || _impl->find(t) || !_impl->parentExists(t))
+    {
+      return false;
+    }
+    _impl->nodes.erase(f);
+    _impl->nodes[t] = node;
+    return true;
+  }
+
+  bool FS::mkdir(const char *path)
+  {
+    std::string p = FSImpl::normalize(path);
+
+    if (_impl->find(p) || !_impl->parentExists(p))
+    {
+      return false;
+    }
+    _impl->nodes[p] = std::make_shared<Node>(Node{true, "", (time_t)sim::epoch()});
+    return true;
+  }
+
+  bool FS::rmdir(const char *path)
+  {
+    std::string p = FSImpl::normalize(path);
+    std::shared_ptr<Node> node = _impl->find(p);
+
+    if (!node || !node->isDirectory || p == "/" || !_impl->children(p).empty())
+    {
+      return false;
+    }
+    _impl->nodes.erase(p);
+    return true;
+  }
+
+  SDFS::SDFS() : FS(std::make_shared<FSImpl>())
+  {
+  }
+
+  bool SDFS::begin(uint8_t ssPin)
+  {
+    return !sim::inSDFault();
+  }
+
+  void SDFS::end()
+  {
+  }
+
+  uint64_t SDFS::cardSize()
+  {
+    return 4ULL << 30;
+  }
+
+  uint64_t SDFS::totalBytes()
+  {
+    return cardSize();
+  }
+
+  uint64_t SDFS::usedBytes()
+  {
+    uint64_t used = 0;
+    for (auto &entry : _impl->nodes)
+    {
+      used += entry.second->data.size();
+    }
+    return used;
+  }
+
+  LittleFSFS::LittleFSFS() : FS(std::make_shared<FSImpl>(true))
+  {
+  }
+
+  bool LittleFSFS::begin(bool formatOnFail, const char *basePath, uint8_t maxOpenFiles, const char *partitionLabel)
+  {
+    return true;
+  }
+
+  void LittleFSFS::end()
+  {
+  }
+
+  bool LittleFSFS::format()
+  {
+    _impl->nodes.clear();
+    _impl->nodes["/"] = std::make_shared<Node>(Node{true, "", 0});
+    return true;
+  }
+
+  size_t LittleFSFS::totalBytes()
+  {
+    return 1408 * 1024; // spiffs partition of the default partition table.
+  }
+
+  size_t LittleFSFS::usedBytes()
+  {
+    size_t used = 0;
+    for (auto &entry : _impl->nodes)
+    {
+      used += entry.second->data.size();
+    }
+    return used;
+  }
+}
+
+fs::SDFS SD;
+fs::LittleFSFS LittleFS;
+
+namespace sim
+{
+  // Copies a host directory tree into the SD card, not counted in the statistics.
+  bool seedFileSystem(const std::string &hostPath)
+  {
+    namespace stdfs = std::filesystem;
+    std::error_code error;
+
+    if (!stdfs::is_directory(hostPath, error))
+    {
+      return false;
+    }
+
+    for (const stdfs::directory_entry &entry : stdfs::recursive_directory_iterator(hostPath, error))
+    {
+      std::string path = "/" + stdfs::relative(entry.path(), hostPath).generic_string();
+
+      if (entry.is_directory())
+      {
+        SD.mkdir(path.c_str());
+        continue;
+      }
+
+      std::ifstream in(entry.path(), std::ios::binary);
+      std::stringstream data;
+      data << in.rdbuf();
+
+      File file = SD.open(path.c_str(), FILE_WRITE);
+      file.write((const uint8_t *)data.str().data(), data.str().size());
+      file.close();
+    }
+
+    clockMicros = 0;
+    stats = Stats();
+    return true;
+  }
+}
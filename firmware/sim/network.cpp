@@ -0,0 +1,1136 @@
+// WiFi and HTTP for the simulator, requests are answered from a replay file.
+
+#include "sim.h"
+#include <AsyncUDP.h>
+#include <WiFiClientSecure.h>
+#include <HTTPClient.h>
+#include <fstream>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <set>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace sim
+{
+  // Received bytes of an in-process connection.
+  struct Connection
+  {
+    std::string data;
+    size_t pos = 0;
+    uint64_t lastActive = 0; // Closed by the server after keepAliveSeconds.
+  };
+
+  struct Record
+  {
+    double time; // Seconds since start.
+    uint32_t latencyMillis;
+    std::string body;
+    std::string version;
+  };
+
+  static std::map<std::string, std::vector<Record>> replay;
+
+  static size_t skipWhitespace(const std::string &json, size_t i)
+  {
+    while (i < json.size() && isspace((unsigned char)json[i]))
+    {
+      i++;
+    }
+    return i;
+  }
+
+  // Returns the index after the value starting at i.
+  static size_t skipValue(const std::string &json, size_t i)
+  {
+    int depth = 0;
+    bool inString = false;
+
+    for (; i < json.size(); i++)
+    {
+      char c = json[i];
+
+      if (inString)
+      {
+        if (c == '\\')
+        {
+          i++;
+        }
+        else if (c == '"')
+        {
+          inString = false;
+          if (depth == 0)
+          {
+            return i + 1;
+          }
+        }
+      }
+      else if (c == '"')
+      {
+        inString = true;
+      }
+      else if (c == '{' || c == '[')
+      {
+        depth++;
+      }
+      else if (c == '}' || c == ']')
+      {
+        if (depth == 0)
+        {
+          return i;
+        }
+        if (--depth == 0)
+        {
+          return i + 1;
+        }
+      }
+      else if (depth == 0 && (c == ',' || isspace((unsigned char)c)))
+      {
+        return i;
+      }
+    }
+    return i;
+  }
+
+  std::string jsonMember(const std::string &json, const std::string &key)
+  {
+    size_t i = skipWhitespace(json, 0);
+    if (i >= json.size() || json[i] != '{')
+    {
+      return "";
+    }
+
+    for (i++;;)
+    {
+      i = skipWhitespace(json, i);
+      if (i >= json.size() || json[i] != '"')
+      {
+        return "";
+      }
+
+      size_t keyEnd = skipValue(json, i);
+      std::string name = jsonString(json.substr(i, keyEnd - i));
+
+      i = skipWhitespace(json, keyEnd);
+      if (i >= json.size() || json[i] != ':')
+      {
+        return "";
+      }
+
+      size_t start = skipWhitespace(json, i + 1);
+      size_t end = skipValue(json, start);
+      if (name == key)
+      {
+        return json.substr(start, end - start);
+      }
+
+      i = skipWhitespace(json, end);
+      if (i >= json.size() || json[i] != ',')
+      {
+        return "";
+      }
+      i++;
+    }
+  }
+
+  std::vector<std::string> jsonArray(const std::string &json)
+  {
+    std::vector<std::string> elements;
+    size_t i = skipWhitespace(json, 0);
+
+    if (i >= json.size() || json[i] != '[')
+    {
+      return elements;
+    }
+
+    for (i = skipWhitespace(json, i + 1); i < json.size() && json[i] != ']';)
+    {
+      size_t end = skipValue(json, i);
+      elements.push_back(json.substr(i, end - i));
+
+      i = skipWhitespace(json, end);
+      if (i < json.size() && json[i] == ',')
+      {
+        i = skipWhitespace(json, i + 1);
+      }
+      else
+      {
+        break;
+      }
+    }
+    return elements;
+  }
+
+  // Unquotes a string value, other values are returned as is.
+  std::string jsonString(const std::string &raw)
+  {
+    if (raw.size() < 2 || raw[0] != '"')
+    {
+      return raw;
+    }
+
+    std::string result;
+    for (size_t i = 1; i + 1 < raw.size(); i++)
+    {
+      if (raw[i] != '\\')
+      {
+        result += raw[i];
+        continue;
+      }
+
+      char c = raw[++i];
+      switch (c)
+      {
+      case 'n':
+        result += '\n';
+        break;
+      case 't':
+        result += '\t';
+        break;
+      case 'r':
+        result += '\r';
+        break;
+      case 'u':
+        result += (char)strtol(raw.substr(i + 1, 4).c_str(), nullptr, 16);
+        i += 4;
+        break;
+      default:
+        result += c;
+      }
+    }
+    return result;
+  }
+
+  // FNV-1a of the recorded body stands in for the server's data version.
+  static std::string bodyVersion(const std::string &body)
+  {
+    uint32_t hash = 2166136261u;
+    for (char c : body)
+    {
+      hash = (hash ^ (uint8_t)c) * 16777619u;
+    }
+
+    char version[9];
+    snprintf(version, sizeof(version), "%08x", hash);
+    return version;
+  }
+
+  // Loads recorded responses, one JSON object per line:
+  // {"t":seconds,"stationId":"...","latencyMs":optional,"body":{...}}
+  bool loadReplay(const std::string &path)
+  {
+    std::ifstream in(path);
+    std::string line;
+    int lineNumber = 0;
+
+    if (!in)
+    {
+      fprintf(stderr, "Cannot open replay file %s\n", path.c_str());
+      return false;
+    }
+
+    while (std::getline(in, line))
+    {
+      lineNumber++;
+      if (line.find_first_not_of(" \t\r") == std::string::npos)
+      {
+        continue;
+      }
+
+      std::string stationId = jsonString(jsonMember(line, "stationId"));
+      std::string body = jsonMember(line, "body");
+      std::string latency = jsonMember(line, "latencyMs");
+
+      if (stationId.empty() || body.empty() || body[0] != '{')
+      {
+        fprintf(stderr, "%s:%d: expected stationId and body\n", path.c_str(), lineNumber);
+        return false;
+      }
+
+      Record record = {atof(jsonMember(line, "t").c_str()), latency.empty() ? config.httpLatencyMillis : (uint32_t)atol(latency.c_str()), body, bodyVersion(body)};
+
+      // Add the version to the station object like the server does.
+      size_t station = body.find("\"station\"");
+      size_t brace = station == std::string::npos ? station : body.find('{', station);
+      if (brace != std::string::npos)
+      {
+        size_t next = skipWhitespace(body, brace + 1);
+        record.body.insert(brace + 1, "\"version\":\"" + record.version + "\"" + (body[next] == '}' ? "" : ","));
+      }
+
+      replay[stationId].push_back(record);
+    }
+
+    for (auto &station : replay)
+    {
+      std::stable_sort(station.second.begin(), station.second.end(), [](const Record &a, const Record &b) { return a.time < b.time; });
+    }
+    return true;
+  }
+
+  // Latest recording at the current virtual time.
+  static const Record *findRecord(const std::string &stationId)
+  {
+    auto it = replay.find(stationId);
+    if (it == replay.end())
+    {
+      return nullptr;
+    }
+
+    double now = clockMicros / 1e6;
+    const Record *found = nullptr;
+    for (const Record &record : it->second)
+    {
+      if (record.time > now)
+      {
+        break;
+      }
+      found = &record;
+    }
+    return found;
+  }
+
+  static std::string isoTime(uint32_t epoch, int offsetHours, bool micros)
+  {
+    time_t t = (time_t)epoch + offsetHours * 3600;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+
+    char buf[48];
+    size_t n = strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+    if (micros)
+    {
+      n += snprintf(buf + n, sizeof(buf) - n, ".%06llu", (unsigned long long)(clockMicros % 1000000));
+    }
+    snprintf(buf + n, sizeof(buf) - n, "%+03d:00", offsetHours);
+    return buf;
+  }
+
+  static std::string queryParameter(const std::string &query, const std::string &name)
+  {
+    size_t start = 0;
+
+    while (start < query.size())
+    {
+      size_t end = query.find('&', start);
+      end = end == std::string::npos ? query.size() : end;
+
+      if (query.compare(start, name.size() + 1, name + "=") == 0)
+      {
+        return query.substr(start + name.size() + 1, end - start - name.size() - 1);
+      }
+      start = end + 1;
+    }
+    return "";
+  }
+
+  // Answers a request, returns the HTTP status code or an HTTPC_ERROR_* code.
+  static int serve(const std::string &host, const std::string &path, std::string *body, uint32_t *latencyMillis)
+  {
+    *latencyMillis = config.httpLatencyMillis;
+
+    if (host == "worldtimeapi.org" && path.rfind("/api/timezone/", 0) == 0)
+    {
+      uint32_t now = epoch();
+      *body = "{\"timezone\":\"" + path.substr(14) + "\",\"datetime\":\"" + isoTime(now, -5, true) + "\",\"utc_datetime\":\"" + isoTime(now, 0, true) + "\",\"unixtime\":" + std::to_string(now) + "}";
+      return HTTP_CODE_OK;
+    }
+
+    if (host == "artofmystate.com" && path.rfind("/api/riverconditions.php?", 0) == 0)
+    {
+      std::string query = path.substr(path.find('?') + 1);
+      std::string stationId = queryParameter(query, "stationId");
+      std::string version = queryParameter(query, "version");
+      const Record *record = findRecord(stationId);
+
+      if (record == nullptr)
+      {
+        *body = "{\"error\":true,\"date\":\"" + isoTime(epoch(), -5, false) + "\",\"message\":\"No recording for station " + stationId + "\"}";
+      }
+      else if (record->version == version)
+      {
+        stats.httpUnchanged++;
+        *body = "{\"unchanged\":true,\"version\":\"" + version + "\"}";
+        *latencyMillis = record->latencyMillis;
+      }
+      else
+      {
+        *body = record->body;
+        *latencyMillis = record->latencyMillis;
+      }
+      return HTTP_CODE_OK;
+    }
+
+    // Recorded USGS instantaneous values response, served for any site list.
+    if (host == "waterservices.usgs.gov" && path.rfind("/nwis/iv/?", 0) == 0)
+    {
+      static std::string recorded;
+      if (recorded.empty())
+      {
+        std::ifstream in(config.usgsReplayPath);
+        recorded.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+      }
+
+      if (recorded.empty())
+      {
+        *body = "No recording.";
+        return HTTP_CODE_NOT_FOUND;
+      }
+
+      *body = recorded;
+      return HTTP_CODE_OK;
+    }
+
+    return HTTPC_ERROR_CONNECTION_REFUSED;
+  }
+
+  // gzip with the 4 KB deflate window the midpoint uses (windowBits 12),
+  // or 32 KB (windowBits 15) like a standard gzip server such as USGS.
+  std::string gzipEncode(const std::string &body, int windowBits)
+  {
+    z_stream stream = z_stream();
+    std::string encoded(deflateBound(&stream, body.size()) + 32, '\0');
+
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, windowBits + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+      return "";
+    }
+
+    stream.next_in = (Bytef *)body.data();
+    stream.avail_in = body.size();
+    stream.next_out = (Bytef *)&encoded[0];
+    stream.avail_out = encoded.size();
+
+    int result = deflate(&stream, Z_FINISH);
+    encoded.resize(stream.total_out);
+    deflateEnd(&stream);
+    return result == Z_STREAM_END ? encoded : "";
+  }
+
+  std::vector<std::string> replayBodies()
+  {
+    std::vector<std::string> bodies;
+
+    for (auto &station : replay)
+    {
+      for (const Record &record : station.second)
+      {
+        bodies.push_back(record.body);
+      }
+    }
+    return bodies;
+  }
+}
+
+// WiFiClient, reads deliver the response bytes of an in-process peer.
+
+WiFiClient::WiFiClient()
+{
+}
+
+WiFiClient::~WiFiClient()
+{
+  stop();
+}
+
+// Connects to the simulated server, costs a round trip.
+int WiFiClient::connect(IPAddress ip, uint16_t port)
+{
+  stop();
+
+  if (WiFi.status() != WL_CONNECTED)
+  {
+    return 0;
+  }
+
+  sim::stats.tcpConnects++;
+  delay(sim::config.rttMillis);
+
+  sim::Connection *connection = new sim::Connection;
+  connection->lastActive = sim::clockMicros;
+  _sim = connection;
+  return 1;
+}
+
+int WiFiClient::connect(const char *host, uint16_t port)
+{
+  IPAddress ip;
+  return WiFi.hostByName(host, ip) ? connect(ip, port) : 0;
+}
+
+// The TLS handshake costs two more round trips.
+int WiFiClientSecure::connect(const char *host, uint16_t port, int32_t timeout)
+{
+  if (!WiFiClient::connect(host, port))
+  {
+    return 0;
+  }
+
+  delay(2 * sim::config.rttMillis);
+  return 1;
+}
+
+size_t WiFiClient::write(uint8_t c)
+{
+  return write(&c, 1);
+}
+
+size_t WiFiClient::write(const uint8_t *buf, size_t size)
+{
+  if (_fd >= 0)
+  {
+    ssize_t n = send(_fd, buf, size, MSG_NOSIGNAL);
+    return n > 0 ? n : 0;
+  }
+  return connected() ? size : 0;
+}
+
+int WiFiClient::available()
+{
+  if (_fd >= 0)
+  {
+    int n = 0;
+    return ioctl(_fd, FIONREAD, &n) == 0 ? n : 0;
+  }
+
+  sim::Connection *connection = (sim::Connection *)_sim;
+  return connection ? connection->data.size() - connection->pos : 0;
+}
+
+int WiFiClient::read()
+{
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int WiFiClient::read(uint8_t *buf, size_t size)
+{
+  static uint64_t nanos = 0;
+  size_t n = min(size, (size_t)available());
+
+  if (n == 0)
+  {
+    return -1;
+  }
+
+  if (_fd >= 0)
+  {
+    return recv(_fd, buf, n, 0);
+  }
+
+  sim::Connection *connection = (sim::Connection *)_sim;
+  memcpy(buf, connection->data.data() + connection->pos, n);
+  connection->pos += n;
+  connection->lastActive = sim::clockMicros;
+
+  sim::stats.httpBytes += n;
+  nanos += (uint64_t)n * sim::httpNanosPerByte;
+  sim::advance(nanos / 1000);
+  nanos %= 1000;
+  return n;
+}
+
+int WiFiClient::peek()
+{
+  if (_fd >= 0)
+  {
+    uint8_t c;
+    return available() > 0 && recv(_fd, &c, 1, MSG_PEEK) == 1 ? c : -1;
+  }
+
+  sim::Connection *connection = (sim::Connection *)_sim;
+  return available() > 0 ? (uint8_t)connection->data[connection->pos] : -1;
+}
+
+void WiFiClient::stop()
+{
+  if (_fd >= 0)
+  {
+    close(_fd);
+    _fd = -1;
+  }
+  delete (sim::Connection *)_sim;
+  _sim = nullptr;
+}
+
+uint8_t WiFiClient::connected()
+{
+  if (_fd >= 0)
+  {
+    uint8_t c;
+    ssize_t n = recv(_fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n > 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+  }
+
+  sim::Connection *connection = (sim::Connection *)_sim;
+  return connection && !sim::inOutage() && sim::clockMicros - connection->lastActive < sim::config.keepAliveSeconds * 1000000ULL;
+}
+
+IPAddress WiFiClient::remoteIP() const
+{
+  return IPAddress(10, 0, 0, 1);
+}
+
+// Listens on 127.0.0.1 at the --http port, whatever port the firmware asks for.
+void WiFiServer::begin(uint16_t port)
+{
+  if (sim::config.httpPort == 0 || _fd >= 0)
+  {
+    return;
+  }
+
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(sim::config.httpPort);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  int one = 1;
+  _fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  if (bind(_fd, (sockaddr *)&address, sizeof(address)) != 0 || listen(_fd, 4) != 0)
+  {
+    fprintf(stderr, "Cannot listen on port %u\n", sim::config.httpPort);
+    close(_fd);
+    _fd = -1;
+  }
+}
+
+WiFiClient WiFiServer::available()
+{
+  return WiFiClient(_fd >= 0 ? accept(_fd, nullptr, nullptr) : -1);
+}
+
+void WiFiServer::end()
+{
+  if (_fd >= 0)
+  {
+    close(_fd);
+    _fd = -1;
+  }
+}
+
+// WiFi, networks come from the configuration, outages drop the connection.
+
+WiFiClass WiFi;
+
+namespace
+{
+  wl_status_t wifiStatus = WL_DISCONNECTED;
+  std::string wifiSsid;
+  uint64_t connectedAtMicros = 0;
+  int16_t scanResult = WIFI_SCAN_FAILED;
+  uint64_t scanDoneMicros = 0;
+  uint8_t bssid[6] = {0x02, 0, 0, 0, 0, 0};
+
+  bool isVisible(const std::string &ssid)
+  {
+    return std::find(sim::config.networks.begin(), sim::config.networks.end(), ssid) != sim::config.networks.end();
+  }
+}
+
+wl_status_t WiFiClass::begin(const char *ssid, const char *passphrase, int32_t channel, const uint8_t *bssid, bool connect)
+{
+  sim::stats.wifiConnects++;
+  wifiSsid = ssid;
+
+  if (!isVisible(wifiSsid))
+  {
+    wifiStatus = WL_NO_SSID_AVAIL;
+    return wifiStatus;
+  }
+
+  wifiStatus = WL_DISCONNECTED;
+  connectedAtMicros = sim::clockMicros + (uint64_t)sim::config.wifiConnectMillis * 1000;
+  return wifiStatus;
+}
+
+wl_status_t WiFiClass::status()
+{
+  if (wifiStatus == WL_DISCONNECTED && connectedAtMicros > 0)
+  {
+    if (sim::clockMicros < connectedAtMicros)
+    {
+      sim::nextDeadline(connectedAtMicros / 1000);
+      return wifiStatus;
+    }
+    connectedAtMicros = 0;
+    wifiStatus = sim::inOutage() ? WL_CONNECT_FAILED : WL_CONNECTED;
+  }
+
+  if (wifiStatus == WL_CONNECTED && sim::inOutage())
+  {
+    wifiStatus = WL_CONNECTION_LOST;
+  }
+  return wifiStatus;
+}
+
+bool WiFiClass::disconnect(bool wifioff, bool eraseap)
+{
+  wifiStatus = WL_DISCONNECTED;
+  connectedAtMicros = 0;
+  return true;
+}
+
+bool WiFiClass::reconnect()
+{
+  begin(wifiSsid.c_str());
+  return true;
+}
+
+bool WiFiClass::mode(wifi_mode_t mode)
+{
+  return true;
+}
+
+bool WiFiClass::setAutoReconnect(bool autoReconnect)
+{
+  return true;
+}
+
+bool WiFiClass::setSleep(bool enable)
+{
+  return true;
+}
+
+bool WiFiClass::setSleep(wifi_ps_type_t type)
+{
+  return true;
+}
+
+IPAddress WiFiClass::localIP()
+{
+  return status() == WL_CONNECTED ? IPAddress(192, 168, 1, 50) : IPAddress();
+}
+
+// The address ends with the --peer ID.
+String WiFiClass::macAddress()
+{
+  uint8_t mac[6];
+  char text[18];
+  macAddress(mac);
+  snprintf(text, sizeof(text), "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  return text;
+}
+
+uint8_t *WiFiClass::macAddress(uint8_t *mac)
+{
+  uint32_t id = sim::config.peerId != 0 ? sim::config.peerId : 1;
+  const uint8_t address[6] = {0x02, 0, (uint8_t)(id >> 24), (uint8_t)(id >> 16), (uint8_t)(id >> 8), (uint8_t)id};
+  memcpy(mac, address, 6);
+  return mac;
+}
+
+int8_t WiFiClass::RSSI()
+{
+  return status() == WL_CONNECTED ? -60 : 0;
+}
+
+uint8_t *WiFiClass::BSSID()
+{
+  return bssid;
+}
+
+String WiFiClass::BSSIDstr()
+{
+  return "02:00:00:00:00:00";
+}
+
+int32_t WiFiClass::channel()
+{
+  return 6;
+}
+
+String WiFiClass::SSID() const
+{
+  return wifiStatus == WL_CONNECTED ? String(wifiSsid.c_str()) : String();
+}
+
+int16_t WiFiClass::scanNetworks(bool async, bool show_hidden, bool passive, uint32_t max_ms_per_chan, uint8_t channel)
+{
+  scanResult = WIFI_SCAN_RUNNING;
+  scanDoneMicros = sim::clockMicros + (uint64_t)sim::config.wifiScanMillis * 1000;
+
+  if (!async)
+  {
+    delay(sim::config.wifiScanMillis);
+    return scanComplete();
+  }
+  return WIFI_SCAN_RUNNING;
+}
+
+// Access points are down during an outage.
+int16_t WiFiClass::scanComplete()
+{
+  if (scanResult == WIFI_SCAN_RUNNING)
+  {
+    if (sim::clockMicros < scanDoneMicros)
+    {
+      sim::nextDeadline(scanDoneMicros / 1000);
+      return WIFI_SCAN_RUNNING;
+    }
+    scanResult = sim::inOutage() ? 0 : sim::config.networks.size();
+  }
+  return scanResult;
+}
+
+void WiFiClass::scanDelete()
+{
+  scanResult = WIFI_SCAN_FAILED;
+}
+
+String WiFiClass::SSID(uint8_t networkItem)
+{
+  return networkItem < scanResult ? String(sim::config.networks[networkItem].c_str()) : String();
+}
+
+int32_t WiFiClass::RSSI(uint8_t networkItem)
+{
+  return -55 - 5 * networkItem;
+}
+
+uint8_t *WiFiClass::BSSID(uint8_t networkItem)
+{
+  bssid[5] = networkItem;
+  return bssid;
+}
+
+int32_t WiFiClass::channel(uint8_t networkItem)
+{
+  return 6;
+}
+
+int WiFiClass::hostByName(const char *host, IPAddress &result)
+{
+  if (status() != WL_CONNECTED)
+  {
+    return 0;
+  }
+
+  sim::stats.dnsLookups++;
+  delay(sim::config.rttMillis);
+  result = IPAddress(10, 0, 0, 1);
+  return 1;
+}
+
+// AsyncUDP, multicast on the host loopback with --peer so simulators on
+// one host share packets, else packets go nowhere. Datagrams are dropped
+// while WiFi is not connected.
+
+static std::set<AsyncUDP *> udpListeners;
+
+bool AsyncUDP::listenMulticast(const IPAddress &address, uint16_t port, uint8_t ttl)
+{
+  close();
+  _listening = true;
+  udpListeners.insert(this);
+
+  if (sim::config.peerId == 0)
+  {
+    return true;
+  }
+
+  sockaddr_in local = {};
+  local.sin_family = AF_INET;
+  local.sin_port = htons(port);
+  local.sin_addr.s_addr = htonl(INADDR_ANY);
+
+  ip_mreq membership = {};
+  membership.imr_multiaddr.s_addr = (uint32_t)address;
+  membership.imr_interface.s_addr = htonl(INADDR_LOOPBACK);
+  in_addr interface = membership.imr_interface;
+  int one = 1;
+
+  _fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+  setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  setsockopt(_fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+
+  if (bind(_fd, (sockaddr *)&local, sizeof(local)) != 0 ||
+      setsockopt(_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) != 0 ||
+      setsockopt(_fd, IPPROTO_IP, IP_MULTICAST_IF, &interface, sizeof(interface)) != 0 ||
+      setsockopt(_fd, IPPROTO_IP, IP_MULTICAST_LOOP, &one, sizeof(one)) != 0)
+  {
+    fprintf(stderr, "Cannot join multicast group on port %u\n", port);
+    close();
+    return false;
+  }
+  return true;
+}
+
+size_t AsyncUDP::writeTo(const uint8_t *data, size_t length, const IPAddress &address, uint16_t port)
+{
+  if (!_listening || wifiStatus != WL_CONNECTED || sim::inOutage())
+  {
+    return 0;
+  }
+  if (_fd < 0)
+  {
+    return length;
+  }
+
+  sockaddr_in remote = {};
+  remote.sin_family = AF_INET;
+  remote.sin_port = htons(port);
+  remote.sin_addr.s_addr = (uint32_t)address;
+
+  ssize_t sent = sendto(_fd, data, length, 0, (sockaddr *)&remote, sizeof(remote));
+  return sent > 0 ? sent : 0;
+}
+
+void AsyncUDP::close()
+{
+  if (_fd >= 0)
+  {
+    ::close(_fd);
+    _fd = -1;
+  }
+  _listening = false;
+  udpListeners.erase(this);
+}
+
+void AsyncUDP::poll()
+{
+  uint8_t buffer[1500];
+  sockaddr_in remote;
+  socklen_t remoteLength = sizeof(remote);
+  ssize_t length;
+
+  while (_fd >= 0 && (length = recvfrom(_fd, buffer, sizeof(buffer), 0, (sockaddr *)&remote, &remoteLength)) >= 0)
+  {
+    // The multicast loop also returns this simulator's own packets.
+    if (_handler && wifiStatus == WL_CONNECTED && !sim::inOutage())
+    {
+      AsyncUDPPacket packet(buffer, length, IPAddress((uint32_t)remote.sin_addr.s_addr));
+      _handler(packet);
+    }
+    remoteLength = sizeof(remote);
+  }
+}
+
+namespace sim
+{
+  void pollUdp()
+  {
+    for (AsyncUDP *udp : udpListeners)
+    {
+      udp->poll();
+    }
+  }
+}
+
+// HTTPClient
+
+// Without a client given to begin() every request connects anew.
+struct HTTPClient::Impl
+{
+  std::string host;
+  std::string path;
+  std::vector<std::string> collect;
+  std::map<std::string, std::string> requestHeaders;
+  std::map<std::string, std::string> headers;
+  WiFiClient ownClient;
+  WiFiClient *client = &ownClient;
+  int size = -1;
+};
+
+HTTPClient::HTTPClient() : _impl(new Impl)
+{
+}
+
+HTTPClient::~HTTPClient()
+{
+  delete _impl;
+}
+
+bool HTTPClient::begin(String url)
+{
+  std::string u = url.c_str();
+  size_t scheme = u.find("://");
+  size_t start = scheme == std::string::npos ? 0 : scheme + 3;
+  size_t slash = u.find('/', start);
+
+  _impl->host = u.substr(start, slash == std::string::npos ? std::string::npos : slash - start);
+  _impl->path = slash == std::string::npos ? "/" : u.substr(slash);
+  _impl->requestHeaders.clear();
+  _impl->headers.clear();
+  _impl->size = -1;
+  _impl->client = &_impl->ownClient;
+  return !_impl->host.empty();
+}
+
+bool HTTPClient::begin(WiFiClient &client, String url)
+{
+  bool result = begin(url);
+  _impl->client = &client;
+  return result;
+}
+
+bool HTTPClient::begin(WiFiClient &client, String host, uint16_t port, String uri, bool https)
+{
+  return begin(client, String("http://") + host + uri);
+}
+
+// Connections of clients given to begin() are kept open for reuse.
+void HTTPClient::end()
+{
+  if (_impl->client == &_impl->ownClient)
+  {
+    _impl->ownClient.stop();
+  }
+}
+
+bool HTTPClient::connected()
+{
+  return _impl->client->connected();
+}
+
+void HTTPClient::setReuse(bool reuse)
+{
+}
+
+void HTTPClient::setTimeout(uint16_t timeout)
+{
+}
+
+void HTTPClient::setConnectTimeout(int32_t connectTimeout)
+{
+}
+
+void HTTPClient::useHTTP10(bool usehttp10)
+{
+}
+
+void HTTPClient::addHeader(const String &name, const String &value, bool first, bool replace)
+{
+  _impl->requestHeaders[name.c_str()] = value.c_str();
+}
+
+void HTTPClient::collectHeaders(const char *headerKeys[], const size_t headerKeysCount)
+{
+  _impl->collect.assign(headerKeys, headerKeys + headerKeysCount);
+}
+
+String HTTPClient::header(const char *name)
+{
+  for (auto &header : _impl->headers)
+  {
+    if (strcasecmp(header.first.c_str(), name) == 0)
+    {
+      return header.second.c_str();
+    }
+  }
+  return String();
+}
+
+bool HTTPClient::hasHeader(const char *name)
+{
+  return !header(name).isEmpty();
+}
+
+int HTTPClient::GET()
+{
+  std::string body;
+  uint32_t latencyMillis;
+  int code = HTTPC_ERROR_CONNECTION_REFUSED;
+
+  sim::stats.httpRequests++;
+  sim::stats.httpByHost[_impl->host]++;
+
+  if (_impl->client->connected() || _impl->client->connect(_impl->host.c_str(), 80))
+  {
+    code = sim::serve(_impl->host, _impl->path, &body, &latencyMillis);
+  }
+
+  if (code <= 0)
+  {
+    sim::stats.httpFailures++;
+    delay(sim::config.httpLatencyMillis);
+    return code;
+  }
+
+  delay(latencyMillis);
+
+  std::map<std::string, std::string> response = {{"Content-Type", "application/json"}, {"Connection", "keep-alive"}, {"Keep-Alive", "timeout=" + std::to_string(sim::config.keepAliveSeconds) + ", max=100"}};
+
+  // Encoded like the host does when the client accepts gzip.
+  for (auto &header : _impl->requestHeaders)
+  {
+    if (strcasecmp(header.first.c_str(), "Accept-Encoding") == 0 && header.second.find("gzip") != std::string::npos && sim::config.gzip)
+    {
+      body = sim::gzipEncode(body, _impl->host == "waterservices.usgs.gov" ? 15 : 12);
+      response["Content-Encoding"] = "gzip";
+    }
+  }
+  response["Content-Length"] = std::to_string(body.size());
+
+  for (const std::string &key : _impl->collect)
+  {
+    auto it = response.find(key);
+    if (it != response.end())
+    {
+      _impl->headers[key] = it->second;
+    }
+  }
+
+  sim::Connection *connection = (sim::Connection *)_impl->client->_sim;
+  connection->data = body;
+  connection->pos = 0;
+  connection->lastActive = sim::clockMicros;
+  _impl->size = body.size();
+  return code;
+}
+
+int HTTPClient::getSize()
+{
+  return _impl->size;
+}
+
+WiFiClient &HTTPClient::getStream()
+{
+  return *_impl->client;
+}
+
+WiFiClient *HTTPClient::getStreamPtr()
+{
+  return _impl->client;
+}
+
+String HTTPClient::getString()
+{
+  return _impl->client->readString();
+}
+
+String HTTPClient::errorToString(int error)
+{
+  switch (error)
+  {
+  case HTTPC_ERROR_CONNECTION_REFUSED:
+    return "connection refused";
+  case HTTPC_ERROR_SEND_HEADER_FAILED:
+    return "send header failed";
+  case HTTPC_ERROR_SEND_PAYLOAD_FAILED:
+    return "send payload failed";
+  case HTTPC_ERROR_NOT_CONNECTED:
+    return "not connected";
+  case HTTPC_ERROR_CONNECTION_LOST:
+    return "connection lost";
+  case HTTPC_ERROR_NO_STREAM:
+    return "no stream";
+  case HTTPC_ERROR_NO_HTTP_SERVER:
+    return "no HTTP server";
+  case HTTPC_ERROR_TOO_LESS_RAM:
+    return "too less ram";
+  case HTTPC_ERROR_ENCODING:
+    return "Transfer-Encoding not supported";
+  case HTTPC_ERROR_STREAM_WRITE:
+    return "Stream write error";
+  case HTTPC_ERROR_READ_TIMEOUT:
+    return "read Timeout";
+  default:
+    return String();
+  }
+}
@@ -0,0 +1,93 @@
+// Non-volatile storage for the simulator, kept in memory for the run.
+
+#include "sim.h"
+#include <Preferences.h>
+
+static std::map<std::string, std::string> storage;
+
+static std::string storageKey(const String &space, const char *key)
+{
+  return std::string(space.c_str()) + "/" + key;
+}
+
+bool Preferences::begin(const char *name, bool readOnly)
+{
+  _namespace = name;
+  return true;
+}
+
+void Preferences::end()
+{
+  _namespace = "";
+}
+
+bool Preferences::clear()
+{
+  std::string prefix = storageKey(_namespace, "");
+  for (auto it = storage.lower_bound(prefix); it != storage.end() && it->first.compare(0, prefix.size(), prefix) == 0;)
+  {
+    it = storage.erase(it);
+  }
+  return true;
+}
+
+bool Preferences::remove(const char *key)
+{
+  return storage.erase(storageKey(_namespace, key)) > 0;
+}
+
+size_t Preferences::putInt(const char *key, int32_t value)
+{
+  return putBytes(key, &value, sizeof(value));
+}
+
+size_t Preferences::putUInt(const char *key, uint32_t value)
+{
+  return putBytes(key, &value, sizeof(value));
+}
+
+size_t Preferences::putString(const char *key, const String &value)
+{
+  return putBytes(key, value.c_str(), value.length());
+}
+
+size_t Preferences::putBytes(const char *key, const void *value, size_t len)
+{
+  storage[storageKey(_namespace, key)].assign((const char *)value, len);
+  return len;
+}
+
+int32_t Preferences::getInt(const char *key, int32_t defaultValue)
+{
+  int32_t value = defaultValue;
+  return getBytes(key, &value, sizeof(value)) == sizeof(value) ? value : defaultValue;
+}
+
+uint32_t Preferences::getUInt(const char *key, uint32_t defaultValue)
+{
+  uint32_t value = defaultValue;
+  return getBytes(key, &value, sizeof(value)) == sizeof(value) ? value : defaultValue;
+}
+
+String Preferences::getString(const char *key, String defaultValue)
+{
+  auto it = storage.find(storageKey(_namespace, key));
+  return it == storage.end() ? defaultValue : String(it->second.c_str());
+}
+
+size_t Preferences::getBytes(const char *key, void *buf, size_t maxLen)
+{
+  auto it = storage.find(storageKey(_namespace, key));
+  if (it == storage.end() || it->second.size() > maxLen)
+  {
+    return 0;
+  }
+
+  memcpy(buf, it->second.data(), it->second.size());
+  return it->second.size();
+}
+
+bool Preferences::isKey(const char *key)
+{
+  return storage.count(storageKey(_namespace, key)) > 0;
+}
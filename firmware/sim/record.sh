@@ -0,0 +1,29 @@
+#!/bin/sh
+# Records midpoint API responses for the simulator replay file.
+#
+# Usage: sim/record.sh STATION_ID... >> sim/replay/recorded.jsonl
+# Run it periodically (e.g. from cron) to capture changes over time, the
+# simulator serves each station's latest record at the virtual time
+# ("t" is seconds since RECORD_START, set it to the epoch of the first run).
+#
+# Usage: sim/record.sh --usgs USGS_ID... > sim/replay/usgs-iv.json
+# Records the USGS instantaneous values response of direct USGS mode.
+
+if [ "$1" = "--usgs" ]; then
+  shift
+  sites=$(echo "$@" | tr ' ' ',')
+  curl -sf --compressed "https://waterservices.usgs.gov/nwis/iv/?format=json&siteStatus=active&parameterCd=00060,00065&sites=$sites"
+  exit
+fi
+
+host="http://artofmystate.com/api/riverconditions.php"
+now=$(date +%s)
+first=${RECORD_START:-$now}
+
+for station in "$@"; do
+  start=$(date +%s%3N)
+  body=$(curl -sf "$host?stationId=$station") || continue
+  latency=$(( $(date +%s%3N) - start ))
+  body=$(printf '%s' "$body" | tr -d '\r\n')
+  printf '{"t":%d,"stationId":"%s","latencyMs":%d,"body":%s}\n' $((now - first)) "$station" "$latency" "$body"
+done
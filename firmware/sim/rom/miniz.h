@@ -0,0 +1,141 @@
+// Host shim of the ESP32 ROM tinfl API (simulator), backed by the host zlib.
+// Like the ROM tinfl with a wrapping output buffer, back-references are
+// limited to the size of the caller's buffer: zlib gets the same window
+// size and fails on a stream using a larger window.
+#ifndef SIM_ROM_MINIZ_H
+#define SIM_ROM_MINIZ_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <zlib.h>
+
+typedef uint8_t mz_uint8;
+typedef uint32_t mz_uint32;
+
+enum
+{
+  TINFL_FLAG_PARSE_ZLIB_HEADER = 1,
+  TINFL_FLAG_HAS_MORE_INPUT = 2,
+  TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF = 4,
+  TINFL_FLAG_COMPUTE_ADLER32 = 8
+};
+
+typedef enum
+{
+  TINFL_STATUS_BAD_PARAM = -3,
+  TINFL_STATUS_ADLER32_MISMATCH = -2,
+  TINFL_STATUS_FAILED = -1,
+  TINFL_STATUS_DONE = 0,
+  TINFL_STATUS_NEEDS_MORE_INPUT = 1,
+  TINFL_STATUS_HAS_MORE_OUTPUT = 2
+} tinfl_status;
+
+// Plain data like the ROM struct: zlib allocates from the arena, so
+// free() of the decompressor releases everything.
+typedef struct
+{
+  uint32_t m_state; // 0 until the first tinfl_decompress().
+  z_stream m_stream;
+  size_t m_used;
+  alignas(16) uint8_t m_arena[48 * 1024];
+} tinfl_decompressor;
+
+#define tinfl_init(r) \
+  do                  \
+  {                   \
+    (r)->m_state = 0; \
+  } while (0)
+
+inline voidpf tinfl_arena_alloc(voidpf opaque, uInt items, uInt size)
+{
+  tinfl_decompressor *r = (tinfl_decompressor *)opaque;
+  size_t bytes = ((size_t)items * size + 15) & ~(size_t)15;
+
+  if (r->m_used + bytes > sizeof(r->m_arena))
+  {
+    return Z_NULL;
+  }
+  r->m_used += bytes;
+  return r->m_arena + r->m_used - bytes;
+}
+
+inline void tinfl_arena_free(voidpf opaque, voidpf address)
+{
+}
+
+inline tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_next, size_t *pIn_buf_size, mz_uint8 *pOut_buf_start, mz_uint8 *pOut_buf_next, size_t *pOut_buf_size, const mz_uint32 decomp_flags)
+{
+  size_t inSize = *pIn_buf_size;
+  size_t outSize = *pOut_buf_size;
+  size_t bufferSize = (pOut_buf_next - pOut_buf_start) + outSize;
+
+  *pIn_buf_size = 0;
+  *pOut_buf_size = 0;
+
+  // As in tinfl, a wrapping output buffer is a power of two.
+  if ((decomp_flags & TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF) || (decomp_flags & TINFL_FLAG_PARSE_ZLIB_HEADER) || (bufferSize & (bufferSize - 1)) != 0 || pOut_buf_next < pOut_buf_start)
+  {
+    return TINFL_STATUS_BAD_PARAM;
+  }
+
+  if (r->m_state == 0)
+  {
+    int windowBits = 8;
+    while (windowBits < 15 && ((size_t)1 << windowBits) < bufferSize)
+    {
+      windowBits++;
+    }
+    if (((size_t)1 << windowBits) != bufferSize)
+    {
+      return TINFL_STATUS_BAD_PARAM;
+    }
+
+    r->m_used = 0;
+    r->m_stream = z_stream();
+    r->m_stream.zalloc = tinfl_arena_alloc;
+    r->m_stream.zfree = tinfl_arena_free;
+    r->m_stream.opaque = r;
+
+    // Raw deflate, the caller parses the gzip wrapper.
+    if (inflateInit2(&r->m_stream, -windowBits) != Z_OK)
+    {
+      return TINFL_STATUS_FAILED;
+    }
+    r->m_state = 1;
+  }
+
+  if (r->m_state == 2)
+  {
+    return TINFL_STATUS_DONE;
+  }
+
+  r->m_stream.next_in = (Bytef *)pIn_buf_next;
+  r->m_stream.avail_in = inSize;
+  r->m_stream.next_out = pOut_buf_next;
+  r->m_stream.avail_out = outSize;
+
+  int result = inflate(&r->m_stream, Z_NO_FLUSH);
+
+  *pIn_buf_size = inSize - r->m_stream.avail_in;
+  *pOut_buf_size = outSize - r->m_stream.avail_out;
+
+  if (result == Z_STREAM_END)
+  {
+    r->m_state = 2;
+    return TINFL_STATUS_DONE;
+  }
+
+  // Z_BUF_ERROR only means no progress was possible.
+  if (result != Z_OK && result != Z_BUF_ERROR)
+  {
+    return TINFL_STATUS_FAILED;
+  }
+
+  if (r->m_stream.avail_out == 0)
+  {
+    return TINFL_STATUS_HAS_MORE_OUTPUT;
+  }
+  return (decomp_flags & TINFL_FLAG_HAS_MORE_INPUT) ? TINFL_STATUS_NEEDS_MORE_INPUT : TINFL_STATUS_FAILED;
+}
+
+#endif
@@ -0,0 +1,179 @@
+// Simulator internals shared by the host shims and the simulator main.
+#ifndef SIM_H
+#define SIM_H
+
+#include <Arduino.h>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace sim
+{
+  // Modelled cost of hardware operations in virtual time.
+  const uint32_t sdOpenMicros = 2000;     // FAT lookup per open().
+  const uint32_t sdReadNanosPerByte = 1000;
+  const uint32_t sdWriteNanosPerByte = 2000;
+  const uint32_t flashOpenMicros = 300;   // LittleFS lookup per open().
+  const uint32_t flashReadNanosPerByte = 100;
+  const uint32_t flashWriteNanosPerByte = 5000; // Program and erase.
+  const uint32_t tftNanosPerPixel = 600;  // 24 bit pixels at 40 MHz SPI.
+  const uint32_t ledMicrosPerPixel = 30;  // 24 bits at 800 kHz.
+  const uint32_t httpNanosPerByte = 10000; // 100 KB/s.
+
+  struct ButtonPress
+  {
+    double time;     // Seconds since start.
+    uint8_t pin;
+    uint32_t holdMillis;
+  };
+
+  struct FileEdit
+  {
+    double time;          // Seconds since start.
+    std::string hostPath; // Copied to the SD card root.
+  };
+
+  struct Outage
+  {
+    double start; // Seconds since start.
+    double end;
+  };
+
+  struct Config
+  {
+    std::string sdCardPath = "../sd-card";
+    std::string replayPath = "sim/replay/midpoint.jsonl";
+    std::string usgsReplayPath = "sim/replay/usgs-iv.json"; // Direct USGS mode response.
+    std::string logPath;           // Serial output, empty to discard.
+    std::string framePath;         // PPM of the last frame, empty for none.
+    bool verbose = false;          // Serial output to stdout.
+    bool gzip = true;              // Responses gzip encoded when accepted.
+    int benchIterations = 0;       // Decode benchmark instead of a run when > 0.
+    int gzipBenchIterations = 0;   // Inflate benchmark instead of a run when > 0.
+    int trendBenchIterations = 0;  // Trend screen benchmark instead of a run when > 0.
+    double days = 7;
+    uint32_t startEpoch = 1599696000; // 2020-09-10T00:00:00Z.
+    uint32_t loopMicros = 200;        // CPU time of a loop() pass doing work.
+    uint32_t idleStepMillis = 1;      // Clock step of loop() passes neither working nor waiting.
+    uint32_t httpLatencyMillis = 300; // Request to response headers.
+    uint32_t rttMillis = 100;         // DNS lookup or TCP handshake.
+    uint32_t keepAliveSeconds = 5;    // Server closes idle connections.
+    uint32_t wifiConnectMillis = 1500;
+    uint32_t wifiScanMillis = 2000;
+    uint16_t httpPort = 0;            // Host port of the firmware's WiFiServer, 0 for none.
+    uint32_t peerId = 0;              // End of the MAC address, UDP on the host when not 0.
+    std::vector<std::string> networks; // Visible SSIDs, empty for those in wifi.txt.
+    std::vector<Outage> outages;
+    std::vector<Outage> sdFaults; // SD card removed or failing.
+    std::vector<Outage> statusHolds; // Status server held as during a table swap.
+    std::vector<ButtonPress> presses;
+    std::vector<FileEdit> edits; // SD card files replaced during the run.
+  };
+
+  struct Stats
+  {
+    uint64_t loops = 0;
+    uint64_t idleLoops = 0;
+    uint64_t sleepMicros = 0; // Power manager idle waits.
+    uint64_t maxLoopMicros = 0;
+    std::map<uint64_t, uint64_t> loopMicros; // Histogram by upper bound.
+
+    uint32_t httpRequests = 0;
+    uint32_t httpFailures = 0;
+    uint32_t httpUnchanged = 0;
+    uint64_t httpBytes = 0;
+    uint32_t dnsLookups = 0;
+    uint32_t tcpConnects = 0;
+    std::map<std::string, uint32_t> httpByHost;
+
+    uint32_t sdOpens = 0;
+    uint64_t sdBytesRead = 0;
+    uint64_t sdBytesWritten = 0;
+    uint32_t flashOpens = 0;
+    uint64_t flashBytesRead = 0;
+    uint64_t flashBytesWritten = 0;
+
+    uint64_t tftPixels = 0;
+    uint64_t redraws = 0; // loop() passes drawing to the display.
+    uint32_t ledFrames = 0;
+    uint32_t ledChangedFrames = 0;
+
+    uint32_t wifiConnects = 0;
+    uint32_t logLines = 0;
+    uint32_t logWarnings = 0;
+    uint32_t logErrors = 0;
+  };
+
+  extern Config config;
+  extern Stats stats;
+
+  // Microseconds at which the simulation ends.
+  extern uint64_t endMicros;
+
+  // Virtual wall clock (epoch seconds).
+  inline uint32_t epoch()
+  {
+    return config.startEpoch + clockMicros / 1000000;
+  }
+
+  inline bool inWindow(const std::vector<Outage> &windows)
+  {
+    double now = clockMicros / 1e6;
+    for (const Outage &window : windows)
+    {
+      if (now >= window.start && now < window.end)
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  inline bool inOutage()
+  {
+    return inWindow(config.outages);
+  }
+
+  inline bool inSDFault()
+  {
+    return inWindow(config.sdFaults);
+  }
+
+  // Earliest timer deadline reported since the last call, reset to none.
+  unsigned long takeDeadline();
+
+  // Prints the report and exits, called when virtual time runs out
+  // (also from blocking loops like FatalError()).
+  [[noreturn]] void finish();
+
+  void setPinLevel(uint8_t pin, int level);
+
+  // Hands received host datagrams to the AsyncUDP handlers.
+  void pollUdp();
+
+  bool seedFileSystem(const std::string &hostPath);
+  bool loadReplay(const std::string &path);
+  std::vector<std::string> replayBodies();
+  std::string gzipEncode(const std::string &body, int windowBits = 12);
+
+  // Times location payload decoding over the SD card's locations, returns the exit code.
+  int runBench(int iterations);
+
+  // Times inflating the replayed responses gzip encoded, returns the exit code.
+  int runGzipBench(int iterations);
+
+  // Times switching to the trend screen with a week of history, returns the exit code.
+  int runTrendBench(int iterations);
+
+  void writeFrame(const std::string &path);
+  std::string screenText();
+  std::string ledSummary();
+
+  // Minimal JSON scanning for the replay file and wifi.txt.
+  // Returns the raw text of a member value (strings keep their quotes).
+  std::string jsonMember(const std::string &json, const std::string &key);
+  std::vector<std::string> jsonArray(const std::string &json);
+  std::string jsonString(const std::string &raw);
+}
+
+#endif
@@ -0,0 +1,491 @@
+// Simulator main: runs setup() and loop() against the host shims in virtual
+// time and prints a report of the run.
+//
+// Usage: pio run -e native && .pio/build/native/program [options]
+//   --sd DIR              SD card contents (default ../sd-card)
+//   --replay FILE         recorded API responses (default sim/replay/midpoint.jsonl)
+//   --usgs FILE           recorded USGS response (default sim/replay/usgs-iv.json)
+//   --days N              simulated duration (default 7)
+//   --start EPOCH         wall clock at start (default 2020-09-10T00:00:00Z)
+//   --latency MS          default HTTP latency (default 300)
+//   --network SSID        visible network, repeatable (default the SSIDs in wifi.txt)
+//   --outage START-END    WiFi outage, times like 90s, 30m, 2h or 1d, repeatable
+//   --sd-fault START-END  SD card removed or failing, repeatable
+//   --status-hold START-END  status server held (answers 503), repeatable
+//   --press TIME:BUTTON[:MS]  button press (left, select, right or a pin), repeatable
+//   --edit TIME:FILE      copy a host file to the SD card root at TIME, repeatable
+//   --log FILE            serial output with virtual time stamps
+//   --frame FILE          final display contents as PPM
+//   --verbose             serial output to stdout
+//   --bench N             time N passes of location payload decoding and exit
+//   --bench-gzip N        time N passes of inflating the replayed responses and exit
+//   --bench-trend N       time N switches to the trend screen with a week of history and exit
+//   --no-gzip             serve responses without gzip encoding
+//   --http PORT           serve the status endpoint on 127.0.0.1:PORT, runs in real time
+//   --peer ID             device ID for peer sharing over host multicast, runs in real time
+
+#include "sim.h"
+#include <logger.h>
+#include <powerManager.h>
+#include <SD.h>
+#include <statusServer.h>
+#include <chrono>
+#include <fstream>
+#include <limits.h>
+#include <sstream>
+#include <thread>
+
+void setup();
+void loop();
+
+extern Logger logger;
+extern PowerManager power;
+extern StatusServer statusServer;
+
+namespace sim
+{
+  Config config;
+  Stats stats;
+
+  // Parses 90, 90s, 30m, 2h or 1d to seconds.
+  static double parseDuration(const std::string &text)
+  {
+    char *end;
+    double value = strtod(text.c_str(), &end);
+
+    switch (*end)
+    {
+    case 'm':
+      return value * 60;
+    case 'h':
+      return value * 3600;
+    case 'd':
+      return value * 86400;
+    default:
+      return value;
+    }
+  }
+
+  static uint8_t parseButton(const std::string &name)
+  {
+    if (name == "left")
+    {
+      return 34;
+    }
+    if (name == "select")
+    {
+      return 39;
+    }
+    if (name == "right")
+    {
+      return 36;
+    }
+    return atoi(name.c_str());
+  }
+
+  static bool parseArguments(int argc, char **argv)
+  {
+    for (int i = 1; i < argc; i++)
+    {
+      std::string option = argv[i];
+      std::string value = i + 1 < argc ? argv[i + 1] : "";
+      bool hasValue = option != "--verbose" && option != "--no-gzip";
+
+      if (hasValue && i + 1 >= argc)
+      {
+        fprintf(stderr, "Missing value for %s\n", option.c_str());
+        return false;
+      }
+
+      if (option == "--sd")
+      {
+        config.sdCardPath = value;
+      }
+      else if (option == "--replay")
+      {
+        config.replayPath = value;
+      }
+      else if (option == "--usgs")
+      {
+        config.usgsReplayPath = value;
+      }
+      else if (option == "--days")
+      {
+        config.days = atof(value.c_str());
+      }
+      else if (option == "--start")
+      {
+        config.startEpoch = strtoul(value.c_str(), nullptr, 10);
+      }
+      else if (option == "--latency")
+      {
+        config.httpLatencyMillis = strtoul(value.c_str(), nullptr, 10);
+      }
+      else if (option == "--network")
+      {
+        config.networks.push_back(value);
+      }
+      else if (option == "--outage" || option == "--sd-fault" || option == "--status-hold")
+      {
+        size_t dash = value.find('-');
+        if (dash == std::string::npos)
+        {
+          fprintf(stderr, "Expected %s START-END, got %s\n", option.c_str(), value.c_str());
+          return false;
+        }
+        std::vector<Outage> &windows = option == "--outage" ? config.outages : option == "--sd-fault" ? config.sdFaults : config.statusHolds;
+        windows.push_back({parseDuration(value.substr(0, dash)), parseDuration(value.substr(dash + 1))});
+      }
+      else if (option == "--press")
+      {
+        std::vector<std::string> fields;
+        std::stringstream stream(value);
+        for (std::string field; std::getline(stream, field, ':');)
+        {
+          fields.push_back(field);
+        }
+        if (fields.size() < 2)
+        {
+          fprintf(stderr, "Expected --press TIME:BUTTON[:MS], got %s\n", value.c_str());
+          return false;
+        }
+        config.presses.push_back({parseDuration(fields[0]), parseButton(fields[1]), fields.size() > 2 ? (uint32_t)atol(fields[2].c_str()) : 100});
+      }
+      else if (option == "--edit")
+      {
+        size_t colon = value.find(':');
+        if (colon == std::string::npos)
+        {
+          fprintf(stderr, "Expected --edit TIME:FILE, got %s\n", value.c_str());
+          return false;
+        }
+        config.edits.push_back({parseDuration(value.substr(0, colon)), value.substr(colon + 1)});
+      }
+      else if (option == "--log")
+      {
+        config.logPath = value;
+      }
+      else if (option == "--frame")
+      {
+        config.framePath = value;
+      }
+      else if (option == "--bench")
+      {
+        config.benchIterations = atoi(value.c_str());
+      }
+      else if (option == "--bench-gzip")
+      {
+        config.gzipBenchIterations = atoi(value.c_str());
+      }
+      else if (option == "--bench-trend")
+      {
+        config.trendBenchIterations = atoi(value.c_str());
+      }
+      else if (option == "--http")
+      {
+        config.httpPort = atoi(value.c_str());
+      }
+      else if (option == "--peer")
+      {
+        config.peerId = strtoul(value.c_str(), nullptr, 10);
+      }
+      else if (option == "--verbose")
+      {
+        config.verbose = true;
+      }
+      else if (option == "--no-gzip")
+      {
+        config.gzip = false;
+      }
+      else
+      {
+        fprintf(stderr, "Unknown option %s\n", option.c_str());
+        return false;
+      }
+
+      i += hasValue;
+    }
+    return true;
+  }
+
+  // The SSIDs of wifi.txt are visible unless networks are given.
+  static void defaultNetworks()
+  {
+    std::ifstream in(config.sdCardPath + "/wifi.txt");
+    std::stringstream text;
+    text << in.rdbuf();
+
+    for (const std::string &credential : jsonArray(jsonMember(text.str(), "wifiCredentials")))
+    {
+      config.networks.push_back(jsonString(jsonMember(credential, "ssid")));
+    }
+  }
+
+  // Button edges in time order, a press followed by its release.
+  struct Edge
+  {
+    uint64_t micros;
+    uint8_t pin;
+    int level;
+  };
+
+  static std::vector<Edge> edges;
+  static size_t nextEdge = 0;
+
+  static void scheduleEdges()
+  {
+    for (const ButtonPress &press : config.presses)
+    {
+      uint64_t start = press.time * 1e6;
+      edges.push_back({start, press.pin, LOW});
+      edges.push_back({start + (uint64_t)press.holdMillis * 1000, press.pin, HIGH});
+    }
+    std::stable_sort(edges.begin(), edges.end(), [](const Edge &a, const Edge &b) { return a.micros < b.micros; });
+  }
+
+  static void applyEdges()
+  {
+    while (nextEdge < edges.size() && edges[nextEdge].micros <= clockMicros)
+    {
+      setPinLevel(edges[nextEdge].pin, edges[nextEdge].level);
+      nextEdge++;
+    }
+  }
+
+  bool sleepUntil(unsigned long ms)
+  {
+    uint64_t target = (uint64_t)ms * 1000;
+    bool woken = nextEdge < edges.size() && edges[nextEdge].micros < target;
+
+    if (woken)
+    {
+      target = edges[nextEdge].micros;
+    }
+    if (target > clockMicros)
+    {
+      stats.sleepMicros += target - clockMicros;
+      advance(target - clockMicros);
+    }
+    applyEdges();
+    return woken;
+  }
+
+  // Replaces SD card files as if edited on a PC, written at their time.
+  static void applyEdits()
+  {
+    for (FileEdit &edit : config.edits)
+    {
+      if (edit.time < 0 || edit.time * 1e6 > clockMicros)
+      {
+        continue;
+      }
+
+      std::ifstream in(edit.hostPath, std::ios::binary);
+      std::stringstream data;
+      data << in.rdbuf();
+
+      size_t slash = edit.hostPath.find_last_of('/');
+      std::string path = "/" + (slash == std::string::npos ? edit.hostPath : edit.hostPath.substr(slash + 1));
+      File file = SD.open(path.c_str(), FILE_WRITE);
+      file.write((const uint8_t *)data.str().data(), data.str().size());
+      file.close();
+      edit.time = -1;
+    }
+  }
+
+  static void drainLogger()
+  {
+    while (logger.drain() > 0)
+    {
+    }
+  }
+
+  // Serves host requests and peer packets (tasks on the device) and keeps
+  // virtual time in step with the wall clock so they are answered while
+  // it runs.
+  static void serveHost()
+  {
+    static auto start = std::chrono::steady_clock::now();
+
+    if (config.httpPort == 0 && config.peerId == 0)
+    {
+      return;
+    }
+
+    // Held as loop() does around freeing memory handlers walk.
+    static bool held = false;
+    if (inWindow(config.statusHolds) != held)
+    {
+      held = !held;
+      held ? statusServer.hold() : statusServer.release();
+    }
+
+    statusServer.service();
+    pollUdp();
+    std::this_thread::sleep_until(start + std::chrono::microseconds(clockMicros));
+  }
+
+  static void recordLoop(uint64_t micros)
+  {
+    static const uint64_t bounds[] = {1000, 10000, 50000, 100000, 500000, 1000000, 5000000, UINT64_MAX};
+
+    for (uint64_t bound : bounds)
+    {
+      if (micros < bound)
+      {
+        stats.loopMicros[bound]++;
+        break;
+      }
+    }
+    stats.maxLoopMicros = max(stats.maxLoopMicros, micros);
+  }
+
+  static void printReport()
+  {
+    double seconds = clockMicros / 1e6;
+
+    printf("Simulated %.2f days (%llu loop passes, %llu idle).\n", seconds / 86400, (unsigned long long)stats.loops, (unsigned long long)stats.idleLoops);
+    printf("\nLoop passes doing work, by duration:\n");
+    for (auto &bucket : stats.loopMicros)
+    {
+      if (bucket.first == UINT64_MAX)
+      {
+        printf("  >= 5 s     %10llu\n", (unsigned long long)bucket.second);
+      }
+      else
+      {
+        printf("  < %-8s %10llu\n", bucket.first >= 1000000 ? (std::to_string(bucket.first / 1000000) + " s").c_str() : (std::to_string(bucket.first / 1000) + " ms").c_str(), (unsigned long long)bucket.second);
+      }
+    }
+    printf("  longest    %10.1f ms\n", stats.maxLoopMicros / 1000.0);
+
+    printf("\nHTTP: %u requests, %u failed, %u unchanged, %llu body bytes.\n", stats.httpRequests, stats.httpFailures, stats.httpUnchanged, (unsigned long long)stats.httpBytes);
+    for (auto &host : stats.httpByHost)
+    {
+      printf("  %-24s %u\n", host.first.c_str(), host.second);
+    }
+    printf("  %u DNS lookups, %u TCP connections.\n", stats.dnsLookups, stats.tcpConnects);
+    printf("WiFi: %u connection attempts.\n", stats.wifiConnects);
+    printf("SD card: %u opens, %llu bytes read, %llu bytes written.\n", stats.sdOpens, (unsigned long long)stats.sdBytesRead, (unsigned long long)stats.sdBytesWritten);
+    printf("Flash: %u opens, %llu bytes read, %llu bytes written.\n", stats.flashOpens, (unsigned long long)stats.flashBytesRead, (unsigned long long)stats.flashBytesWritten);
+    printf("Display: %llu redraws, %llu pixels (%.1f per hour).\n", (unsigned long long)stats.redraws, (unsigned long long)stats.tftPixels, seconds > 0 ? stats.redraws * 3600 / seconds : 0);
+    printf("LEDs: %u frames, %u changed.\n", stats.ledFrames, stats.ledChangedFrames);
+    printf("Power: %.1f%% active, %.1f%% idle, %.1f%% light sleep, radio on %.1f%%, %u wake ups, ~%.1f mAh.\n", power.percent(PowerActive), power.percent(PowerIdle), power.percent(PowerSleep), power.radioPercent(), power.wakeups(), power.milliampHours());
+    printf("Log: %u lines, %u warnings, %u errors.\n", stats.logLines, stats.logWarnings, stats.logErrors);
+
+    printf("\nScreen:\n%s", screenText().c_str());
+    printf("\nLEDs:\n%s", ledSummary().c_str());
+  }
+
+  void finish()
+  {
+    static bool finishing = false;
+
+    // Writing the report must not advance time any further.
+    if (!finishing)
+    {
+      finishing = true;
+      endMicros = UINT64_MAX;
+      drainLogger();
+      fflush(stdout);
+
+      if (!config.framePath.empty())
+      {
+        writeFrame(config.framePath);
+      }
+      printReport();
+    }
+    exit(stats.logErrors > 0 ? 2 : 0);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  using namespace sim;
+
+  if (!parseArguments(argc, argv))
+  {
+    return 1;
+  }
+  if (config.benchIterations > 0)
+  {
+    return runBench(config.benchIterations);
+  }
+
+  if (!seedFileSystem(config.sdCardPath))
+  {
+    fprintf(stderr, "Cannot read SD card directory %s\n", config.sdCardPath.c_str());
+    return 1;
+  }
+  if (!loadReplay(config.replayPath))
+  {
+    return 1;
+  }
+  if (config.gzipBenchIterations > 0)
+  {
+    return runGzipBench(config.gzipBenchIterations);
+  }
+  if (config.trendBenchIterations > 0)
+  {
+    return runTrendBench(config.trendBenchIterations);
+  }
+  if (config.networks.empty())
+  {
+    defaultNetworks();
+  }
+  scheduleEdges();
+
+  endMicros = config.days * 86400e6;
+
+  setup();
+  drainLogger();
+
+  while (true)
+  {
+    applyEdges();
+    applyEdits();
+
+    uint64_t start = clockMicros;
+    uint64_t pixels = stats.tftPixels;
+    uint64_t sleepStart = stats.sleepMicros;
+    unsigned long deadline;
+
+    takeDeadline();
+    loop();
+    drainLogger();
+    serveHost();
+    deadline = takeDeadline();
+    stats.loops++;
+
+    // Time slept in the power manager is not work.
+    uint64_t slept = stats.sleepMicros - sleepStart;
+
+    if (clockMicros - slept == start && slept > 0)
+    {
+      stats.idleLoops++;
+      continue;
+    }
+
+    if (clockMicros == start)
+    {
+      // The power manager returns at once when the next timer is a few ms
+      // away, step towards it unless an operation or button edge is sooner.
+      uint64_t target = start + (uint64_t)config.idleStepMillis * 1000;
+      if (deadline != ULONG_MAX)
+      {
+        target = min(target, (uint64_t)deadline * 1000);
+      }
+      if (nextEdge < edges.size())
+      {
+        target = min(target, edges[nextEdge].micros);
+      }
+      stats.idleLoops++;
+      advance(target > start ? target - start : 1000);
+      continue;
+    }
+
+    advance(config.loopMicros);
+    recordLoop(clockMicros - start - slept);
+    stats.redraws += stats.tftPixels != pixels;
+  }
+}
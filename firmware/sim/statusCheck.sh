@@ -0,0 +1,82 @@
+#!/bin/sh
+# Checks the status endpoint served by the simulator (--http): status codes,
+# the JSON of /status, the Prometheus text format of /metrics and the 503
+# answer while the server is held. Exits non-zero when a check fails.
+#
+# Usage: sim/statusCheck.sh [PROGRAM] [PORT]
+# Run from firmware/ after pio run -e native, takes about 30 seconds.
+
+program=${1:-.pio/build/native/program}
+port=${2:-8080}
+url="http://127.0.0.1:$port"
+out=$(mktemp -d)
+failed=0
+
+# Real time from here on, the server is held from 15 s to 20 s.
+"$program" --sd ../sd-card --days 0.0004 --http "$port" --status-hold 15s-20s > "$out/report.txt" &
+sim=$!
+trap 'kill $sim 2> /dev/null; rm -rf "$out"' EXIT
+
+check() {
+  if [ "$2" = "$3" ]; then
+    echo "ok   $1"
+  else
+    echo "FAIL $1: expected '$2', got '$3'"
+    failed=1
+  fi
+}
+
+# Fetches a path into $out/body and $out/headers, prints the status code.
+get() {
+  curl -s -o "$out/body" -D "$out/headers" -w '%{http_code}' "$url$1"
+}
+
+header() {
+  sed -n "s/^$1: *//Ip" "$out/headers" | tr -d '\r'
+}
+
+for i in $(seq 50); do
+  [ "$(get /status)" = 200 ] && break
+  sleep 0.2
+done
+
+check "GET /status" 200 "$(get /status)"
+check "/status content type" "application/json" "$(header Content-Type)"
+python3 -m json.tool "$out/body" > /dev/null 2>&1
+check "/status is JSON" 0 $?
+
+check "GET /metrics" 200 "$(get /metrics)"
+check "/metrics content type" "text/plain; version=0.0.4" "$(header Content-Type)"
+
+# Text exposition format: HELP and TYPE comments, samples with an
+# optional label set and a number.
+name='[a-zA-Z_:][a-zA-Z0-9_:]*'
+label='[a-zA-Z_][a-zA-Z0-9_]*="[^"]*"'
+value='(-?[0-9]+(\.[0-9]+)?([eE][-+]?[0-9]+)?|NaN|[-+]Inf)'
+invalid=$(grep -Evc "^(# HELP $name .+|# TYPE $name (counter|gauge|histogram|summary|untyped)|$name(\{$label(,$label)*\})? $value)$" "$out/body")
+check "/metrics lines in text format" 0 "$invalid"
+untyped=$(awk '/^# TYPE/ { typed[$3] = 1; next } /^[^#]/ { sub(/[{ ].*/, ""); if (!typed[$0]) print }' "$out/body" | wc -l)
+check "/metrics samples follow their TYPE" 0 "$untyped"
+samples=$(grep -vc '^#' "$out/body")
+[ "$samples" -gt 0 ]
+check "/metrics has samples" 0 $?
+
+check "GET /nope" 404 "$(get /nope)"
+check "POST /status" 404 "$(curl -s -o /dev/null -w '%{http_code}' -X POST "$url/status")"
+
+# Held as around a location table swap.
+for i in $(seq 100); do
+  [ "$(get /status)" = 503 ] && break
+  sleep 0.2
+done
+check "GET /status while held" 503 "$(get /status)"
+check "503 body" "Busy" "$(cat "$out/body")"
+check "GET /metrics while held" 503 "$(get /metrics)"
+
+for i in $(seq 50); do
+  [ "$(get /status)" = 200 ] && break
+  sleep 0.2
+done
+check "GET /status after release" 200 "$(get /status)"
+
+exit $failed
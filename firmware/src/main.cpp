@@ -12,6 +12,8 @@
 	Due to the large and complex json reponse from the endpoints, 
 	The midpoint is reponsible for compressing the station data into 
 	a smaller json chunk (with minimal data manipulation).
+	The midpoint response is requested as gzip compressed MessagePack (JSON fallback)
+	and decoded as it streams in.
 		
 	MCU: 
 		ESP32 (ESP32 DEV KIT 1.0)
@@ -23,6 +25,8 @@
 	SD card data:
 		Location description (name, area, station ids, etc.) are stored as: locations.json	
 		Location data (containing one or more stations) are cached as: locations\[location_id].json
+		Station data (shared by locations referencing the same station) are cached as: stations\[station_id].json
+		Measurement history (ring log of samples) is stored as: history\[location_id].bin
 */
 
 #include <Arduino.h>
@@ -30,14 +34,36 @@
 #include <Wire.h>
 #include <WiFi.h>
 #include <HTTPClient.h>
+#include <Preferences.h>
 #include <SPI.h>
 #include <SD.h>
+#include <LittleFS.h>
+#include <vector>
 #include "utilities.h"    // local library
 #include "msTimer.h"      // local library
 #include "flasher.h"      // local library
+#include "httpBodyStream.h" // local library
+#include "httpSession.h"    // local library
+#include "inflateStream.h"  // local library
+#include "logger.h"         // local library
+#include "historyLog.h"     // local library
+#include "sparkline.h"      // local library
+#include "overviewGrid.h"   // local library
+#include "buttonEvents.h"   // local library
+#include "safetyRules.h"    // local library
+#include "locationRecord.h" // local library
+#include "tieredStore.h"    // local library
+#include "powerManager.h"   // local library
+#include "statusServer.h"   // local library
+#include "peerShare.h"      // local library
+#include "flightRecorder.h" // local library
+#include "configWatch.h"    // local library
 #include <ArduinoJson.h>  // https://github.com/bblanchon/ArduinoJson
+#if __has_include("locationCatalogue.h")
+#include "locationCatalogue.h"  // generated by scripts/locationCatalogue.py
+#define HAVE_LOCATION_CATALOGUE
+#endif
 #include <TFT_eSPI.h>     // https://github.com/Bodmer/TFT_eSPI
-#include <JC_Button.h>    // https://github.com/JChristensen/JC_Button
 #include "FastLED.h"      // https://github.com/FastLED/FastLED
 
 /*
@@ -67,23 +93,87 @@ Remove conflicting defines.
 #define PIN_SD_CHIP_SELECT 22
 
 const unsigned long timeBetweenApiCalls = 60000; // Time in milliseconds between API calls for location data.
+const unsigned long timeBetweenUsgsCalls = 900000; // USGS gauges report every 15 minutes.
 const unsigned long timeBetweenIndicatorUpdate = 300000;
 
-const int numLEDs = 27; //23 locations plus 4 legends LEDs.
+const int defaultNumLEDs = 27; //23 locations plus 4 legends LEDs.
 const int daysDataIsValid = 7;
 const int textIndent = 15;
 const int textStatusY = 293;
 
 int indicatorBrightness = 127;
 int signBrightness = 127;
+const int indicatorSignChannel = 8; // Low speed LEDC channel, can run in light sleep.
 
 TFT_eSPI tft = TFT_eSPI();
 
-CRGB leds[numLEDs];
+Logger logger;
 
-Button buttonLeft(PIN_BUTTON_LEFT, 25, false, true);
-Button buttonSelect(PIN_BUTTON_SELECT, 25, false, true);
-Button buttonRight(PIN_BUTTON_RIGHT, 25, false, true);
+// Flight recorder in RTC memory: slow and stalled loop() stages, resets
+// and events, written to SD card after a restart. The task watchdog
+// resets the ESP32 when loop() hangs.
+enum LoopStage : uint8_t
+{
+  StageIdle,
+  StageSetup,
+  StageButtons,
+  StageWifi,
+  StageLeds,
+  StageSnapshot,
+  StageHistory,
+  StageSDCard,
+  StageStore,
+  StageConfig,
+  StageDisplay,
+  StageTimeApi,
+  StageDataApi,
+  StageUsgsApi,
+  StagePeers,
+  numLoopStages
+};
+const char *const loopStageNames[numLoopStages] = {"idle", "setup", "buttons", "WiFi", "LEDs", "snapshot", "history flush", "SD card check", "store flush", "config reload", "TFT draw", "time API GET", "data API GET", "USGS API GET", "peers"};
+
+enum FlightEventCode : uint16_t
+{
+  EventWifiLost,
+  EventTimeApiFailed,
+  EventDataApiFailed,
+  EventSDCardLost,
+  EventUsgsApiFailed,
+  numFlightEvents
+};
+const char *const flightEventNames[numFlightEvents] = {"WiFi lost", "time API failed", "data API failed", "SD card lost", "USGS API failed"};
+
+const char *flightLogFilePath = "/flightlog.txt";
+const uint32_t watchdogTimeout = 120; // Seconds, longer than the longest idle wait.
+RTC_NOINIT_ATTR FlightLog flightLog;
+FlightRecorder recorder(flightLog);
+
+// LED strips from locations.json, all strips share the leds buffer.
+// Each strip is driven by its own RMT channel, FastLED.show() sends all strips in parallel.
+const int maxStrips = 8;
+const int numLegendLEDs = 4; // Green, yellow, red, off.
+struct Strip
+{
+  uint8_t pin;
+  uint16_t count;
+  uint16_t firstLed; // Index into leds.
+};
+std::vector<Strip> strips;
+std::vector<CRGB> leds;
+int numLEDs = 0;
+int legendLed = -1; // First legend LED, -1 when there is no legend.
+
+// Buttons in ButtonEvents order.
+enum ButtonIndex
+{
+  ButtonLeft,
+  ButtonSelect,
+  ButtonRight
+};
+const uint8_t buttonPins[] = {PIN_BUTTON_LEFT, PIN_BUTTON_SELECT, PIN_BUTTON_RIGHT};
+const uint32_t buttonLongPress = 3000;
+ButtonEvents buttons;
 
 struct WifiCredentials
 {
@@ -93,35 +183,225 @@ struct WifiCredentials
 
 const char *wifiFilePath = "/wifi.txt";
 int numWifiCredentials = 0;
+
+// WiFi connection state machine (see ServiceWifi()).
+enum class WifiState
+{
+  FastConnect, // Connect to the cached access point, no scan.
+  Scanning,    // Scan for known networks.
+  Connecting,  // Connect to scanned candidates, strongest first.
+  Connected,
+  Backoff,     // Wait before retrying.
+  Off          // Radio off between fetches (power save).
+} wifiState = WifiState::FastConnect;
+
+struct WifiCandidate
+{
+  int credentialsIndex;
+  uint8_t bssid[6];
+  int32_t channel;
+  int32_t rssi;
+} wifiCandidates[10];
+
+// Access point of the last successful connection, persisted in NVS.
+struct WifiCache
+{
+  String ssid;
+  uint8_t bssid[6];
+  int32_t channel;
+} wifiCache;
+
+Preferences preferences;
+int numWifiCandidates = 0;
+int wifiCandidateIndex = 0;
+bool wifiAttemptStarted = false;
+unsigned long wifiStateMillis;
+unsigned long wifiBackoff = 1000;
+const unsigned long wifiFastConnectTimeout = 3000;
+const unsigned long wifiConnectTimeout = 5000;
+const unsigned long wifiMaxBackoff = 8000;
+unsigned long wifiResumeMillis; // End of WifiState::Off.
+
+// The CPU idles at a reduced clock between scheduled work. In power save
+// mode (wifi.txt) the radio is also off between fetches and the ESP32
+// light sleeps.
+PowerManager power;
+bool powerSave = false;
+const unsigned long radioOffGap = 15000;     // Radio off when the next fetch is further away.
+const unsigned long radioResumeLead = 2000;  // Reconnect ahead of the fetch.
+const unsigned long busyPollInterval = 20;   // Longest idle while WiFi connects or a button is held.
+const unsigned long timeBetweenPowerReports = 3600000;
+
+// Boot snapshot: location status codes and the selected location,
+// drawn straight after the SD card is mounted (before WiFi connects).
+const char *snapshotFilePath = "/snapshot.bin";
+const uint32_t snapshotMagic = 0x32534352; // "RCS2"
+
+// wifi.txt, locations.json and rules.json are reloaded when changed on the
+// SD card (checked with the SD card), applying only what changed.
+ConfigWatch configWatch;
 String timeZone = "EST";
 
-// Location data contains IDs of associated stations.
-// Order of location is order of LEDs.
-const int maxStationIds = 10;
-const int maxLocations = 50;
+// Keep-alive connections to the API hosts.
+HttpSession dataApiSession("artofmystate.com");
+HttpSession timeApiSession("worldtimeapi.org");
+
+// Direct USGS mode (wifi.txt): the latest stream flow and gauge height of
+// all USGS stations come from one request to the USGS instantaneous
+// values service, the API above is only asked for Water Reporter stations.
+HttpSession usgsApiSession("waterservices.usgs.gov", 443, true);
+
+// Roots the USGS server certificate is checked against (set in setup()):
+// DigiCert Global Root G2 and the older DigiCert Global Root CA, so a
+// certificate reissued under either keeps working. Update these when
+// USGS moves to another CA, the USGS mode fails to connect until then.
+const char usgsRootCA[] =
+  "-----BEGIN CERTIFICATE-----\n"
+  "MIIDjjCCAnagAwIBAgIQAzrx5qcRqaC7KGSxHQn65TANBgkqhkiG9w0BAQsFADBh\n"
+  "MQswCQYDVQQGEwJVUzEVMBMGA1UEChMMRGlnaUNlcnQgSW5jMRkwFwYDVQQLExB3\n"
+  "d3cuZGlnaWNlcnQuY29tMSAwHgYDVQQDExdEaWdpQ2VydCBHbG9iYWwgUm9vdCBH\n"
+  "MjAeFw0xMzA4MDExMjAwMDBaFw0zODAxMTUxMjAwMDBaMGExCzAJBgNVBAYTAlVT\n"
+  "MRUwEwYDVQQKEwxEaWdpQ2VydCBJbmMxGTAXBgNVBAsTEHd3dy5kaWdpY2VydC5j\n"
+  "b20xIDAeBgNVBAMTF0RpZ2lDZXJ0IEdsb2JhbCBSb290IEcyMIIBIjANBgkqhkiG\n"
+  "9w0BAQEFAAOCAQ8AMIIBCgKCAQEAuzfNNNx7a8myaJCtSnX/RrohCgiN9RlUyfuI\n"
+  "2/Ou8jqJkTx65qsGGmvPrC3oXgkkRLpimn7Wo6h+4FR1IAWsULecYxpsMNzaHxmx\n"
+  "1x7e/dfgy5SDN67sH0NO3Xss0r0upS/kqbitOtSZpLYl6ZtrAGCSYP9PIUkY92eQ\n"
+  "q2EGnI/yuum06ZIya7XzV+hdG82MHauVBJVJ8zUtluNJbd134/tJS7SsVQepj5Wz\n"
+  "tCO7TG1F8PapspUwtP1MVYwnSlcUfIKdzXOS0xZKBgyMUNGPHgm+F6HmIcr9g+UQ\n"
+  "vIOlCsRnKPZzFBQ9RnbDhxSJITRNrw9FDKZJobq7nMWxM4MphQIDAQABo0IwQDAP\n"
+  "BgNVHRMBAf8EBTADAQH/MA4GA1UdDwEB/wQEAwIBhjAdBgNVHQ4EFgQUTiJUIBiV\n"
+  "5uNu5g/6+rkS7QYXjzkwDQYJKoZIhvcNAQELBQADggEBAGBnKJRvDkhj6zHd6mcY\n"
+  "1Yl9PMWLSn/pvtsrF9+wX3N3KjITOYFnQoQj8kVnNeyIv/iPsGEMNKSuIEyExtv4\n"
+  "NeF22d+mQrvHRAiGfzZ0JFrabA0UWTW98kndth/Jsw1HKj2ZL7tcu7XUIOGZX1NG\n"
+  "Fdtom/DzMNU+MeKNhJ7jitralj41E6Vf8PlwUHBHQRFXGU7Aj64GxJUTFy8bJZ91\n"
+  "8rGOmaFvE7FBcf6IKshPECBV1/MUReXgRPTqh5Uykw7+U0b6LJ3/iyK5S9kJRaTe\n"
+  "pLiaWN0bfVKfjllDiIGknibVb63dDcY3fe0Dkhvld1927jyNxF1WW6LZZm6zNTfl\n"
+  "MrY=\n"
+  "-----END CERTIFICATE-----\n"
+  "-----BEGIN CERTIFICATE-----\n"
+  "MIIDrzCCApegAwIBAgIQCDvgVpBCRrGhdWrJWZHHSjANBgkqhkiG9w0BAQUFADBh\n"
+  "MQswCQYDVQQGEwJVUzEVMBMGA1UEChMMRGlnaUNlcnQgSW5jMRkwFwYDVQQLExB3\n"
+  "d3cuZGlnaWNlcnQuY29tMSAwHgYDVQQDExdEaWdpQ2VydCBHbG9iYWwgUm9vdCBD\n"
+  "QTAeFw0wNjExMTAwMDAwMDBaFw0zMTExMTAwMDAwMDBaMGExCzAJBgNVBAYTAlVT\n"
+  "MRUwEwYDVQQKEwxEaWdpQ2VydCBJbmMxGTAXBgNVBAsTEHd3dy5kaWdpY2VydC5j\n"
+  "b20xIDAeBgNVBAMTF0RpZ2lDZXJ0IEdsb2JhbCBSb290IENBMIIBIjANBgkqhkiG\n"
+  "9w0BAQEFAAOCAQ8AMIIBCgKCAQEA4jvhEXLeqKTTo1eqUKKPC3eQyaKl7hLOllsB\n"
+  "CSDMAZOnTjC3U/dDxGkAV53ijSLdhwZAAIEJzs4bg7/fzTtxRuLWZscFs3YnFo97\n"
+  "nh6Vfe63SKMI2tavegw5BmV/Sl0fvBf4q77uKNd0f3p4mVmFaG5cIzJLv07A6Fpt\n"
+  "43C/dxC//AH2hdmoRBBYMql1GNXRor5H4idq9Joz+EkIYIvUX7Q6hL+hqkpMfT7P\n"
+  "T19sdl6gSzeRntwi5m3OFBqOasv+zbMUZBfHWymeMr/y7vrTC0LUq7dBMtoM1O/4\n"
+  "gdW7jVg/tRvoSSiicNoxBN33shbyTApOB6jtSj1etX+jkMOvJwIDAQABo2MwYTAO\n"
+  "BgNVHQ8BAf8EBAMCAYYwDwYDVR0TAQH/BAUwAwEB/zAdBgNVHQ4EFgQUA95QNVbR\n"
+  "TLtm8KPiGxvDl7I90VUwHwYDVR0jBBgwFoAUA95QNVbRTLtm8KPiGxvDl7I90VUw\n"
+  "DQYJKoZIhvcNAQEFBQADggEBAMucN6pIExIK+t1EnE9SsPTfrgT1eXkIoyQY/Esr\n"
+  "hMAtudXH/vTBH1jLuG2cenTnmCmrEbXjcKChzUyImZOMkXDiqw8cvpOp/2PV5Adg\n"
+  "06O/nVsJ8dWO41P0jmP6P6fbtGbfYmbW0W5BjfIttep3Sp+dWOIrWcBAI+0tKIJF\n"
+  "PnlUkiaY4IBIqDfv8NZ5YBberOgOzW6sRBc4L0na4UU+Krk2U886UAb3LujEV0ls\n"
+  "YSEY1QSteDwsOoBrp+uvFRTp2InBuThs4pFsiv9kuXclVzDAGySj4dzp30d8tbQk\n"
+  "CAUw7C29C79Fv1C5qfPrmAESrciIxpg0X40KPMbp1ZWVbd4=\n"
+  "-----END CERTIFICATE-----\n";
+bool usgsDirect = false;
+const size_t usgsResponseCapacity = 16384; // Filtered document, ~300 bytes per series.
+
+// Stations are fetched from the API once per cycle,
+// each location's data is composed from its stations.
+struct Station
+{
+  String id;      // USGS (8 digits) or Water Reporter station ID.
+  String version; // Data version stored on SD card (delta sync).
+  uint32_t fetchEpoch;        // When the stored data was fetched, here or by a peer (0 when not known).
+  unsigned long sharedMillis; // Last record received from a peer.
+};
+std::vector<Station> stations;
+
+// Location data contains indexes of associated stations.
+// Locations are on consecutive LEDs unless mapped to a strip and pixel.
 struct Location
 {
-  String stationIds[maxStationIds]; // Station IDs.
-  String shortName;                 // Short name of location.
-  String area;                      // Name of general station area.
-  String status;                    // Status of the location.
-} locations[maxLocations];
+  uint16_t led;            // Index into leds.
+  uint16_t firstStationId; // First entry in locationStationIndexes.
+  uint8_t numStationIds;   // Number of associated stations.
+  const char *shortName;   // Short name of location.
+  const char *area;        // Name of general station area.
+  Safety reportedSafety;   // Worst locationStatus reported by the API.
+  Safety safety;           // Status shown, scored from the measurements.
+  float measurements[numMeasurements]; // NAN when not available.
+  unsigned long recordTime; // UTC epoch of the latest data, 0 when not known.
+};
+std::vector<Location> locations;
+std::vector<uint16_t> locationStationIndexes; // Indexes into stations, grouped by location.
+std::vector<char *> locationNames; // Names read from locations.json, catalogue names stay in flash.
+const char *locationsFilePath = "/locations.json";
+
+// Per-station safety thresholds from rules.json, compiled per location.
+// Locations without rules show the status reported by the API.
+const char *rulesFilePath = "/rules.json";
+SafetyRules safetyRules;
+bool locationsNeedScoring = false; // Set when measurements or rules change.
+
+// Measurement history per location.
+const uint32_t historyCapacity = 1024;                // Samples kept per location.
+const unsigned long timeBetweenHistoryFlush = 3600000; // Partial sectors are written hourly.
+std::vector<HistoryLog> history;
+
+// Trend screen sparklines (one sample per column), kept for the last location shown.
+const int trendWidth = 448;
+const int trendHeight = 60;
+Sparkline trendFlow(&tft);
+Sparkline trendGauge(&tft);
+int trendLocationIndex = -1;
+
+// Overview screen, tiles of all locations drawn from the location table.
+const int overviewColumns = 4;
+const int overviewY = 80;
+const int overviewWidth = 448;
+const int overviewHeight = 205;
+OverviewGrid overview(&tft);
 
 bool sdStatus = false;
+
+// SD card files, with the latest location data, the boot snapshot and
+// settings mirrored in internal flash (LittleFS) for fast reads and for
+// when the SD card fails.
+TieredStore store;
+const unsigned long timeBetweenCacheFlush = 600000; // Coalesces flash writes.
+const unsigned long timeBetweenSDCardChecks = 30000;
 bool wifiStatus = false;
 bool timeApiStatus = false;
 bool dataApiStatus = false;
+uint32_t timeApiFailures = 0;
+uint32_t dataApiFailures = 0;
+uint32_t usgsApiFailures = 0;
 
 String dataApiErrorDate = "No error.";
 String dataApiErrorMessage = "No error.";
 
 int numLocations;
+int numStations;
 int selectedLoctionIndex;
-int apiLoctionIndex = 0;
+int apiStationIndex = 0;
 String currentTime;
+unsigned long timeEpoch = 0; // currentTime as UTC epoch, 0 before the first time API response.
+unsigned long timeEpochMillis;
+msTimer timerTime(0); // Time API requests, forced when the time zone changes.
+
+// Local HTTP endpoint with /status and /metrics, served from resident state.
+StatusServer statusServer(80);
+
+// Peer sharing (wifi.txt): dashboards on the LAN multicast the station
+// records they fetch, each station is fetched by one of them. A station
+// owned by a peer is fetched here when no record came for two cycles.
+PeerShare peers;
+bool peerSharing = false;
+const IPAddress peerGroup(239, 255, 82, 67);
+const uint16_t peerPort = 4210;
 
 int displayScreen;
-const int numDisplayScreens = 2;
+const int numDisplayScreens = 4; // Data screens cycled by the select button.
+const int screenTrend = 2;
+const int screenOverview = 3;
+const int screenDiagnostics = 4;
+const int screenFlightLog = 5; // Follows the diagnostics screen.
 
 const uint32_t OFF = 0x0000000;
 const uint32_t RED = 0x00FF0000;
@@ -133,727 +413,2929 @@ bool GetJsonFromSDCard(String fileName, String *locationDataJson)
 {
   String path = "/" + fileName + ".json";
 
-  Serial.print("Reading file: ");
-  Serial.println(path);
-
-  File file = SD.open(path);
+  LOG_D("Reading file: %s", path.c_str());
 
-  if (!file)
+  if (!store.read(path, locationDataJson))
   {
-    Serial.println("Failed to open file for reading.");
+    LOG_W("Failed to open file for reading: %s", path.c_str());
     return false;
   }
+  return true;
+}
 
-  *locationDataJson = file.readString();
+// Returns the index of the station with the given ID, adding it when new
+// so stations shared by several locations are only fetched once.
+int FindOrAddStation(const char *stationId)
+{
+  for (int i = 0; i < numStations; i++)
+  {
+    if (stations[i].id == stationId)
+    {
+      return i;
+    }
+  }
 
-  file.close();
-  return true;
+  stations.push_back({stationId, "", 0, 0});
+  return numStations++;
 }
 
-bool InitLocationsFromSDCard()
+// Index into stations of a location's station.
+inline int LocationStationIndex(int locationIndex, int s)
 {
-  String stationInitDataJson;
+  return locationStationIndexes[locations[locationIndex].firstStationId + s];
+}
 
-  if (!GetJsonFromSDCard("locations", &stationInitDataJson))
+// Registers a strip with FastLED, the pin is a template parameter
+// so only these pins can drive strips.
+bool AddStripLeds(uint8_t pin, CRGB *data, int count)
+{
+  switch (pin)
   {
+  case 27:
+    FastLED.addLeds<APA106, 27>(data, count);
+    break;
+  case 13:
+    FastLED.addLeds<APA106, 13>(data, count);
+    break;
+  case 14:
+    FastLED.addLeds<APA106, 14>(data, count);
+    break;
+  case 16:
+    FastLED.addLeds<APA106, 16>(data, count);
+    break;
+  case 17:
+    FastLED.addLeds<APA106, 17>(data, count);
+    break;
+  case 21:
+    FastLED.addLeds<APA106, 21>(data, count);
+    break;
+  default:
     return false;
   }
+  return true;
+}
 
-  DynamicJsonDocument doc(4096);
-  DeserializationError error = deserializeJson(doc, stationInitDataJson);
+// Allocates the LEDs of the strips and registers the strips with FastLED.
+bool BeginStrips(String *errorMessage)
+{
+  char buf[100];
 
-  if (error)
+  numLEDs = 0;
+  for (Strip &strip : strips)
   {
-    Serial.print(F("DeserializeJson() failed: "));
-    Serial.println(error.c_str());
-    return false;
+    numLEDs += strip.count;
   }
+  leds.assign(numLEDs, CRGB::Black);
 
-  numLocations = doc["locations"].size();
-
-  for (int i = 0; i < numLocations; i++)
+  for (int i = 0; i < (int)strips.size(); i++)
   {
-    for (int u = 0; u < doc["locations"][i]["stationIds"].size(); u++)
+    if (!AddStripLeds(strips[i].pin, leds.data() + strips[i].firstLed, strips[i].count))
     {
-      locations[i].stationIds[u] = doc["locations"][i]["stationIds"][u].as<String>();
+      sprintf(buf, "locations.json: strip %d:\npin %d can't drive a strip", i, strips[i].pin);
+      *errorMessage = buf;
+      return false;
     }
-    locations[i].shortName = doc["locations"][i]["shortName"].as<String>();
-    locations[i].area = doc["locations"][i]["area"].as<String>();
   }
 
-  Serial.printf("Number of locations found on SD card: %u.\n", numLocations);
+  LOG_I("Number of LEDs: %u on %u strip(s).", numLEDs, (unsigned int)strips.size());
 
   return true;
 }
 
-void UpdateLocationIndicators(bool allOffFlag = false)
+// Reads the optional strips array of locations.json:
+// "strips": [{"pin": 27, "count": 27, "legend": 23}, ...]
+// Legend is the first of the legend LEDs on that strip.
+// Without strips a single strip on PIN_STRIP_LOCATIONS is used.
+bool InitStripsFromSDCard(const char *path, String *errorMessage)
 {
-  static msTimer timerUpdateStatusBuffer(0);
-  static msTimer timerUpdateLEDs(50);
+  char buf[100];
 
-  FastLED.setBrightness(indicatorBrightness);
+  strips.clear();
+  legendLed = -1;
+  numLEDs = 0;
+  int totalLeds = 0;
 
-  // Turn off all indicators.
-  if (allOffFlag)
+  File file = store.open(path);
+
+  if (!file)
   {
-    for (int i = 0; i < numLEDs; i++)
+    *errorMessage = "Failed to open " + String(path);
+    return false;
+  }
+
+  DynamicJsonDocument doc(1024);
+
+  if (file.find("\"strips\"") && file.find(":"))
+  {
+    DeserializationError error = deserializeJson(doc, file);
+
+    if (error)
     {
-      leds[i] = CRGB::Black;
-      delay(10);
-      FastLED.show();
+      sprintf(buf, "locations.json: strips:\n%s (byte %u)", error.c_str(), (unsigned int)file.position());
+      *errorMessage = buf;
+      file.close();
+      return false;
     }
-    return;
+  }
+  else
+  {
+    JsonObject strip = doc.to<JsonArray>().createNestedObject();
+    strip["pin"] = PIN_STRIP_LOCATIONS;
+    strip["count"] = defaultNumLEDs;
+    strip["legend"] = defaultNumLEDs - numLegendLEDs;
   }
 
-  // Refresh status data from SD card.
-  if (timerUpdateStatusBuffer.elapsed())
+  file.close();
+
+  JsonArray stripArray = doc.as<JsonArray>();
+
+  if (stripArray.size() == 0 || stripArray.size() > maxStrips)
+  {
+    sprintf(buf, "locations.json: strips:\n1 to %d strips required", maxStrips);
+    *errorMessage = buf;
+    return false;
+  }
+
+  for (JsonObject stripObject : stripArray)
   {
-    timerUpdateStatusBuffer.setDelay(timeBetweenIndicatorUpdate);
+    int index = strips.size();
+    Strip strip;
+    strip.pin = stripObject["pin"] | 0;
+    strip.count = stripObject["count"] | 0;
+    strip.firstLed = totalLeds;
+
+    if (strip.count == 0)
+    {
+      sprintf(buf, "locations.json: strip %d:\ncount required", index);
+      *errorMessage = buf;
+      return false;
+    }
 
-    Serial.println("Getting location status from location data stored on SD card.");
+    for (Strip &other : strips)
+    {
+      if (other.pin == strip.pin)
+      {
+        sprintf(buf, "locations.json: strip %d:\npin %d used twice", index, strip.pin);
+        *errorMessage = buf;
+        return false;
+      }
+    }
 
-    for (int i = 0; i < numLocations; i++)
+    if (stripObject.containsKey("legend"))
     {
-      String locationDataJson;
-      if (GetJsonFromSDCard("/locations/" + String(i), &locationDataJson))
+      int legend = stripObject["legend"];
+
+      if (legendLed >= 0 || legend < 0 || legend + numLegendLEDs > strip.count)
       {
-        DynamicJsonDocument doc(2048);
-        deserializeJson(doc, locationDataJson);
-        locations[i].status = doc["station"]["locationStatus"].as<String>();
+        sprintf(buf, "locations.json: strip %d:\ninvalid legend %d", index, legend);
+        *errorMessage = buf;
+        return false;
       }
+      legendLed = strip.firstLed + legend;
     }
+
+    strips.push_back(strip);
+    totalLeds += strip.count;
   }
 
-  // Update all LEDs.
-  static msTimer timerFlash(750);
-  static bool flashToggle;
+  numLEDs = totalLeds;
+  return true;
+}
 
-  if (timerFlash.elapsed())
+// Frees the location and station tables.
+void ClearLocations()
+{
+  for (char *name : locationNames)
   {
-    flashToggle = !flashToggle;
+    free(name);
   }
+  locationNames.clear();
 
-  if (timerUpdateLEDs.elapsed())
-  {
-    for (int i = 0; i < numLocations; i++)
-    {
-      leds[i] = locations[i].status == "Fair" ? GREEN : locations[i].status == "Caution" ? YELLOW : locations[i].status == "Danger" ? RED : locations[i].status == "N.A." ? OFF : OFF;
-    }
-
-    if (flashToggle)
-      leds[selectedLoctionIndex] = CRGB::Blue;
+  numLocations = 0;
+  numStations = 0;
+  locations.clear();
+  stations.clear();
+  locationStationIndexes.clear();
+}
 
-    leds[numLEDs - 4] = CRGB::Green;
-    leds[numLEDs - 3] = CRGB::Yellow;
-    leds[numLEDs - 2] = CRGB::Red;
-    leds[numLEDs - 1] = CRGB::Black;
+// Keeps a copy of a name read from locations.json.
+const char *KeepLocationName(const char *name)
+{
+  locationNames.push_back(strdup(name));
+  return locationNames.back();
+}
 
-    delay(10);
-    FastLED.show();
+// Appends a location, its stations follow with AddLocationStation().
+void AddLocation(uint16_t led, const char *shortName, const char *area)
+{
+  Location location;
+  location.led = led;
+  location.firstStationId = locationStationIndexes.size();
+  location.numStationIds = 0;
+  location.shortName = shortName;
+  location.area = area;
+  location.reportedSafety = SafetyNA;
+  location.safety = SafetyNA;
+  for (int m = 0; m < numMeasurements; m++)
+  {
+    location.measurements[m] = NAN;
   }
+  location.recordTime = 0;
+
+  locations.push_back(location);
+  numLocations++;
 }
 
-void FatalError(String errorMsg)
+void AddLocationStation(const char *stationId)
 {
+  locationStationIndexes.push_back(FindOrAddStation(stationId));
+  locations.back().numStationIds++;
+}
 
-  UpdateLocationIndicators(true);
+#ifdef HAVE_LOCATION_CATALOGUE
+// FNV-1a of a file's contents, as computed by scripts/locationCatalogue.py.
+uint32_t HashFile(File &file)
+{
+  uint8_t buf[256];
+  uint32_t hash = 2166136261u;
 
-  tft.fillScreen(TFT_BLACK);
-  tft.setTextSize(2);
-  tft.setTextColor(TFT_RED);
-  tft.setCursor(0, 0);
-  tft.println("Fatal error.");
-  tft.println();
-  tft.print(errorMsg);
+  for (size_t length; (length = file.read(buf, sizeof(buf))) > 0;)
+  {
+    for (size_t i = 0; i < length; i++)
+    {
+      hash = (hash ^ buf[i]) * 16777619u;
+    }
+  }
+  return hash;
+}
 
-  Serial.println(errorMsg);
+// True when there is no locations.json to override the catalogue, or
+// it is the file the catalogue was generated from.
+bool IsLocationCatalogueCurrent(const char *path)
+{
+  File file = store.open(path);
 
-  while (1)
+  if (!file)
   {
+    return true;
   }
+
+  bool current = file.size() == catalogue::sourceSize && HashFile(file) == catalogue::sourceHash;
+  file.close();
+  return current;
 }
 
-// Solution provided by : https://github.com/Bodmer/TFT_eSPI/issues/6
-void charBounds(char c, int16_t *x, int16_t *y,
-                int16_t *minx, int16_t *miny, int16_t *maxx, int16_t *maxy)
+// Builds the tables from the catalogue compiled into flash. It was
+// checked when generated, names are used in place.
+void InitLocationsFromCatalogue()
 {
-  if (c == '\n')
-  {                         // Newline?
-    *x = 0;                 // Reset x to zero,
-    *y += tft.textsize * 8; // advance y one line
-                            // min/max x/y unchaged -- that waits for next 'normal' character
+  uint16_t firstLed = 0;
+
+  strips.clear();
+  for (const catalogue::StripEntry &entry : catalogue::strips)
+  {
+    strips.push_back({entry.pin, entry.count, firstLed});
+    firstLed += entry.count;
   }
-  else if (c != '\r')
-  { // Normal char; ignore carriage returns
-    if (/*wrap*/ false && ((*x + tft.textsize * 6) > tft.width()))
-    {                         // Off right?
-      *x = 0;                 // Reset x to zero,
-      *y += tft.textsize * 8; // advance y one line
+  legendLed = catalogue::legendLed;
+  numLEDs = firstLed;
+
+  for (const catalogue::LocationEntry &entry : catalogue::locations)
+  {
+    AddLocation(entry.led, entry.shortName, entry.area);
+
+    for (int s = 0; s < entry.numStationIds; s++)
+    {
+      AddLocationStation(catalogue::stationIds[catalogue::locationStations[entry.firstStationId + s]]);
     }
-    int x2 = *x + tft.textsize * 6 - 1, // Lower-right pixel of char
-        y2 = *y + tft.textsize * 8 - 1;
-    if (x2 > *maxx)
-      *maxx = x2; // Track max x, y
-    if (y2 > *maxy)
-      *maxy = y2;
-    if (*x < *minx)
-      *minx = *x; // Track min x, y
-    if (*y < *miny)
-      *miny = *y;
-    *x += tft.textsize * 6; // Advance x one char
   }
 }
+#endif
 
-// Solution provided by : https://github.com/Bodmer/TFT_eSPI/issues/6
-void getTextBounds(const char *str, int16_t x, int16_t y,
-                   int16_t *x1, int16_t *y1, uint16_t *w, uint16_t *h)
+// Reads locations.json one location at a time, so the file size is only
+// limited by the tables built from it.
+bool ParseLocationsFile(const char *path, String *errorMessage)
 {
-  uint8_t c; // Current character
+  char buf[100];
 
-  *x1 = x;
-  *y1 = y;
-  *w = *h = 0;
+  if (!InitStripsFromSDCard(path, errorMessage))
+  {
+    return false;
+  }
 
-  int16_t minx = tft.width(), miny = tft.width(), maxx = -1, maxy = -1;
+  File file = store.open(path);
 
-  while ((c = *str++))
-    charBounds(c, &x, &y, &minx, &miny, &maxx, &maxy);
+  if (!file)
+  {
+    *errorMessage = "Failed to open " + String(path);
+    return false;
+  }
 
-  if (maxx >= minx)
+  // LEDs taken by the legend or a location.
+  std::vector<bool> ledUsed(numLEDs, false);
+  for (int i = 0; legendLed >= 0 && i < numLegendLEDs; i++)
   {
-    *x1 = minx;
-    *w = maxx - minx + 1;
+    ledUsed[legendLed + i] = true;
   }
-  if (maxy >= miny)
+
+  if (!file.find("\"locations\"") || !file.find("["))
   {
-    *y1 = miny;
-    *h = maxy - miny + 1;
+    *errorMessage = "No locations array in " + String(path);
+    file.close();
+    return false;
   }
-}
 
-bool InitSDCard()
-{
-  int count = 0;
+  while (isspace(file.peek()))
+  {
+    file.read();
+  }
 
-  Serial.println("Attempting to mount SD card...");
+  // Holds a single location.
+  DynamicJsonDocument doc(1024);
+  bool more = file.peek() != ']';
 
-  while (!SD.begin(PIN_SD_CHIP_SELECT))
+  while (more)
   {
-    if (++count > 5)
+    DeserializationError error = deserializeJson(doc, file);
+
+    if (error)
     {
-      Serial.println("Card Mount Failed.");
+      sprintf(buf, "locations.json: location %d:\n%s (byte %u)", numLocations, error.c_str(), (unsigned int)file.position());
+      *errorMessage = buf;
+      file.close();
       return false;
     }
-    delay(250);
-  }
 
-  Serial.println("SD card mounted.");
-  return true;
-}
+    JsonArray stationIds = doc["stationIds"];
 
-bool SaveDataToSDCard(int locationIndex, String data)
-{
-  String path = "/locations/" + String(locationIndex) + ".json";
-  Serial.printf("Writing file: %s\n", path.c_str());
+    if (stationIds.size() == 0 || stationIds.size() > 255 || !doc["shortName"].is<const char *>())
+    {
+      sprintf(buf, "locations.json: location %d:\nneeds shortName and\n1 to 255 stationIds", numLocations);
+      *errorMessage = buf;
+      file.close();
+      return false;
+    }
 
-  File file = SD.open(path, FILE_WRITE);
-  if (!file)
-  {
-    Serial.println("Failed to open file for writing.");
-    return false;
+    // Optional "led": [strip, pixel], by default the next LED.
+    int led = numLocations;
+    if (doc.containsKey("led"))
+    {
+      unsigned int strip = doc["led"][0];
+      unsigned int pixel = doc["led"][1];
+      led = strip < strips.size() && pixel < strips[strip].count ? strips[strip].firstLed + pixel : numLEDs;
+    }
+
+    if (led >= numLEDs || ledUsed[led])
+    {
+      sprintf(buf, "locations.json: location %d:\nLED %d missing or used twice", numLocations, led);
+      *errorMessage = buf;
+      file.close();
+      return false;
+    }
+    ledUsed[led] = true;
+
+    AddLocation(led, KeepLocationName(doc["shortName"].as<const char *>()), KeepLocationName(doc["area"] | ""));
+
+    for (JsonVariant stationId : stationIds)
+    {
+      AddLocationStation(stationId.as<const char *>());
+    }
+
+    more = file.findUntil(",", "]");
   }
-  if (!file.print(data))
+
+  file.close();
+
+  if (numLocations == 0)
   {
-    Serial.println("Write failed.");
+    *errorMessage = "No locations in " + String(path);
     return false;
   }
-  file.close();
+
   return true;
 }
 
-uint16_t safetyStringToColor(const char *str)
+// Builds the strip, location and station tables. Locations come from the
+// catalogue compiled into the firmware unless locations.json on SD card
+// differs from the file it was generated from.
+bool LoadLocationTables(String *errorMessage)
 {
-  return !strcmp(str, "N.A.") ? TFT_WHITE : !strcmp(str, "Fair") ? TFT_GREEN : !strcmp(str, "Caution") ? TFT_YELLOW : !strcmp(str, "Danger") ? TFT_RED : TFT_WHITE;
+  ClearLocations();
+
+#ifdef HAVE_LOCATION_CATALOGUE
+  if (IsLocationCatalogueCurrent(locationsFilePath))
+  {
+    LOG_I("Using the built-in location catalogue.");
+    InitLocationsFromCatalogue();
+    return true;
+  }
+#endif
+
+  return ParseLocationsFile(locationsFilePath, errorMessage);
 }
 
-void PrintData(int line, const char *text, const char *value, const char *units, uint16_t color)
+bool InitLocationsFromSDCard(String *errorMessage)
 {
+  if (!LoadLocationTables(errorMessage) || !BeginStrips(errorMessage))
+  {
+    return false;
+  }
 
-  int spaces = strlen(value) > 5 ? 9 - (strlen(value) - 5) : 9;
+  LOG_I("Number of locations: %u.", numLocations);
+  LOG_I("Number of unique stations: %u.", numStations);
 
-  tft.setTextSize(2);
-  tft.setCursor(textIndent, 87 + line * 21);
+  if (!SD.exists("/stations"))
+  {
+    SD.mkdir("/stations");
+  }
 
-  tft.setTextColor(TFT_WHITE, TFT_BLACK);
-  tft.printf("%-*s", 20, text);
+  if (!SD.exists("/history"))
+  {
+    SD.mkdir("/history");
+  }
 
-  tft.setTextColor(color, TFT_BLACK);
-  tft.printf("%-*s", 5, value);
+  history.resize(numLocations);
+  for (int i = 0; i < numLocations; i++)
+  {
+    history[i].begin(SD, "/history/" + String(i) + ".bin", historyCapacity);
+  }
 
-  tft.setTextColor(TFT_WHITE, TFT_BLACK);
-  tft.printf("%-*s", spaces, strcmp(value, "N.A.") == 0 ? "" : units);
+  return true;
 }
 
-void PrinInfo(int line, const char *text, uint16_t color)
+// Parses a rule list of rules.json:
+// [{"measurement": "streamFlow", "above": 5000, "safety": "Danger"}, ...]
+bool ParseSafetyRules(JsonArray list, const char *owner, std::vector<SafetyRule> *rules, String *errorMessage)
 {
-  const int spacesPerLine = 34;
+  char buf[128];
+  int index = 0;
 
-  tft.setTextSize(2);
-  tft.setCursor(textIndent, 87 + line * 21);
+  for (JsonObject item : list)
+  {
+    int measurement = SafetyRules::findMeasurement(item["measurement"]);
+    Safety safety = SafetyRules::findSafety(item["safety"]);
+    bool above = item.containsKey("above");
 
-  tft.setTextColor(color, TFT_BLACK);
-  tft.printf("%-*s", spacesPerLine, text);
-}
+    if (measurement < 0 || safety == SafetyNA || above == item.containsKey("below") || !item[above ? "above" : "below"].is<float>())
+    {
+      sprintf(buf, "rules.json: %.24s rule %d:\nneeds measurement, safety\nand above or below", owner, index);
+      *errorMessage = buf;
+      return false;
+    }
 
-void PrintTitle(const char *line1, const char *line2, uint16_t color)
-{
-  tft.setTextSize(3);
-  tft.setTextColor(color, TFT_BLACK);
-  tft.setCursor(textIndent, 14);
-  tft.printf("%-24s", line1);
-  tft.setCursor(textIndent, 44);
-  tft.printf("%-24s", line2);
+    rules->push_back({item[above ? "above" : "below"].as<float>(), (Measurement)measurement, safety, above});
+    index++;
+  }
+  return true;
 }
 
-bool UpdateLocationDataOnScreen(int locationIndex, String *locationDataJson, int displayScreen)
+// Compiles rules.json into a rule range per location: the rules of its stations,
+// then the default rules for measurements its station rules do not cover.
+// Without rules.json locations show the status reported by the API.
+// The rules in use are kept when rules.json is not valid.
+bool InitRulesFromSDCard(String *errorMessage)
 {
+  SafetyRules compiled;
 
-  PrintTitle(locations[locationIndex].shortName.c_str(), locations[locationIndex].area.c_str(), TFT_WHITE);
-
-  DynamicJsonDocument doc(2048);
-  DeserializationError error = deserializeJson(doc, *locationDataJson);
+  File file = store.open(rulesFilePath);
+
+  if (!file)
+  {
+    LOG_I("No %s, showing location status reported by the API.", rulesFilePath);
+    safetyRules.clear();
+    locationsNeedScoring = true;
+    return true;
+  }
+
+  DynamicJsonDocument doc(8192);
+  DeserializationError error = deserializeJson(doc, file);
+  file.close();
 
   if (error)
   {
-    Serial.print(F("DeserializeJson() failed: "));
-    Serial.println(error.c_str());
+    *errorMessage = "rules.json: " + String(error.c_str());
+    return false;
+  }
 
-    char locationString[50];
-    sprintf(locationString, "(filename: %u.json, was not found.)", locationIndex);
+  std::vector<SafetyRule> defaultRules;
+  if (!ParseSafetyRules(doc["default"], "default", &defaultRules, errorMessage))
+  {
+    return false;
+  }
 
-    PrinInfo(0, "Location data not found", TFT_RED);
-    PrinInfo(1, "on SD card.", TFT_RED);
-    PrinInfo(2, "", TFT_RED);
-    PrinInfo(3, "Data will be downloaded", TFT_RED);
-    PrinInfo(4, "from API shortly.", TFT_RED);
-    PrinInfo(5, "", TFT_RED);
-    PrinInfo(6, "", TFT_RED);
-    PrinInfo(7, "", TFT_RED);
-    PrinInfo(8, "", TFT_RED);
+  // Station rules by index into stations.
+  std::vector<std::vector<SafetyRule>> stationRules(numStations);
+  for (JsonPair station : doc["stations"].as<JsonObject>())
+  {
+    int stationIndex = 0;
+    while (stationIndex < numStations && stations[stationIndex].id != station.key().c_str())
+    {
+      stationIndex++;
+    }
+
+    if (stationIndex == numStations)
+    {
+      LOG_W("Rules for station %s not used by any location.", station.key().c_str());
+      continue;
+    }
+
+    if (!ParseSafetyRules(station.value(), station.key().c_str(), &stationRules[stationIndex], errorMessage))
+    {
+      return false;
+    }
   }
-  else
+
+  for (int i = 0; i < numLocations; i++)
   {
-    // Get data from json.
-    String usgsId = doc["station"]["usgsId"].as<String>();
-    String wrId = doc["station"]["wrId"].as<String>();
-    String lastModifed = doc["station"]["recordTime"];
+    uint32_t covered = 0; // Measurements with station rules.
 
-    // Init displaying variables.
-    const char stationTypes[4][9] = {"N/A     ", "USGS    ", "WR      ", "USGS, WR"};
-    int stationTypeIndex = !usgsId.isEmpty() && !wrId.isEmpty() ? 3 : usgsId.isEmpty() ? 1 : wrId.isEmpty() ? 2 : 0;
+    compiled.beginLocation();
 
-    char lastModifedDateBuf[20];
-    sprintf(lastModifedDateBuf, "%s", lastModifed.substring(0, 10).c_str());
-    char lastModifedTimeBuf[20];
-    sprintf(lastModifedTimeBuf, "%s", lastModifed.substring(11, 19).c_str());
+    for (int s = 0; s < locations[i].numStationIds; s++)
+    {
+      for (const SafetyRule &rule : stationRules[LocationStationIndex(i, s)])
+      {
+        compiled.add(rule);
+        covered |= 1 << rule.measurement;
+      }
+    }
 
-    if (displayScreen == 0)
+    for (const SafetyRule &rule : defaultRules)
     {
-      PrintData(0, "Stream Flow:", doc["data"]["streamFlow"]["value"], "ft3/s", safetyStringToColor(doc["data"]["streamFlow"]["safety"]));
-      PrintData(1, "Gauge Height:", doc["data"]["gaugeHeight"]["value"], "ft", safetyStringToColor(doc["data"]["gaugeHeight"]["safety"]));
-      PrintData(2, "Water temperature:", doc["data"]["waterTempC"]["value"], "C", safetyStringToColor(doc["data"]["waterTempC"]["safety"]));
-      PrintData(3, "E. Coli:", doc["data"]["eColiConcentration"]["value"], "col/samp.", safetyStringToColor(doc["data"]["eColiConcentration"]["safety"]));
-      PrintData(4, "Bacteria threshold:", doc["data"]["bacteriaThreshold"]["safety"], "", safetyStringToColor(doc["data"]["bacteriaThreshold"]["safety"]));
-      PrintData(5, "", "", "", TFT_BLUE);
-      PrintData(6, "Station type(s):", stationTypes[stationTypeIndex], "", TFT_BLUE);
-      PrintData(7, "Date Retrieved:", lastModifedDateBuf, "", TFT_WHITE);
-      PrintData(8, "(from endpoint)", lastModifedTimeBuf, "", TFT_WHITE);
+      if (!(covered & (1 << rule.measurement)))
+      {
+        compiled.add(rule);
+      }
     }
-    else if (displayScreen == 1)
+  }
+
+  safetyRules = compiled;
+  locationsNeedScoring = true;
+
+  LOG_I("Compiled %u safety rules for %u locations.", (unsigned int)safetyRules.size(), numLocations);
+
+  return true;
+}
+
+// Takes the measurements and reported status of decoded location data.
+void ApplyLocationRecord(int locationIndex, const LocationRecord &record)
+{
+  for (int m = 0; m < numMeasurements; m++)
+  {
+    locations[locationIndex].measurements[m] = record.data[m].number;
+  }
+  locations[locationIndex].reportedSafety = record.status;
+  if (record.recordTime[0] != '\0')
+  {
+    locations[locationIndex].recordTime = GetEpochFromISO8601(record.recordTime);
+  }
+  locationsNeedScoring = true;
+}
+
+// Status of a location: scored by its rules, else as reported by the API.
+Safety LocationSafety(int locationIndex)
+{
+  Location &location = locations[locationIndex];
+  return safetyRules.hasRules(locationIndex) ? safetyRules.evaluate(locationIndex, location.measurements) : location.reportedSafety;
+}
+
+// Re-scores all locations in one pass.
+void ScoreLocations()
+{
+  for (int i = 0; i < numLocations; i++)
+  {
+    locations[i].safety = LocationSafety(i);
+  }
+  locationsNeedScoring = false;
+}
+
+void LoadMeasurementsFromSDCard()
+{
+  LOG_I("Getting location measurements from location data stored on SD card.");
+
+  DynamicJsonDocument doc(2048);
+  LocationRecord record;
+
+  for (int i = 0; i < numLocations; i++)
+  {
+    String locationDataJson;
+    if (GetJsonFromSDCard("/locations/" + String(i), &locationDataJson) && !deserializeJson(doc, locationDataJson) && record.decode(doc.as<JsonVariantConst>()))
     {
+      ApplyLocationRecord(i, record);
+    }
+  }
+  locationsNeedScoring = true;
+}
+
+msTimer timerUpdateStatusBuffer(0);
+
+void ShowLocationIndicators(bool highlightSelected)
+{
+  static const uint32_t safetyColors[] = {OFF, GREEN, YELLOW, RED};
+
+  for (int i = 0; i < numLocations; i++)
+  {
+    leds[locations[i].led] = safetyColors[locations[i].safety];
+  }
 
-      uint16_t color = AreDateTimesWithinNDays(currentTime, doc["data"]["streamFlow"]["date"].as<String>(), daysDataIsValid) ? TFT_GREEN : TFT_RED;
-      PrintData(0, "Stream Flow:", doc["data"]["streamFlow"]["date"].as<String>().substring(0, 10).c_str(), "", color);
+  if (highlightSelected)
+    leds[locations[selectedLoctionIndex].led] = CRGB::Blue;
 
-      color = AreDateTimesWithinNDays(currentTime, doc["data"]["gaugeHeight"]["date"].as<String>(), daysDataIsValid) ? TFT_GREEN : TFT_RED;
-      PrintData(1, "Gauge Height:", doc["data"]["gaugeHeight"]["date"].as<String>().substring(0, 10).c_str(), "", color);
+  if (legendLed >= 0)
+  {
+    leds[legendLed] = CRGB::Green;
+    leds[legendLed + 1] = CRGB::Yellow;
+    leds[legendLed + 2] = CRGB::Red;
+    leds[legendLed + 3] = CRGB::Black;
+  }
 
-      color = AreDateTimesWithinNDays(currentTime, doc["data"]["waterTempC"]["date"].as<String>(), daysDataIsValid) ? TFT_GREEN : TFT_RED;
-      PrintData(2, "Water temperature:", doc["data"]["waterTempC"]["date"].as<String>().substring(0, 10).c_str(), "", color);
+  delay(10);
+  FastLED.show();
+}
 
-      color = AreDateTimesWithinNDays(currentTime, doc["data"]["eColiConcentration"]["date"].as<String>(), daysDataIsValid) ? TFT_GREEN : TFT_RED;
-      PrintData(3, "E. Coli:", doc["data"]["eColiConcentration"]["date"].as<String>().substring(0, 10).c_str(), "", color);
+void UpdateLocationIndicators(bool allOffFlag = false)
+{
+  FastLED.setBrightness(indicatorBrightness);
 
-      color = AreDateTimesWithinNDays(currentTime, doc["data"]["bacteriaThreshold"]["date"].as<String>(), daysDataIsValid) ? TFT_GREEN : TFT_RED;
-      PrintData(4, "Bacteria threshold:", doc["data"]["bacteriaThreshold"]["date"].as<String>().substring(0, 10).c_str(), "", color);
+  // Turn off all indicators.
+  if (allOffFlag)
+  {
+    for (int i = 0; i < numLEDs; i++)
+    {
+      leds[i] = CRGB::Black;
+      delay(10);
+      FastLED.show();
     }
+    return;
+  }
+
+  // Load measurements from location data on SD card once, API updates
+  // keep them current afterwards.
+  static bool measurementsLoaded = false;
+
+  if (!measurementsLoaded && timerUpdateStatusBuffer.elapsed())
+  {
+    measurementsLoaded = true;
+    LoadMeasurementsFromSDCard();
+  }
+
+  bool changed = locationsNeedScoring;
+  if (locationsNeedScoring)
+  {
+    ScoreLocations();
+  }
+
+  // Update all LEDs when a status, the selection or the flash phase
+  // changes, the strips keep their colours in between. In power save
+  // mode the selection is lit steadily, a flash would wake the loop
+  // every 750 ms.
+  static msTimer timerFlash(750);
+  static bool flashToggle;
+  static int shownSelection = -1;
+
+  if (powerSave)
+  {
+    changed |= !flashToggle;
+    flashToggle = true;
+  }
+  else if (timerFlash.elapsed())
+  {
+    flashToggle = !flashToggle;
+    changed = true;
+  }
+
+  if (changed || shownSelection != selectedLoctionIndex)
+  {
+    shownSelection = selectedLoctionIndex;
+    ShowLocationIndicators(flashToggle);
+  }
+}
+
+// Loads location statuses and the selected location from the boot snapshot.
+bool LoadSnapshotFromSDCard()
+{
+  std::vector<uint8_t> buf;
+
+  if (!store.read(snapshotFilePath, buf))
+  {
+    LOG_I("No boot snapshot found.");
+    return false;
+  }
+
+  uint32_t magic = 0;
+  uint16_t count = 0, selected = 0;
+  if (buf.size() >= 8)
+  {
+    memcpy(&magic, &buf[0], 4);
+    memcpy(&count, &buf[4], 2);
+    memcpy(&selected, &buf[6], 2);
+  }
+
+  if (magic != snapshotMagic || count != numLocations || buf.size() != 8 + (size_t)numLocations)
+  {
+    LOG_W("Boot snapshot does not match locations, ignored.");
+    return false;
+  }
+
+  for (int i = 0; i < numLocations; i++)
+  {
+    locations[i].safety = (Safety)(buf[8 + i] & 0x03);
   }
 
+  selectedLoctionIndex = selected < numLocations ? selected : 0;
+
   return true;
 }
 
-void UpdateDisplay()
+// Writes the boot snapshot when location statuses or the selected location changed.
+void SaveSnapshotToSDCard()
 {
-  // Displaying the diagnostic screen takes priority
-  if (displayScreen == 2)
+  static std::vector<uint8_t> saved;
+
+  std::vector<uint8_t> buf(8 + numLocations);
+  uint16_t count = numLocations;
+  uint16_t selected = selectedLoctionIndex;
+
+  memcpy(&buf[0], &snapshotMagic, 4);
+  memcpy(&buf[4], &count, 2);
+  memcpy(&buf[6], &selected, 2);
+
+  for (int i = 0; i < numLocations; i++)
   {
-    PrintTitle("Diagnostics:", "", TFT_YELLOW);
+    buf[8 + i] = locations[i].safety;
+  }
 
-    char buf[50];
-    sprintf(buf, "Date/Time: %s", currentTime.substring(0, 19).c_str());
-    PrinInfo(0, buf, TFT_YELLOW);
-    sprintf(buf, "Selected location: %u", selectedLoctionIndex);
-    PrinInfo(1, buf, TFT_YELLOW);
-    sprintf(buf, "Next API location: %u", apiLoctionIndex);
-    PrinInfo(2, buf, TFT_YELLOW);
-    PrinInfo(3, "", TFT_YELLOW);
-    sprintf(buf, "API Error: %s", dataApiErrorDate.c_str(), dataApiErrorMessage.c_str());
-    PrinInfo(4, buf, TFT_YELLOW);
-    sprintf(buf, "API Error: %s", dataApiErrorMessage.c_str());
-    PrinInfo(5, buf, TFT_YELLOW);
-    PrinInfo(6, "", TFT_YELLOW);
-    PrinInfo(7, "", TFT_YELLOW);
-    PrinInfo(8, "", TFT_YELLOW);
+  if (buf == saved)
+  {
     return;
   }
 
-  String locationDataJson;
-  if (!GetJsonFromSDCard("/locations/" + String(selectedLoctionIndex), &locationDataJson))
+  if (!store.write(snapshotFilePath, buf.data(), buf.size()))
   {
-    // Check SD card for connectivity.
-    String path = "/locations.json";
-    File file = SD.open(path);
-    if (!file)
-    {
-      FatalError("SD card not detected.\nTurn off device and\nreinsert valid SD card.");
+    LOG_W("Failed to write boot snapshot.");
+    return;
+  }
+  saved = buf;
+}
+
+void FatalError(String errorMsg)
+{
+
+  UpdateLocationIndicators(true);
+
+  tft.fillScreen(TFT_BLACK);
+  tft.setTextSize(2);
+  tft.setTextColor(TFT_RED);
+  tft.setCursor(0, 0);
+  tft.println("Fatal error.");
+  tft.println();
+  tft.print(errorMsg);
+
+  // Fatal errors bypass the logger, the drain task may never run again.
+  Serial.println(errorMsg);
+  recorder.fatal(errorMsg.c_str());
+
+  while (1)
+  {
+    recorder.feed();
+    delay(1000);
+  }
+}
+
+// Solution provided by : https://github.com/Bodmer/TFT_eSPI/issues/6
+void charBounds(char c, int16_t *x, int16_t *y,
+                int16_t *minx, int16_t *miny, int16_t *maxx, int16_t *maxy)
+{
+  if (c == '\n')
+  {                         // Newline?
+    *x = 0;                 // Reset x to zero,
+    *y += tft.textsize * 8; // advance y one line
+                            // min/max x/y unchaged -- that waits for next 'normal' character
+  }
+  else if (c != '\r')
+  { // Normal char; ignore carriage returns
+    if (/*wrap*/ false && ((*x + tft.textsize * 6) > tft.width()))
+    {                         // Off right?
+      *x = 0;                 // Reset x to zero,
+      *y += tft.textsize * 8; // advance y one line
     }
-    file.close();
+    int x2 = *x + tft.textsize * 6 - 1, // Lower-right pixel of char
+        y2 = *y + tft.textsize * 8 - 1;
+    if (x2 > *maxx)
+      *maxx = x2; // Track max x, y
+    if (y2 > *maxy)
+      *maxy = y2;
+    if (*x < *minx)
+      *minx = *x; // Track min x, y
+    if (*y < *miny)
+      *miny = *y;
+    *x += tft.textsize * 6; // Advance x one char
   }
+}
 
-  unsigned long m = millis();
+// Solution provided by : https://github.com/Bodmer/TFT_eSPI/issues/6
+void getTextBounds(const char *str, int16_t x, int16_t y,
+                   int16_t *x1, int16_t *y1, uint16_t *w, uint16_t *h)
+{
+  uint8_t c; // Current character
 
-  UpdateLocationDataOnScreen(selectedLoctionIndex, &locationDataJson, displayScreen);
+  *x1 = x;
+  *y1 = y;
+  *w = *h = 0;
+
+  int16_t minx = tft.width(), miny = tft.width(), maxx = -1, maxy = -1;
+
+  while ((c = *str++))
+    charBounds(c, &x, &y, &minx, &miny, &maxx, &maxy);
 
-  Serial.printf("Time to print data on tft: %ums\n", (unsigned int)(millis() - m));
+  if (maxx >= minx)
+  {
+    *x1 = minx;
+    *w = maxx - minx + 1;
+  }
+  if (maxy >= miny)
+  {
+    *y1 = miny;
+    *h = maxy - miny + 1;
+  }
 }
 
-bool GetParametersFromSDCard()
+bool InitSDCard()
 {
-  File file = SD.open(wifiFilePath);
+  int count = 0;
 
-  Serial.println("Attempting to fetch parameters from SD card...");
+  LOG_I("Attempting to mount SD card...");
 
-  if (!file)
+  while (!SD.begin(PIN_SD_CHIP_SELECT))
   {
-    Serial.printf("Failed to open file: %s\n", wifiFilePath);
-    file.close();
-    return false;
+    if (++count > 5)
+    {
+      LOG_E("Card Mount Failed.");
+      return false;
+    }
+    delay(250);
+  }
+
+  LOG_I("SD card mounted.");
+  return true;
+}
+
+// Mounts internal flash (formatted on first use) as the fast tier.
+void InitStore()
+{
+  bool mounted = LittleFS.begin(true);
+
+  if (!mounted)
+  {
+    LOG_W("Internal flash not mounted, files are read from SD card only.");
+  }
+
+  store.begin(SD, mounted ? &LittleFS : nullptr, timeBetweenCacheFlush);
+  store.mirror(wifiFilePath);
+  store.mirror(locationsFilePath);
+  store.mirror(rulesFilePath);
+  store.mirror(snapshotFilePath);
+  store.mirror("/locations/");
+  store.mirror("/stations/");
+}
+
+// Detects a removed or failing SD card and remounts it once it is back.
+void CheckSDCard()
+{
+  File file = SD.open(wifiFilePath);
+  bool present = file;
+  file.close();
+
+  if (!present)
+  {
+    SD.end();
+    present = SD.begin(PIN_SD_CHIP_SELECT);
+  }
+
+  if (present != sdStatus)
+  {
+    if (present)
+    {
+      LOG_I("SD card mounted.");
+    }
+    else
+    {
+      LOG_W("SD card not detected, showing data cached in flash.");
+      recorder.event(EventSDCardLost);
+    }
+    sdStatus = present;
+  }
+}
+
+bool SaveJsonToSDCard(String fileName, String data)
+{
+  String path = "/" + fileName + ".json";
+  LOG_D("Writing file: %s", path.c_str());
+
+  uint32_t bulkErrors = store.bulkErrors();
+  bool written = store.write(path, data);
+
+  // Kept in flash when the SD card failed, the SD fault shows as sdStatus.
+  if (store.bulkErrors() != bulkErrors && sdStatus)
+  {
+    CheckSDCard();
+  }
+
+  if (!written)
+  {
+    LOG_E("Write failed: %s", path.c_str());
+    return false;
+  }
+  return true;
+}
+
+uint16_t SafetyColor(Safety safety)
+{
+  static const uint16_t safetyColors[] = {TFT_WHITE, TFT_GREEN, TFT_YELLOW, TFT_RED};
+  return safetyColors[safety];
+}
+
+void PrintData(int line, const char *text, const char *value, const char *units, uint16_t color)
+{
+
+  int spaces = strlen(value) > 5 ? 9 - (strlen(value) - 5) : 9;
+
+  tft.setTextSize(2);
+  tft.setCursor(textIndent, 87 + line * 21);
+
+  tft.setTextColor(TFT_WHITE, TFT_BLACK);
+  tft.printf("%-*s", 20, text);
+
+  tft.setTextColor(color, TFT_BLACK);
+  tft.printf("%-*s", 5, value);
+
+  tft.setTextColor(TFT_WHITE, TFT_BLACK);
+  tft.printf("%-*s", spaces, strcmp(value, "N.A.") == 0 ? "" : units);
+}
+
+void PrinInfo(int line, const char *text, uint16_t color)
+{
+  const int spacesPerLine = 34;
+
+  tft.setTextSize(2);
+  tft.setCursor(textIndent, 87 + line * 21);
+
+  tft.setTextColor(color, TFT_BLACK);
+  tft.printf("%-*s", spacesPerLine, text);
+}
+
+void PrintTitle(const char *line1, const char *line2, uint16_t color)
+{
+  tft.setTextSize(3);
+  tft.setTextColor(color, TFT_BLACK);
+  tft.setCursor(textIndent, 14);
+  tft.printf("%-24s", line1);
+  tft.setCursor(textIndent, 44);
+  tft.printf("%-24s", line2);
+}
+
+void PrintTrendLabel(int line, const char *text, Sparkline &sparkline, const char *units)
+{
+  char buf[50];
+
+  if (isnan(sparkline.minValue()))
+  {
+    sprintf(buf, "%s: N.A.", text);
+  }
+  else
+  {
+    sprintf(buf, "%s: %.1f - %.1f %s", text, sparkline.minValue(), sparkline.maxValue(), units);
+  }
+  PrinInfo(line, buf, TFT_WHITE);
+}
+
+// Loads the trend sparklines of a location from its history log.
+void LoadTrend(int locationIndex)
+{
+  HistorySample *samples = (HistorySample *)malloc(trendWidth * sizeof(HistorySample));
+  float *values = (float *)malloc(trendWidth * sizeof(float));
+
+  trendLocationIndex = -1;
+
+  if (samples == nullptr || values == nullptr)
+  {
+    LOG_E("Not enough memory to load trend of location %u.", locationIndex);
+  }
+  else
+  {
+    size_t count = history[locationIndex].readLast(samples, trendWidth);
+
+    for (size_t i = 0; i < count; i++)
+    {
+      values[i] = samples[i].streamFlow;
+    }
+    trendFlow.load(values, count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+      values[i] = samples[i].gaugeHeight;
+    }
+    trendGauge.load(values, count);
+
+    trendLocationIndex = locationIndex;
+  }
+
+  free(samples);
+  free(values);
+}
+
+void DrawTrend(int locationIndex)
+{
+  const unsigned long drawBudget = 50; // Screen switch with a week of samples.
+  unsigned long m = millis();
+
+  // Sparklines of the location shown last are kept up to date by AppendHistorySample().
+  if (trendLocationIndex != locationIndex)
+  {
+    LoadTrend(locationIndex);
+  }
+
+  PrintTrendLabel(0, "Stream Flow", trendFlow, "ft3/s");
+  trendFlow.pushSprite(textIndent, 108);
+  PrintTrendLabel(4, "Gauge Height", trendGauge, "ft");
+  trendGauge.pushSprite(textIndent, 192);
+
+  char buf[50];
+  sprintf(buf, "Last %u samples", trendFlow.count());
+  PrinInfo(8, buf, TFT_BLUE);
+
+  unsigned long elapsed = millis() - m;
+  if (elapsed > drawBudget)
+  {
+    LOG_W("Trend of %u samples took %lums to draw.", trendFlow.count(), elapsed);
+  }
+  LOG_D("Time to draw trend: %lums", elapsed);
+}
+
+void ClearTrend()
+{
+  tft.fillRect(textIndent, 108, trendWidth, trendHeight, TFT_BLACK);
+  tft.fillRect(textIndent, 192, trendWidth, trendHeight, TFT_BLACK);
+}
+
+// Seconds since the epoch, 0 while the time is not known.
+unsigned long CurrentEpoch()
+{
+  return timeEpoch == 0 ? 0 : timeEpoch + (millis() - timeEpochMillis) / 1000;
+}
+
+// Milliseconds until millis() reaches a time, 0 when it has passed.
+unsigned long MillisUntil(unsigned long time)
+{
+  long span = (long)(time - millis());
+  return span > 0 ? span : 0;
+}
+
+void ClearOverview()
+{
+  tft.fillRect(textIndent, overviewY, overviewWidth, overviewHeight, TFT_BLACK);
+}
+
+// Age of location data on the overview, "--" when not known.
+void FormatDataAge(char *buf, size_t size, unsigned long now, unsigned long time)
+{
+  if (now == 0 || time == 0)
+  {
+    snprintf(buf, size, "--");
+    return;
+  }
+
+  unsigned long age = now > time ? now - time : 0;
+  if (age < 3600)
+  {
+    snprintf(buf, size, "<1h");
+  }
+  else if (age < 2 * 86400)
+  {
+    snprintf(buf, size, "%luh", age / 3600);
+  }
+  else
+  {
+    snprintf(buf, size, "%lud", min(age / 86400, 999UL));
+  }
+}
+
+// Redraws the overview tiles that changed, all of them when the screen was
+// just entered. Only the location table is read, no files.
+void DrawOverview(bool entered)
+{
+  static std::vector<OverviewTile> tiles;
+
+  unsigned long m = millis();
+  unsigned long currentEpoch = CurrentEpoch();
+
+  int counts[SafetyDanger + 1] = {0};
+  tiles.resize(numLocations);
+  for (int i = 0; i < numLocations; i++)
+  {
+    const Location &location = locations[i];
+    OverviewTile &tile = tiles[i];
+
+    tile.name = location.shortName;
+    tile.area = location.area;
+    tile.color = SafetyColor(location.safety);
+    tile.selected = i == selectedLoctionIndex;
+    tile.stale = location.recordTime == 0 || currentEpoch - location.recordTime > daysDataIsValid * 86400UL;
+    FormatDataAge(tile.age, sizeof(tile.age), currentEpoch, location.recordTime);
+
+    if (location.safety <= SafetyDanger)
+    {
+      counts[location.safety]++;
+    }
+  }
+
+  if (entered)
+  {
+    ClearOverview();
+    overview.invalidate();
+  }
+
+  int drawn = overview.update(tiles.data(), numLocations);
+  if (entered || drawn > 0)
+  {
+    char buf[30];
+    snprintf(buf, sizeof(buf), "%d danger, %d caution", counts[SafetyDanger], counts[SafetyCaution]);
+    PrintTitle("All locations:", buf, TFT_WHITE);
+    LOG_D("Time to draw %d overview tiles: %ums", drawn, (unsigned int)(millis() - m));
+  }
+}
+
+bool UpdateLocationDataOnScreen(int locationIndex, String *locationDataJson, int displayScreen)
+{
+
+  PrintTitle(locations[locationIndex].shortName, locations[locationIndex].area, TFT_WHITE);
+
+  DynamicJsonDocument doc(2048);
+  DeserializationError error = deserializeJson(doc, *locationDataJson);
+  LocationRecord record;
+
+  if (error || !record.decode(doc.as<JsonVariantConst>()))
+  {
+    LOG_E("DeserializeJson() failed: %s", error ? error.c_str() : "no station");
+
+    char locationString[50];
+    sprintf(locationString, "(filename: %u.json, was not found.)", locationIndex);
+
+    PrinInfo(0, "Location data not found", TFT_RED);
+    PrinInfo(1, "on SD card.", TFT_RED);
+    PrinInfo(2, "", TFT_RED);
+    PrinInfo(3, "Data will be downloaded", TFT_RED);
+    PrinInfo(4, "from API shortly.", TFT_RED);
+    PrinInfo(5, "", TFT_RED);
+    PrinInfo(6, "", TFT_RED);
+    PrinInfo(7, "", TFT_RED);
+    PrinInfo(8, "", TFT_RED);
+  }
+  else
+  {
+    // Init displaying variables.
+    const char stationTypes[4][9] = {"N/A     ", "USGS    ", "WR      ", "USGS, WR"};
+    bool hasUsgs = record.usgsId[0] != '\0';
+    bool hasWr = record.wrId[0] != '\0';
+    int stationTypeIndex = hasUsgs && hasWr ? 3 : !hasUsgs ? 1 : !hasWr ? 2 : 0;
+
+    char lastModifedDateBuf[20];
+    snprintf(lastModifedDateBuf, sizeof(lastModifedDateBuf), "%.10s", record.recordTime);
+    char lastModifedTimeBuf[20];
+    snprintf(lastModifedTimeBuf, sizeof(lastModifedTimeBuf), "%.8s", strlen(record.recordTime) > 11 ? record.recordTime + 11 : "");
+
+    // Rows of the measurement screens.
+    static const struct
+    {
+      Measurement measurement;
+      const char *text;
+      const char *units;
+    } rows[] = {{MeasureStreamFlow, "Stream Flow:", "ft3/s"}, {MeasureGaugeHeight, "Gauge Height:", "ft"}, {MeasureWaterTemp, "Water temperature:", "C"}, {MeasureEColi, "E. Coli:", "col/samp."}, {MeasureBacteria, "Bacteria threshold:", ""}};
+
+    if (displayScreen == 0)
+    {
+      for (int line = 0; line < 5; line++)
+      {
+        const MeasurementRecord &data = record.data[rows[line].measurement];
+
+        // The bacteria threshold is shown by its safety only.
+        const char *value = rows[line].measurement == MeasureBacteria ? safetyNames[data.safety] : data.value;
+        PrintData(line, rows[line].text, value, rows[line].units, SafetyColor(data.safety));
+      }
+      PrintData(5, "", "", "", TFT_BLUE);
+      PrintData(6, "Station type(s):", stationTypes[stationTypeIndex], "", TFT_BLUE);
+      PrintData(7, "Date Retrieved:", lastModifedDateBuf, "", TFT_WHITE);
+      PrintData(8, "(from endpoint)", lastModifedTimeBuf, "", TFT_WHITE);
+    }
+    else if (displayScreen == 1)
+    {
+      for (int line = 0; line < 5; line++)
+      {
+        const MeasurementRecord &data = record.data[rows[line].measurement];
+
+        char date[11];
+        snprintf(date, sizeof(date), "%.10s", data.date);
+        uint16_t color = AreDateTimesWithinNDays(currentTime, data.date, daysDataIsValid) ? TFT_GREEN : TFT_RED;
+        PrintData(line, rows[line].text, date, "", color);
+      }
+    }
+    else if (displayScreen == screenTrend)
+    {
+      DrawTrend(locationIndex);
+    }
+  }
+
+  return true;
+}
+
+// Flight recorder page: the stage running at the last reset and the
+// newest slow and stalled stages, with the boots since when older.
+void DrawFlightLog()
+{
+  char buf[50];
+  int line = 0;
+
+  snprintf(buf, sizeof(buf), "%s reset", FlightRecorder::resetName(recorder.resetReason()));
+  PrintTitle("Flight recorder:", buf, TFT_YELLOW);
+
+  if (recorder.recovered())
+  {
+    snprintf(buf, sizeof(buf), "Reset in: %s", recorder.stageName(recorder.resetStage()));
+  }
+  else
+  {
+    snprintf(buf, sizeof(buf), "Log started at this boot");
+  }
+  PrinInfo(line++, buf, TFT_YELLOW);
+  snprintf(buf, sizeof(buf), "Boots: %u, stalls: %u", (unsigned int)recorder.boots(), (unsigned int)recorder.stalls());
+  PrinInfo(line++, buf, TFT_YELLOW);
+
+  int bootsAgo = 0;
+  const FlightRecord *record;
+  for (int n = 0; line < 10 && (record = recorder.newest(n)) != nullptr; n++)
+  {
+    if (record->type == FlightSlow || record->type == FlightStall)
+    {
+      int length = snprintf(buf, sizeof(buf), "%-5s %-14s %5u ms", FlightRecorder::typeName(record->type), recorder.stageName(record->stage), record->value);
+      if (bootsAgo > 0)
+      {
+        snprintf(buf + length, sizeof(buf) - length, " b-%d", bootsAgo);
+      }
+      PrinInfo(line++, buf, record->type == FlightStall ? TFT_RED : TFT_YELLOW);
+    }
+    bootsAgo += record->type == FlightBoot;
+  }
+
+  if (line == 2)
+  {
+    PrinInfo(line++, "No slow or stalled stages.", TFT_YELLOW);
+  }
+  while (line < 10)
+  {
+    PrinInfo(line++, "", TFT_YELLOW);
+  }
+}
+
+void UpdateDisplay()
+{
+  // Graph pixels are not covered by the text of the other screens.
+  static int drawnScreen = 0;
+  bool entered = drawnScreen != displayScreen;
+  if (drawnScreen == screenTrend && entered)
+  {
+    ClearTrend();
+  }
+  if (drawnScreen == screenOverview && entered)
+  {
+    ClearOverview();
+  }
+  drawnScreen = displayScreen;
+
+  if (displayScreen == screenOverview)
+  {
+    DrawOverview(entered);
+    return;
+  }
+
+  if (displayScreen == screenFlightLog)
+  {
+    DrawFlightLog();
+    return;
+  }
+
+  // Displaying the diagnostic screen takes priority
+  if (displayScreen == screenDiagnostics)
+  {
+    char buf[50];
+    snprintf(buf, sizeof(buf), "%s reset", FlightRecorder::resetName(recorder.resetReason()));
+    PrintTitle("Diagnostics:", buf, TFT_YELLOW);
+
+    sprintf(buf, "Date/Time: %s", currentTime.substring(0, 19).c_str());
+    PrinInfo(0, buf, TFT_YELLOW);
+    sprintf(buf, "Selected location: %u", selectedLoctionIndex);
+    PrinInfo(1, buf, TFT_YELLOW);
+    sprintf(buf, "Next API station: %s", stations[apiStationIndex].id.c_str());
+    PrinInfo(2, buf, TFT_YELLOW);
+    if (WiFi.status() == WL_CONNECTED)
+    {
+      sprintf(buf, "WiFi: %.16s (%d dBm, ch %d)", WiFi.SSID().c_str(), WiFi.RSSI(), WiFi.channel());
+    }
+    else
+    {
+      sprintf(buf, "WiFi: not connected");
+    }
+    PrinInfo(3, buf, TFT_YELLOW);
+    sprintf(buf, "API Error: %s", dataApiErrorDate.c_str(), dataApiErrorMessage.c_str());
+    PrinInfo(4, buf, TFT_YELLOW);
+    sprintf(buf, "API Error: %s", dataApiErrorMessage.c_str());
+    PrinInfo(5, buf, TFT_YELLOW);
+    sprintf(buf, "API: %lums (avg %lu), %u conn/%u req", dataApiSession.lastMillis(), dataApiSession.averageMillis(), (unsigned int)dataApiSession.connects(), (unsigned int)dataApiSession.requests());
+    PrinInfo(6, buf, TFT_YELLOW);
+    sprintf(buf, "Time: %lums (avg %lu), %u conn/%u req", timeApiSession.lastMillis(), timeApiSession.averageMillis(), (unsigned int)timeApiSession.connects(), (unsigned int)timeApiSession.requests());
+    PrinInfo(7, buf, TFT_YELLOW);
+    snprintf(buf, sizeof(buf), "Flash: %u/%u rd, %u wr (%u saved)", (unsigned int)store.fastReads(), (unsigned int)(store.fastReads() + store.bulkReads()), (unsigned int)store.fastWrites(), (unsigned int)store.savedWrites());
+    PrinInfo(8, buf, TFT_YELLOW);
+    sprintf(buf, "CPU %.0f%%, sleep %.0f%%, radio %.0f%%", power.percent(PowerActive), power.percent(PowerSleep), power.radioPercent());
+    PrinInfo(9, buf, TFT_YELLOW);
+    return;
+  }
+
+  String locationDataJson;
+  if (!GetJsonFromSDCard("/locations/" + String(selectedLoctionIndex), &locationDataJson))
+  {
+    // Cached location data is shown while the SD card is missing.
+    CheckSDCard();
+  }
+
+  unsigned long m = millis();
+
+  UpdateLocationDataOnScreen(selectedLoctionIndex, &locationDataJson, displayScreen);
+
+  LOG_D("Time to print data on tft: %ums", (unsigned int)(millis() - m));
+}
+
+bool GetParametersFromSDCard()
+{
+  File file = store.open(wifiFilePath);
+
+  LOG_I("Attempting to fetch parameters from SD card...");
+
+  if (!file)
+  {
+    LOG_E("Failed to open file: %s", wifiFilePath);
+    file.close();
+    return false;
+  }
+  else
+  {
+    DynamicJsonDocument doc(2048);
+    DeserializationError error = deserializeJson(doc, file.readString());
+
+    if (error)
+    {
+      LOG_E("DeserializeJson() failed: %s", error.c_str());
+      return false;
+    }
+
+    numWifiCredentials = min((int)doc["wifiCredentials"].size(), (int)(sizeof(wifiCredentials) / sizeof(wifiCredentials[0])));
+
+    for (int i = 0; i < numWifiCredentials; i++)
+    {
+      wifiCredentials[i].ssid = doc["wifiCredentials"][i]["ssid"].as<String>();
+      wifiCredentials[i].password = doc["wifiCredentials"][i]["password"].as<String>();
+
+      LOG_D("WiFi credentials for SSID: %s", wifiCredentials[i].ssid.c_str());
+    }
+
+    timeZone = doc["timeZone"].as<String>();
+
+    int indicatorBrightnessParameter = doc["indicatorBrightness"].as<int>();
+    int signBrightnessParameter = doc["signBrightness"].as<int>();
+
+    if (indicatorBrightnessParameter > 9 && indicatorBrightnessParameter < 256)
+    {
+      indicatorBrightness = indicatorBrightnessParameter;
+    }
+
+    if (signBrightnessParameter > 25 && signBrightnessParameter < 256)
+    {
+      signBrightness = signBrightnessParameter;
+    }
+
+    powerSave = doc["powerSave"].as<bool>();
+    peerSharing = doc["peerSharing"].as<bool>();
+    usgsDirect = doc["usgsDirect"].as<bool>();
+  }
+  file.close();
+  return true;
+}
+
+void DisplayLayout()
+{
+  int w = tft.width() - 1;
+  int h = tft.height() - 1;
+  int t = 5;
+
+  tft.fillScreen(TFT_BLACK);
+
+  // Perimeter
+  tft.fillRect(0, 0, w, t, TFT_BLUE);
+  tft.fillRect(w - t, 0, w, h, TFT_BLUE);
+  tft.fillRect(0, h - t, tft.width(), 5, TFT_BLUE);
+  tft.fillRect(0, 0, 0 + t, h, TFT_BLUE);
+
+  // Lines across.
+  tft.fillRect(0, 73, tft.width(), 5, TFT_BLUE);
+  tft.fillRect(0, 280, tft.width(), 5, TFT_BLUE);
+
+  tft.setTextSize(2);
+  tft.setCursor(textIndent, textStatusY);
+  tft.setTextColor(TFT_WHITE);
+  tft.print("System Status:");
+}
+
+void DisplayIndicator(String string, int x, int y, uint16_t color)
+{
+  int16_t x1, y1;
+  uint16_t w, h;
+  const int offset = 2;
+  tft.setTextSize(2);
+  tft.setCursor(x, y);
+
+  getTextBounds(string.c_str(), x, y, &x1, &y1, &w, &h);
+  tft.fillRect(x - offset, y - offset, w + offset, h + offset, color);
+  tft.setTextPadding(5);
+  tft.setTextColor(TFT_BLACK, color);
+  tft.print(string);
+}
+
+void UpdateIndicators()
+{
+  static int oldStatusSum = 99;
+  int statusSum = (int)sdStatus + (int)wifiStatus + (int)dataApiStatus + (int)timeApiStatus;
+
+  if (oldStatusSum != statusSum)
+  {
+    oldStatusSum = statusSum;
+    DisplayIndicator("SD", 200, textStatusY, sdStatus ? TFT_GREEN : TFT_RED);
+    DisplayIndicator("WIFI", 252, textStatusY, wifiStatus ? TFT_GREEN : TFT_RED);
+    DisplayIndicator("TIME", 329, textStatusY, timeApiStatus ? TFT_GREEN : TFT_RED);
+    DisplayIndicator("API", 407, textStatusY, dataApiStatus ? TFT_GREEN : TFT_RED);
+  }
+}
+
+// Performs a GET request on a keep-alive session and decodes the response while it
+// streams in from the socket. Responses may be gzip encoded and either MessagePack or JSON.
+// A filter document keeps only the fields it marks while JSON is parsed.
+bool GetDocumentFromHost(HttpSession &session, String uri, JsonDocument &doc, String *errorMessage, const JsonDocument *filter = nullptr)
+{
+  LOG_I("Requesting %s%s", session.host().c_str(), uri.c_str());
+
+  int httpCode = session.get(uri);
+
+  if (httpCode <= 0)
+  {
+    LOG_W("Connection failed, HTTP client code: %d", httpCode);
+    *errorMessage = HTTPClient::errorToString(httpCode);
+    session.end(false);
+    return false;
+  }
+
+  LOG_D("HTTP code: %d", httpCode);
+
+  bool isMsgPack = session.header("Content-Type").startsWith("application/msgpack");
+  bool isGzip = session.header("Content-Encoding").equalsIgnoreCase("gzip");
+  bool isChunked = session.header("Transfer-Encoding").equalsIgnoreCase("chunked");
+
+  HttpBodyStream body(session.stream(), session.size(), isChunked);
+  InflateStream inflater(body);
+  Stream &source = isGzip ? (Stream &)inflater : (Stream &)body;
+
+  DeserializationError error;
+  if (isMsgPack)
+  {
+    error = deserializeMsgPack(doc, source);
+  }
+  else if (filter != nullptr)
+  {
+    error = deserializeJson(doc, source, DeserializationOption::Filter(*filter));
+  }
+  else
+  {
+    error = deserializeJson(doc, source);
+  }
+
+  // The connection is reused only when no response bytes are left on it.
+  session.end(body.finish());
+
+  LOG_I("Response: %u bytes (%s%s) in %lums.", (unsigned int)body.bytesRead(), isMsgPack ? "MessagePack" : "JSON", isGzip ? ", gzip" : "", session.lastMillis());
+
+  if (isGzip)
+  {
+    LOG_D("Inflated %u to %u bytes in %luus.", (unsigned int)inflater.compressedBytes(), (unsigned int)inflater.inflatedBytes(), inflater.inflateMicros());
+  }
+
+  if (error || inflater.error())
+  {
+    LOG_E("Deserialize failed: %s", inflater.error() ? "gzip stream error" : error.c_str());
+    *errorMessage = inflater.error() ? "gzip stream error" : error.c_str();
+    return false;
+  }
+
+#if LOG_PAYLOADS
+  serializeJsonPretty(doc, logger);
+  logger.println();
+#endif
+
+  return true;
+}
+
+bool UpdateTime()
+{
+  String uri = "/api/timezone/" + timeZone;
+  String errorMessage;
+
+  DynamicJsonDocument doc(2048);
+
+  if (!GetDocumentFromHost(timeApiSession, uri, doc, &errorMessage))
+  {
+    return false;
+  }
+
+  currentTime = doc["datetime"].as<String>();
+  timeEpoch = GetEpochFromISO8601(currentTime.c_str());
+  timeEpochMillis = millis();
+  LOG_I("Current time: %s", currentTime.c_str());
+
+  return true;
+}
+
+// Applies a delta response (changed data objects only) to the station data stored on SD card.
+bool ApplyDeltaToSDCard(String fileName, JsonDocument &delta, String *payload)
+{
+  String storedJson;
+  if (!GetJsonFromSDCard(fileName, &storedJson))
+  {
+    return false;
+  }
+
+  DynamicJsonDocument stored(2048);
+  if (deserializeJson(stored, storedJson))
+  {
+    return false;
+  }
+
+  stored["station"] = delta["station"];
+
+  for (JsonPair measurement : delta["data"].as<JsonObject>())
+  {
+    stored["data"][measurement.key().c_str()] = measurement.value();
+  }
+
+  serializeJsonPretty(stored, *payload);
+  return true;
+}
+
+// Logs a location's measurements once per record time: composing a
+// location again (another of its stations updated) adds no sample until
+// its record time moves on.
+void AppendHistorySample(int locationIndex, const LocationRecord &record)
+{
+  HistorySample sample = {};
+  const float *measurements = locations[locationIndex].measurements;
+
+  sample.time = record.recordTime[0] ? GetEpochFromISO8601(record.recordTime) : 0;
+  if (sample.time == 0 || sample.time <= history[locationIndex].lastTime())
+  {
+    return;
+  }
+
+  sample.streamFlow = measurements[MeasureStreamFlow];
+  sample.gaugeHeight = measurements[MeasureGaugeHeight];
+  sample.waterTempC = measurements[MeasureWaterTemp];
+  sample.eColi = measurements[MeasureEColi];
+  sample.status = LocationSafety(locationIndex);
+
+  if (!history[locationIndex].append(sample))
+  {
+    LOG_W("Failed to append history sample for location %u.", locationIndex);
+    return;
+  }
+
+  // Scroll the cached trend by one column instead of reloading it.
+  if (locationIndex == trendLocationIndex)
+  {
+    trendFlow.push(sample.streamFlow);
+    trendGauge.push(sample.gaugeHeight);
+
+    if (displayScreen == screenTrend && locationIndex == selectedLoctionIndex)
+    {
+      DrawTrend(locationIndex);
+    }
+  }
+}
+
+void FlushHistory()
+{
+  for (int i = 0; i < numLocations; i++)
+  {
+    history[i].flush(true);
+  }
+}
+
+// Composes a location's data from the data of its stations stored on SD card.
+// USGS stations provide flow and gauge data, Water Reporter stations provide water quality data.
+bool ComposeLocationData(int locationIndex)
+{
+  const char *usgsStationFields[] = {"usgsId", "usgsName", "usgsDescription"};
+  const char *usgsDataFields[] = {"streamFlow", "gaugeHeight"};
+  const char *wrStationFields[] = {"wrId", "wrName", "wrIsActive", "wrDescription"};
+  const char *wrDataFields[] = {"bacteriaThreshold", "waterTempC", "eColiConcentration"};
+
+  DynamicJsonDocument location(2048);
+  LocationRecord composed;
+  LocationRecord stationRecord;
+  bool empty = true;
+
+  for (int s = 0; s < locations[locationIndex].numStationIds; s++)
+  {
+    Station &station = stations[LocationStationIndex(locationIndex, s)];
+
+    String stationJson;
+    DynamicJsonDocument stationDoc(2048);
+    if (!GetJsonFromSDCard("stations/" + station.id, &stationJson) || deserializeJson(stationDoc, stationJson) || !stationRecord.decode(stationDoc.as<JsonVariantConst>()))
+    {
+      continue;
+    }
+
+    if (empty)
+    {
+      // First station provides defaults for all fields.
+      location.set(stationDoc);
+      location["station"].remove("version");
+      composed = stationRecord;
+      empty = false;
+      continue;
+    }
+
+    bool isUsgs = station.id.length() == 8;
+    const char **stationFields = isUsgs ? usgsStationFields : wrStationFields;
+    const char **dataFields = isUsgs ? usgsDataFields : wrDataFields;
+    int numStationFields = isUsgs ? 3 : 4;
+    int numDataFields = isUsgs ? 2 : 3;
+
+    for (int i = 0; i < numStationFields; i++)
+    {
+      location["station"][stationFields[i]] = stationDoc["station"][stationFields[i]];
+    }
+
+    for (int i = 0; i < numDataFields; i++)
+    {
+      location["data"][dataFields[i]] = stationDoc["data"][dataFields[i]];
+    }
+
+    // Stations report times in different formats (offsets, fractions).
+    if (stationRecord.recordTime[0] && (!composed.recordTime[0] || GetEpochFromISO8601(stationRecord.recordTime) > GetEpochFromISO8601(composed.recordTime)))
+    {
+      location["station"]["recordTime"] = stationDoc["station"]["recordTime"];
+      strcpy(composed.recordTime, stationRecord.recordTime);
+    }
+
+    if (stationRecord.status > composed.status)
+    {
+      location["station"]["locationStatus"] = stationDoc["station"]["locationStatus"];
+      composed.status = stationRecord.status;
+    }
+
+    for (int i = 0; i < numDataFields; i++)
+    {
+      int m = SafetyRules::findMeasurement(dataFields[i]);
+      composed.data[m] = stationRecord.data[m];
+    }
+  }
+
+  if (empty)
+  {
+    return false;
+  }
+
+  ApplyLocationRecord(locationIndex, composed);
+  AppendHistorySample(locationIndex, composed);
+
+  String payload;
+  serializeJsonPretty(location, payload);
+  return SaveJsonToSDCard("locations/" + String(locationIndex), payload);
+}
+
+// Updates every location sharing a station.
+void ComposeStationLocations(int stationIndex)
+{
+  for (int i = 0; i < numLocations; i++)
+  {
+    for (int s = 0; s < locations[i].numStationIds; s++)
+    {
+      if (LocationStationIndex(i, s) == stationIndex)
+      {
+        ComposeLocationData(i);
+        break;
+      }
+    }
+  }
+}
+
+bool GetDataFromAPI(int stationIndex)
+{
+  Station &station = stations[stationIndex];
+  String fileName = "stations/" + station.id;
+  String payload;
+  String uri = "/api/riverconditions.php?stationId=" + station.id;
+
+  // Recover the version of data stored before a restart.
+  if (station.version.isEmpty() && GetJsonFromSDCard(fileName, &payload))
+  {
+    DynamicJsonDocument stored(2048);
+    if (!deserializeJson(stored, payload))
+    {
+      station.version = stored["station"]["version"] | "";
+    }
+    payload = "";
+  }
+
+  // Request only changes since the version stored on SD card.
+  if (!station.version.isEmpty())
+  {
+    uri += "&version=" + station.version;
+  }
+
+  DynamicJsonDocument doc(2048);
+
+  if (!GetDocumentFromHost(dataApiSession, uri, doc, &dataApiErrorMessage))
+  {
+    dataApiErrorDate = currentTime;
+    return false;
+  }
+
+  if (doc["error"].as<bool>() == true)
+  {
+    dataApiErrorDate = doc["date"].as<String>();
+    dataApiErrorMessage = doc["message"].as<String>();
+    return false;
+  }
+
+  if (doc["unchanged"].as<bool>() == true)
+  {
+    LOG_I("Station %s unchanged (version %s).", station.id.c_str(), station.version.c_str());
+    station.fetchEpoch = CurrentEpoch();
+    return true;
+  }
+
+  if (doc["delta"].as<bool>() == true)
+  {
+    if (!ApplyDeltaToSDCard(fileName, doc, &payload))
+    {
+      // Stored data is unusable, request the full data next time.
+      LOG_W("Failed to apply delta to stored station data.");
+      station.version = "";
+      return false;
+    }
+  }
+  else
+  {
+    // Station data is always cached on the SD card as JSON.
+    serializeJsonPretty(doc, payload);
+  }
+
+  if (!SaveJsonToSDCard(fileName, payload))
+  {
+    station.version = "";
+    return false;
+  }
+
+  station.version = doc["station"]["version"] | "";
+  station.fetchEpoch = CurrentEpoch();
+
+  ComposeStationLocations(stationIndex);
+  return true;
+}
+
+inline bool IsUsgsStation(int stationIndex)
+{
+  return stations[stationIndex].id.length() == 8;
+}
+
+// Merges the latest USGS values of a station into its stored data. USGS
+// reports no safety, the measurements are scored by rules.json.
+void UpdateUsgsStation(int stationIndex, JsonArray timeSeries)
+{
+  Station &station = stations[stationIndex];
+  String fileName = "stations/" + station.id;
+  String payload;
+  DynamicJsonDocument stored(2048);
+  const char *newest = nullptr;
+  bool changed = false;
+
+  // A station not fetched before starts from its ID.
+  if (!GetJsonFromSDCard(fileName, &payload) || deserializeJson(stored, payload))
+  {
+    stored.clear();
+    stored["station"]["usgsId"] = station.id.c_str();
+  }
+
+  for (JsonObject series : timeSeries)
+  {
+    if (station.id != (series["sourceInfo"]["siteCode"][0]["value"] | ""))
+    {
+      continue;
+    }
+
+    const char *parameter = series["variable"]["variableCode"][0]["value"] | "";
+    const char *name = !strcmp(parameter, "00060") ? "streamFlow" : !strcmp(parameter, "00065") ? "gaugeHeight" : nullptr;
+    JsonObject latest = series["values"][0]["value"][0];
+
+    if (name == nullptr || latest.isNull())
+    {
+      continue;
+    }
+
+    const char *date = latest["dateTime"] | "";
+    const char *value = latest["value"] | "N.A.";
+
+    // Missing values are reported as the no data value -999999.
+    if (atof(value) <= -999999)
+    {
+      value = "N.A.";
+    }
+
+    if (newest == nullptr || GetEpochFromISO8601(date) > GetEpochFromISO8601(newest))
+    {
+      newest = date;
+    }
+
+    JsonVariant measurement = stored["data"][name];
+    if (!strcmp(measurement["date"] | "", date) && !strcmp(measurement["value"] | "", value))
+    {
+      continue;
+    }
+
+    stored["data"][name]["date"] = date;
+    stored["data"][name]["value"] = value;
+    stored["data"][name]["safety"] = "N.A.";
+    changed = true;
+  }
+
+  station.fetchEpoch = CurrentEpoch();
+
+  if (!changed)
+  {
+    return;
+  }
+
+  // USGS times are the site's local time with its offset, compared with
+  // the API's fetch times (UTC offset) as parsed UTC epochs.
+  stored["station"]["recordTime"] = newest;
+
+  // The data no longer matches an API version.
+  stored["station"].remove("version");
+  station.version = "";
+
+  payload = "";
+  serializeJsonPretty(stored, payload);
+  if (!SaveJsonToSDCard(fileName, payload))
+  {
+    return;
+  }
+
+  LOG_I("Station %s updated from USGS (%s).", station.id.c_str(), newest);
+  ComposeStationLocations(stationIndex);
+}
+
+// Fetches the latest values of all USGS stations in one request. The
+// response (~1.5 KB of metadata per station and parameter) is parsed
+// as it arrives, keeping only the site code, parameter code and latest
+// value with its time.
+bool GetUsgsDataFromAPI()
+{
+  String sites;
+
+  for (int i = 0; i < numStations; i++)
+  {
+    if (IsUsgsStation(i))
+    {
+      if (!sites.isEmpty())
+      {
+        sites += ',';
+      }
+      sites += stations[i].id;
+    }
+  }
+
+  if (sites.isEmpty())
+  {
+    return true;
+  }
+
+  // Without a period the service returns the latest value of each series.
+  String uri = "/nwis/iv/?format=json&siteStatus=active&parameterCd=00060,00065&sites=" + sites;
+
+  StaticJsonDocument<512> filter;
+  filter["value"]["timeSeries"][0]["sourceInfo"]["siteCode"][0]["value"] = true;
+  filter["value"]["timeSeries"][0]["variable"]["variableCode"][0]["value"] = true;
+  filter["value"]["timeSeries"][0]["values"][0]["value"][0]["value"] = true;
+  filter["value"]["timeSeries"][0]["values"][0]["value"][0]["dateTime"] = true;
+
+  DynamicJsonDocument doc(usgsResponseCapacity);
+
+  if (!GetDocumentFromHost(usgsApiSession, uri, doc, &dataApiErrorMessage, &filter))
+  {
+    dataApiErrorDate = currentTime;
+    return false;
+  }
+
+  JsonArray timeSeries = doc["value"]["timeSeries"];
+  if (timeSeries.isNull())
+  {
+    dataApiErrorDate = currentTime;
+    dataApiErrorMessage = "No USGS time series.";
+    return false;
+  }
+
+  if (doc.overflowed())
+  {
+    LOG_W("USGS response exceeds %u bytes, some series are left out.", (unsigned int)usgsResponseCapacity);
+  }
+
+  LOG_I("USGS: %u series, %u bytes kept.", (unsigned int)timeSeries.size(), (unsigned int)doc.memoryUsage());
+
+  for (int i = 0; i < numStations; i++)
+  {
+    if (IsUsgsStation(i))
+    {
+      UpdateUsgsStation(i, timeSeries);
+    }
+  }
+  return true;
+}
+
+// Joins the peer group, again after every WiFi connection. The device ID
+// is the end of the MAC address.
+void JoinPeerGroup()
+{
+  uint8_t mac[6];
+  WiFi.macAddress(mac);
+  uint32_t deviceId = (uint32_t)mac[2] << 24 | (uint32_t)mac[3] << 16 | (uint32_t)mac[4] << 8 | mac[5];
+
+  // Peers send a packet per fetch slot.
+  if (!peers.begin(deviceId, peerGroup, peerPort, 3 * timeBetweenApiCalls))
+  {
+    LOG_E("Failed to join peer group.");
+    return;
+  }
+  peers.setWakeTask(power.task());
+  LOG_I("Sharing station records as peer %08x.", (unsigned int)deviceId);
+}
+
+// True while a live peer owns the station and its records arrive. Before
+// the first record the grace period runs from boot.
+bool IsStationFetchedByPeer(int stationIndex)
+{
+  const Station &station = stations[stationIndex];
+  unsigned long peerRecordTimeout = 2UL * numStations * timeBetweenApiCalls;
+
+  return peerSharing && !peers.owns(station.id.c_str()) && millis() - station.sharedMillis < peerRecordTimeout;
+}
+
+// Sends the stored record of a station fetched here, a hello when there is none.
+void ShareStation(int stationIndex)
+{
+  const Station &station = stations[stationIndex];
+  String stationJson;
+  DynamicJsonDocument doc(2048);
+  LocationRecord record;
+
+  if (!GetJsonFromSDCard("stations/" + station.id, &stationJson) || deserializeJson(doc, stationJson) || !record.decode(doc.as<JsonVariantConst>()))
+  {
+    peers.hello();
+    return;
+  }
+  peers.share(station.id.c_str(), record, station.fetchEpoch);
+}
+
+// Stores a station record fetched by a peer when it was fetched later
+// than the stored data and its version differs.
+void ApplyPeerRecord(const PeerRecord &shared)
+{
+  int stationIndex = -1;
+
+  for (int i = 0; i < numStations && stationIndex < 0; i++)
+  {
+    if (stations[i].id == shared.stationId)
+    {
+      stationIndex = i;
+    }
+  }
+
+  // Direct USGS data is not replaced by API records.
+  if (stationIndex < 0 || shared.fetchEpoch == 0 || (usgsDirect && IsUsgsStation(stationIndex)))
+  {
+    return;
+  }
+
+  Station &station = stations[stationIndex];
+  station.sharedMillis = millis();
+
+  if (shared.fetchEpoch <= station.fetchEpoch)
+  {
+    return;
+  }
+  station.fetchEpoch = shared.fetchEpoch;
+
+  if (station.version == shared.record.version)
+  {
+    return;
+  }
+
+  DynamicJsonDocument doc(2048);
+  String payload;
+  shared.record.encode(doc);
+  serializeJsonPretty(doc, payload);
+
+  if (!SaveJsonToSDCard("stations/" + station.id, payload))
+  {
+    station.version = "";
+    return;
+  }
+
+  station.version = shared.record.version;
+  LOG_I("Station %s version %s from peer %08x.", station.id.c_str(), station.version.c_str(), (unsigned int)shared.deviceId);
+
+  ComposeStationLocations(stationIndex);
+}
+
+// Handles all button events queued since the last call, long press is
+// measured from the event timestamps.
+void CheckButtons()
+{
+  static uint32_t selectPressTime;
+  static bool selectLongPressHandled = true;
+
+  buttons.poll();
+
+  ButtonEvent event;
+  while (buttons.read(event))
+  {
+    if (!event.pressed)
+    {
+      // Long press released before the loop saw it held.
+      if (event.button == ButtonSelect && !selectLongPressHandled)
+      {
+        if (event.time - selectPressTime >= buttonLongPress)
+        {
+          displayScreen = screenDiagnostics;
+        }
+        selectLongPressHandled = true;
+      }
+      continue;
+    }
+
+    if (event.button == ButtonLeft)
+    {
+      if (selectedLoctionIndex == 0)
+      {
+        selectedLoctionIndex = numLocations - 1;
+      }
+      else
+      {
+        selectedLoctionIndex--;
+      }
+    }
+
+    if (event.button == ButtonSelect)
+    {
+      selectPressTime = event.time;
+      selectLongPressHandled = false;
+
+      if (displayScreen == screenDiagnostics)
+      {
+        displayScreen = screenFlightLog;
+      }
+      else if (++displayScreen > numDisplayScreens - 1)
+      {
+        displayScreen = 0;
+      }
+    }
+
+    if (event.button == ButtonRight)
+    {
+      if (++selectedLoctionIndex > numLocations - 1)
+      {
+        selectedLoctionIndex = 0;
+      }
+    }
+  }
+
+  // Select still held.
+  if (!selectLongPressHandled && buttons.isPressed(ButtonSelect) && millis() - selectPressTime >= buttonLongPress)
+  {
+    displayScreen = screenDiagnostics;
+    selectLongPressHandled = true;
+  }
+
+  // Illuminate buttons when pressed.
+  digitalWrite(PIN_INDICATOR_LEFT, buttons.isPressed(ButtonLeft));
+  digitalWrite(PIN_INDICATOR_SELECT, buttons.isPressed(ButtonSelect));
+  digitalWrite(PIN_INDICATOR_RIGHT, buttons.isPressed(ButtonRight));
+}
+
+int FindWifiCredentials(String ssid)
+{
+  for (int i = 0; i < numWifiCredentials; i++)
+  {
+    if (wifiCredentials[i].ssid == ssid)
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void LoadWifiCache()
+{
+  preferences.begin("wifi", true);
+  wifiCache.ssid = preferences.getString("ssid", "");
+  wifiCache.channel = preferences.getInt("channel", 0);
+  if (preferences.getBytes("bssid", wifiCache.bssid, 6) != 6)
+  {
+    wifiCache.ssid = "";
+  }
+  preferences.end();
+}
+
+void SaveWifiCache(String ssid, const uint8_t *bssid, int32_t channel)
+{
+  if (wifiCache.ssid == ssid && wifiCache.channel == channel && memcmp(wifiCache.bssid, bssid, 6) == 0)
+  {
+    return;
+  }
+
+  wifiCache.ssid = ssid;
+  wifiCache.channel = channel;
+  memcpy(wifiCache.bssid, bssid, 6);
+
+  preferences.begin("wifi", false);
+  preferences.putString("ssid", ssid);
+  preferences.putInt("channel", channel);
+  preferences.putBytes("bssid", bssid, 6);
+  preferences.end();
+}
+
+void SetWifiState(WifiState state)
+{
+  wifiState = state;
+  wifiStateMillis = millis();
+  wifiAttemptStarted = false;
+
+  if (state == WifiState::Connected && peerSharing)
+  {
+    JoinPeerGroup();
+  }
+}
+
+// Ranks known networks found by the scan by signal strength.
+void RankWifiCandidates(int numNetworks)
+{
+  numWifiCandidates = 0;
+
+  for (int n = 0; n < numNetworks; n++)
+  {
+    int credentialsIndex = FindWifiCredentials(WiFi.SSID(n));
+    if (credentialsIndex < 0)
+    {
+      continue;
+    }
+
+    // Keep only the strongest access point per SSID.
+    int c;
+    for (c = 0; c < numWifiCandidates; c++)
+    {
+      if (wifiCandidates[c].credentialsIndex == credentialsIndex)
+      {
+        break;
+      }
+    }
+
+    if (c == numWifiCandidates)
+    {
+      numWifiCandidates++;
+    }
+    else if (WiFi.RSSI(n) <= wifiCandidates[c].rssi)
+    {
+      continue;
+    }
+
+    wifiCandidates[c].credentialsIndex = credentialsIndex;
+    wifiCandidates[c].rssi = WiFi.RSSI(n);
+    wifiCandidates[c].channel = WiFi.channel(n);
+    memcpy(wifiCandidates[c].bssid, WiFi.BSSID(n), 6);
+  }
+
+  WiFi.scanDelete();
+
+  std::sort(wifiCandidates, wifiCandidates + numWifiCandidates, [](const WifiCandidate &a, const WifiCandidate &b) { return a.rssi > b.rssi; });
+
+  for (int c = 0; c < numWifiCandidates; c++)
+  {
+    LOG_I("WiFi candidate: %s, RSSI: %d, channel: %d", wifiCredentials[wifiCandidates[c].credentialsIndex].ssid.c_str(), wifiCandidates[c].rssi, wifiCandidates[c].channel);
+  }
+}
+
+// Connects to WiFi in the background and reconnects when the connection drops.
+// Reconnects go straight to the cached access point and channel, a scan
+// ranking known networks by signal strength is only run when that fails.
+void ServiceWifi()
+{
+  unsigned long elapsed = millis() - wifiStateMillis;
+
+  switch (wifiState)
+  {
+  case WifiState::FastConnect:
+  {
+    int credentialsIndex = FindWifiCredentials(wifiCache.ssid);
+
+    if (credentialsIndex < 0)
+    {
+      SetWifiState(WifiState::Scanning);
+      break;
+    }
+
+    if (!wifiAttemptStarted)
+    {
+      LOG_I("Connecting to cached SSID: %s, channel: %d", wifiCache.ssid.c_str(), wifiCache.channel);
+      WiFi.begin(wifiCredentials[credentialsIndex].ssid.c_str(), wifiCredentials[credentialsIndex].password.c_str(), wifiCache.channel, wifiCache.bssid);
+      wifiAttemptStarted = true;
+    }
+    else if (WiFi.status() == WL_CONNECTED)
+    {
+      SetWifiState(WifiState::Connected);
+      LOG_I("WiFi connected in %lums, IP address: %s", elapsed, WiFi.localIP().toString().c_str());
+    }
+    else if (elapsed > wifiFastConnectTimeout)
+    {
+      WiFi.disconnect();
+      SetWifiState(WifiState::Scanning);
+    }
+    break;
+  }
+
+  case WifiState::Scanning:
+  {
+    if (!wifiAttemptStarted)
+    {
+      LOG_I("Scanning for WiFi networks...");
+      WiFi.scanNetworks(true);
+      wifiAttemptStarted = true;
+      break;
+    }
+
+    int16_t result = WiFi.scanComplete();
+
+    if (result == WIFI_SCAN_RUNNING)
+    {
+      break;
+    }
+
+    if (result >= 0)
+    {
+      RankWifiCandidates(result);
+    }
+    else
+    {
+      numWifiCandidates = 0;
+    }
+
+    wifiCandidateIndex = 0;
+    SetWifiState(numWifiCandidates > 0 ? WifiState::Connecting : WifiState::Backoff);
+    break;
+  }
+
+  case WifiState::Connecting:
+  {
+    WifiCandidate &candidate = wifiCandidates[wifiCandidateIndex];
+    WifiCredentials &credentials = wifiCredentials[candidate.credentialsIndex];
+
+    if (!wifiAttemptStarted)
+    {
+      LOG_I("Connecting to SSID: %s", credentials.ssid.c_str());
+      WiFi.begin(credentials.ssid.c_str(), credentials.password.c_str(), candidate.channel, candidate.bssid);
+      wifiAttemptStarted = true;
+    }
+    else if (WiFi.status() == WL_CONNECTED)
+    {
+      SaveWifiCache(credentials.ssid, candidate.bssid, candidate.channel);
+      SetWifiState(WifiState::Connected);
+      LOG_I("WiFi connected, IP address: %s", WiFi.localIP().toString().c_str());
+    }
+    else if (elapsed > wifiConnectTimeout)
+    {
+      WiFi.disconnect();
+
+      if (++wifiCandidateIndex < numWifiCandidates)
+      {
+        SetWifiState(WifiState::Connecting);
+      }
+      else
+      {
+        SetWifiState(WifiState::Backoff);
+      }
+    }
+    break;
+  }
+
+  case WifiState::Connected:
+    if (WiFi.status() != WL_CONNECTED)
+    {
+      LOG_W("WiFi connection lost, reconnecting.");
+      recorder.event(EventWifiLost);
+      wifiBackoff = 1000;
+      SetWifiState(WifiState::FastConnect);
+    }
+    break;
+
+  case WifiState::Backoff:
+    if (elapsed > wifiBackoff)
+    {
+      wifiBackoff = min(wifiBackoff * 2, wifiMaxBackoff);
+      SetWifiState(WifiState::FastConnect);
+    }
+    break;
+
+  case WifiState::Off:
+    if ((long)(millis() - wifiResumeMillis) >= 0)
+    {
+      WiFi.mode(WIFI_STA);
+      SetWifiState(WifiState::FastConnect);
+    }
+    break;
+  }
+}
+
+// Applies a changed wifi.txt. Brightness applies at once and a new time
+// zone with a time request. WiFi reconnects only when the network in use
+// is no longer listed or its password changed, or, while not connected,
+// to try the new credentials.
+void ReloadParameters()
+{
+  std::vector<WifiCredentials> previousCredentials(wifiCredentials, wifiCredentials + numWifiCredentials);
+  String previousTimeZone = timeZone;
+  int previousIndicatorBrightness = indicatorBrightness;
+  int previousSignBrightness = signBrightness;
+  bool previousPeerSharing = peerSharing;
+
+  if (!GetParametersFromSDCard())
+  {
+    LOG_E("Keeping the parameters in use.");
+    return;
+  }
+
+  if (indicatorBrightness != previousIndicatorBrightness)
+  {
+    LOG_I("Indicator brightness: %d.", indicatorBrightness);
+    FastLED.setBrightness(indicatorBrightness);
+    FastLED.show();
+  }
+
+  if (signBrightness != previousSignBrightness)
+  {
+    LOG_I("Sign brightness: %d.", signBrightness);
+    ledcWrite(indicatorSignChannel, signBrightness);
+  }
+
+  if (timeZone != previousTimeZone)
+  {
+    LOG_I("Time zone: %s.", timeZone.c_str());
+    timerTime.ForceTrigger();
+  }
+
+  power.allowLightSleep(powerSave);
+
+  if (peerSharing && !previousPeerSharing && wifiState == WifiState::Connected)
+  {
+    JoinPeerGroup();
+  }
+
+  bool credentialsChanged = numWifiCredentials != (int)previousCredentials.size();
+  for (int i = 0; i < numWifiCredentials && !credentialsChanged; i++)
+  {
+    credentialsChanged = wifiCredentials[i].ssid != previousCredentials[i].ssid || wifiCredentials[i].password != previousCredentials[i].password;
+  }
+
+  if (!credentialsChanged)
+  {
+    return;
+  }
+
+  if (wifiState == WifiState::Connected)
+  {
+    String ssid = WiFi.SSID();
+    int current = FindWifiCredentials(ssid);
+
+    for (const WifiCredentials &previous : previousCredentials)
+    {
+      if (current >= 0 && previous.ssid == ssid && previous.password == wifiCredentials[current].password)
+      {
+        return;
+      }
+    }
+    LOG_I("Credentials of %s changed, reconnecting.", ssid.c_str());
+  }
+  else if (wifiState == WifiState::Scanning || wifiState == WifiState::Off)
+  {
+    // Scan results are ranked with the new credentials.
+    return;
   }
   else
   {
-    DynamicJsonDocument doc(2048);
-    DeserializationError error = deserializeJson(doc, file.readString());
+    LOG_I("WiFi credentials changed, reconnecting.");
+  }
+
+  WiFi.disconnect();
+  wifiBackoff = 1000;
+  SetWifiState(WifiState::FastConnect);
+}
+
+// Applies a changed locations.json. Locations are matched to the ones in
+// use by their station IDs: matched locations keep their measurements,
+// status, stored data and history, also when their index changed, only
+// added locations start empty. LED strip changes apply after a restart.
+void ReloadLocations()
+{
+  String errorMessage;
+  std::vector<Strip> previousStrips = strips;
+  int previousLegendLed = legendLed;
+  int previousNumLEDs = numLEDs;
+  int previousNumLocations = numLocations;
+  int previousNumStations = numStations;
+  int previousSelected = selectedLoctionIndex;
+  String apiStationId = stations[apiStationIndex].id;
+
+  std::vector<Location> previousLocations;
+  std::vector<Station> previousStations;
+  std::vector<uint16_t> previousStationIndexes;
+  std::vector<char *> previousNames;
+
+  // The status server walks the tables being replaced.
+  statusServer.hold();
+  FlushHistory();
+
+  previousLocations.swap(locations);
+  previousStations.swap(stations);
+  previousStationIndexes.swap(locationStationIndexes);
+  previousNames.swap(locationNames);
+
+  bool loaded = LoadLocationTables(&errorMessage);
+  bool sameStrips = loaded && legendLed == previousLegendLed && strips.size() == previousStrips.size();
+
+  for (size_t i = 0; sameStrips && i < strips.size(); i++)
+  {
+    sameStrips = strips[i].pin == previousStrips[i].pin && strips[i].count == previousStrips[i].count;
+  }
+
+  if (!sameStrips)
+  {
+    if (loaded)
+    {
+      LOG_W("LED strips in %s changed, restart to apply.", locationsFilePath);
+    }
+    else
+    {
+      LOG_E("Keeping the locations in use. %s", errorMessage.c_str());
+    }
+
+    ClearLocations();
+    locations.swap(previousLocations);
+    stations.swap(previousStations);
+    locationStationIndexes.swap(previousStationIndexes);
+    locationNames.swap(previousNames);
+    numLocations = previousNumLocations;
+    numStations = previousNumStations;
+    strips = previousStrips;
+    legendLed = previousLegendLed;
+    numLEDs = previousNumLEDs;
+    statusServer.release();
+    return;
+  }
+
+  // Fetch state of stations still in use.
+  for (Station &station : stations)
+  {
+    for (const Station &previous : previousStations)
+    {
+      if (previous.id == station.id)
+      {
+        station = previous;
+        break;
+      }
+    }
+  }
+
+  // Index of the previous location with the same stations, -1 when added.
+  std::vector<int> previousIndex(numLocations, -1);
+  std::vector<bool> matched(previousNumLocations, false);
+  int kept = 0;
+  int moved = 0;
+
+  for (int i = 0; i < numLocations; i++)
+  {
+    for (int j = 0; j < previousNumLocations && previousIndex[i] < 0; j++)
+    {
+      bool same = !matched[j] && previousLocations[j].numStationIds == locations[i].numStationIds;
+
+      for (int s = 0; same && s < locations[i].numStationIds; s++)
+      {
+        same = previousStations[previousStationIndexes[previousLocations[j].firstStationId + s]].id == stations[LocationStationIndex(i, s)].id;
+      }
+
+      if (same)
+      {
+        previousIndex[i] = j;
+        matched[j] = true;
+      }
+    }
+
+    int j = previousIndex[i];
+    if (j < 0)
+    {
+      continue;
+    }
+
+    Location &location = locations[i];
+    const Location &previous = previousLocations[j];
+    memcpy(location.measurements, previous.measurements, sizeof(location.measurements));
+    location.reportedSafety = previous.reportedSafety;
+    location.safety = previous.safety;
+    location.recordTime = previous.recordTime;
+    kept += j == i;
+    moved += j != i;
+  }
+
+  // Stored data and history follow moved locations, the history of
+  // removed locations is deleted.
+  std::vector<String> movedData(numLocations);
+
+  for (int i = 0; i < numLocations; i++)
+  {
+    if (previousIndex[i] >= 0 && previousIndex[i] != i)
+    {
+      GetJsonFromSDCard("locations/" + String(previousIndex[i]), &movedData[i]);
+      SD.rename("/history/" + String(previousIndex[i]) + ".bin", "/history/" + String(previousIndex[i]) + ".moved");
+    }
+  }
+
+  for (int j = 0; j < previousNumLocations; j++)
+  {
+    if (!matched[j])
+    {
+      SD.remove("/history/" + String(j) + ".bin");
+    }
+  }
+
+  for (int i = 0; i < numLocations; i++)
+  {
+    if (previousIndex[i] >= 0 && previousIndex[i] != i)
+    {
+      SD.rename("/history/" + String(previousIndex[i]) + ".moved", "/history/" + String(i) + ".bin");
+    }
+  }
+
+  history.clear();
+  history.resize(numLocations);
+  for (int i = 0; i < numLocations; i++)
+  {
+    history[i].begin(SD, "/history/" + String(i) + ".bin", historyCapacity);
+  }
+
+  for (int i = 0; i < numLocations; i++)
+  {
+    String path = "/locations/" + String(i) + ".json";
 
-    if (error)
+    if (previousIndex[i] >= 0 && previousIndex[i] != i)
     {
-      Serial.print(F("DeserializeJson() failed: "));
-      Serial.println(error.c_str());
-      return false;
+      if (movedData[i].isEmpty())
+      {
+        store.remove(path);
+      }
+      else
+      {
+        store.write(path, movedData[i]);
+      }
     }
-
-    numWifiCredentials = doc["wifiCredentials"].size();
-
-    for (int i = 0; i < numWifiCredentials; i++)
+    else if (previousIndex[i] < 0 && !ComposeLocationData(i))
     {
-      wifiCredentials[i].ssid = doc["wifiCredentials"][i]["ssid"].as<String>();
-      wifiCredentials[i].password = doc["wifiCredentials"][i]["password"].as<String>();
-
-      Serial.println(wifiCredentials[i].ssid);
-      Serial.println(wifiCredentials[i].password);
+      // Data of the location stored before at this index.
+      store.remove(path);
     }
+  }
 
-    timeZone = doc["timeZone"].as<String>();
-
-    int indicatorBrightnessParameter = doc["indicatorBrightness"].as<int>();
-    int signBrightnessParameter = doc["signBrightness"].as<int>();
+  for (int j = numLocations; j < previousNumLocations; j++)
+  {
+    store.remove("/locations/" + String(j) + ".json");
+  }
 
-    if (indicatorBrightnessParameter > 9 && indicatorBrightnessParameter < 256)
+  selectedLoctionIndex = 0;
+  for (int i = 0; i < numLocations; i++)
+  {
+    if (previousIndex[i] == previousSelected)
     {
-      indicatorBrightness = indicatorBrightnessParameter;
+      selectedLoctionIndex = i;
     }
+  }
 
-    if (signBrightnessParameter > 25 && signBrightnessParameter < 256)
+  apiStationIndex = 0;
+  for (int s = 0; s < numStations; s++)
+  {
+    if (stations[s].id == apiStationId)
     {
-      signBrightness = signBrightnessParameter;
+      apiStationIndex = s;
     }
   }
-  file.close();
-  return true;
-}
 
-void DisplayLayout()
-{
-  int w = tft.width() - 1;
-  int h = tft.height() - 1;
-  int t = 5;
+  // Rules are compiled per location.
+  if (!InitRulesFromSDCard(&errorMessage))
+  {
+    LOG_E("Showing the location status reported by the API. %s", errorMessage.c_str());
+    safetyRules.clear();
+  }
+  locationsNeedScoring = true;
 
-  tft.fillScreen(TFT_BLACK);
+  // LEDs of removed locations go dark.
+  std::fill(leds.begin(), leds.end(), CRGB::Black);
 
-  // Perimeter
-  tft.fillRect(0, 0, w, t, TFT_BLUE);
-  tft.fillRect(w - t, 0, w, h, TFT_BLUE);
-  tft.fillRect(0, h - t, tft.width(), 5, TFT_BLUE);
-  tft.fillRect(0, 0, 0 + t, h, TFT_BLUE);
+  if (numLocations != previousNumLocations)
+  {
+    overview.begin(textIndent, overviewY, overviewWidth, overviewHeight, overviewColumns, numLocations);
+  }
+  overview.invalidate();
+  trendLocationIndex = -1;
 
-  // Lines across.
-  tft.fillRect(0, 73, tft.width(), 5, TFT_BLUE);
-  tft.fillRect(0, 280, tft.width(), 5, TFT_BLUE);
+  for (char *name : previousNames)
+  {
+    free(name);
+  }
+  statusServer.release();
 
-  tft.setTextSize(2);
-  tft.setCursor(textIndent, textStatusY);
-  tft.setTextColor(TFT_WHITE);
-  tft.print("System Status:");
+  LOG_I("Locations reloaded: %d kept, %d moved, %d added, %d removed.", kept, moved, numLocations - kept - moved, previousNumLocations - kept - moved);
+  UpdateDisplay();
 }
 
-void DisplayIndicator(String string, int x, int y, uint16_t color)
+// Applies a changed rules.json.
+void ReloadRules()
 {
-  int16_t x1, y1;
-  uint16_t w, h;
-  const int offset = 2;
-  tft.setTextSize(2);
-  tft.setCursor(x, y);
+  String errorMessage;
 
-  getTextBounds(string.c_str(), x, y, &x1, &y1, &w, &h);
-  tft.fillRect(x - offset, y - offset, w + offset, h + offset, color);
-  tft.setTextPadding(5);
-  tft.setTextColor(TFT_BLACK, color);
-  tft.print(string);
+  if (!InitRulesFromSDCard(&errorMessage))
+  {
+    LOG_E("Keeping the safety rules in use. %s", errorMessage.c_str());
+  }
 }
 
-void UpdateIndicators()
+// Reloads the configuration files changed on the SD card.
+void CheckConfigFiles()
 {
-  static int oldStatusSum = 99;
-  int statusSum = (int)sdStatus + (int)wifiStatus + (int)dataApiStatus + (int)timeApiStatus;
-
-  if (oldStatusSum != statusSum)
+  for (int changed; (changed = configWatch.check()) >= 0;)
   {
-    oldStatusSum = statusSum;
-    DisplayIndicator("SD", 200, textStatusY, sdStatus ? TFT_GREEN : TFT_RED);
-    DisplayIndicator("WIFI", 252, textStatusY, wifiStatus ? TFT_GREEN : TFT_RED);
-    DisplayIndicator("TIME", 329, textStatusY, timeApiStatus ? TFT_GREEN : TFT_RED);
-    DisplayIndicator("API", 407, textStatusY, dataApiStatus ? TFT_GREEN : TFT_RED);
+    const char *path = configWatch.path(changed);
+
+    LOG_I("%s changed, reloading.", path);
+    store.invalidate(path);
+
+    if (!strcmp(path, wifiFilePath))
+    {
+      ReloadParameters();
+    }
+    else if (!strcmp(path, locationsFilePath))
+    {
+      ReloadLocations();
+    }
+    else
+    {
+      ReloadRules();
+    }
   }
 }
 
-bool UpdateTime()
+// GET /status: location statuses and data ages as JSON.
+void ServeStatus(Print &out)
 {
-  String payload;
-  // String host = "http://worldclockapi.com/api/json/" + timeZone + "/now"; // currentDateTime
-  String host = "http://worldtimeapi.org/api/timezone/" + timeZone;
-
-  Serial.print("Connecting to ");
-  Serial.println(host);
+  unsigned long now = CurrentEpoch();
 
-  HTTPClient http;
-  http.begin(host);
-  int httpCode = http.GET();
+  out.printf("{\"time\":%lu,\"uptime\":%lu,\"selected\":%d,\"locations\":[", now, millis() / 1000, selectedLoctionIndex);
 
-  if (httpCode > 0)
-  {
-    Serial.print("HTTP code: ");
-    Serial.println(httpCode);
-    Serial.println("[RESPONSE]");
-    payload = http.getString();
-    Serial.println(payload);
-    http.end();
-  }
-  else
+  for (int i = 0; i < numLocations; i++)
   {
-    Serial.print("Connection failed, HTTP client code: ");
-    Serial.println(httpCode);
-    http.end();
-    return false;
-  }
-
-  DynamicJsonDocument doc(2048);
-  DeserializationError error = deserializeJson(doc, payload);
+    const Location &location = locations[i];
 
-  if (error)
-  {
-    Serial.print(F("DeserializeJson() failed: "));
-    Serial.println(error.c_str());
-    return false;
-  }
+    out.print(i > 0 ? ",{\"name\":" : "{\"name\":");
+    StatusServer::printJson(out, location.shortName);
+    out.print(",\"area\":");
+    StatusServer::printJson(out, location.area);
+    out.printf(",\"status\":\"%s\",\"reported\":\"%s\",\"age\":", safetyNames[location.safety], safetyNames[location.reportedSafety]);
 
-  currentTime = doc["datetime"].as<String>();
-  Serial.printf("Current time: %s\n", currentTime.c_str());
+    if (now > 0 && location.recordTime > 0)
+    {
+      out.printf("%lu", now > location.recordTime ? now - location.recordTime : 0);
+    }
+    else
+    {
+      out.print("null");
+    }
 
-  return true;
+    for (int m = 0; m < numMeasurements; m++)
+    {
+      out.printf(m == 0 ? ",\"measurements\":{\"%s\":" : ",\"%s\":", measurementNames[m]);
+      if (isnan(location.measurements[m]))
+      {
+        out.print("null");
+      }
+      else
+      {
+        out.printf("%g", location.measurements[m]);
+      }
+    }
+    out.print("}}");
+  }
+  out.print("]}\n");
 }
 
-bool GetDataFromAPI(int loctionIndex)
+void PrintMetricHeader(Print &out, const char *name, const char *type, const char *help)
 {
-  String payload;
-  String host = "http://artofmystate.com/api/riverconditions.php?stationId=" + locations[loctionIndex].stationIds[0];
+  out.printf("# HELP riverconditions_%s %s\n# TYPE riverconditions_%s %s\n", name, help, name, type);
+}
 
-  // Add remaining stations to query URL.
-  for (int i = 1; i < maxStationIds; i++)
+void PrintMetricLabel(Print &out, const char *text)
+{
+  for (const char *c = text; *c != '\0'; c++)
   {
-    if (!locations[loctionIndex].stationIds[i].isEmpty())
+    if (*c == '"' || *c == '\\')
     {
-      host += "," + locations[loctionIndex].stationIds[i];
+      out.print('\\');
     }
+    out.print(*c);
   }
+}
 
-  Serial.print("Connecting to ");
-  Serial.println(host);
+// GET /metrics: Prometheus text format.
+void ServeMetrics(Print &out)
+{
+  const char *apiNames[] = {"data", "time", "usgs"};
+  HttpSession *apiSessions[] = {&dataApiSession, &timeApiSession, &usgsApiSession};
+  uint32_t apiFailures[] = {dataApiFailures, timeApiFailures, usgsApiFailures};
+  const int numApis = 3;
 
-  HTTPClient http;
-  http.begin(host);
-  int httpCode = http.GET();
+  PrintMetricHeader(out, "uptime_seconds", "gauge", "Time since boot.");
+  out.printf("riverconditions_uptime_seconds %lu\n", millis() / 1000);
 
-  if (httpCode > 0)
+  PrintMetricHeader(out, "fetch_requests_total", "counter", "API requests.");
+  for (int i = 0; i < numApis; i++)
   {
-    Serial.print("HTTP code: ");
-    Serial.println(httpCode);
-    Serial.println("[RESPONSE]");
-    payload = http.getString();
-    Serial.println(payload);
-    http.end();
+    out.printf("riverconditions_fetch_requests_total{api=\"%s\"} %u\n", apiNames[i], (unsigned int)apiSessions[i]->requests());
   }
-  else
+  PrintMetricHeader(out, "fetch_failures_total", "counter", "API fetches that failed.");
+  for (int i = 0; i < numApis; i++)
   {
-    Serial.print("Connection failed, HTTP client code: ");
-    Serial.println(httpCode);
-    dataApiErrorDate = currentTime;
-    dataApiErrorMessage = httpCode;
-    http.end();
-    return false;
+    out.printf("riverconditions_fetch_failures_total{api=\"%s\"} %u\n", apiNames[i], (unsigned int)apiFailures[i]);
   }
-
-  DynamicJsonDocument doc(2048);
-  DeserializationError jsonError = deserializeJson(doc, payload);
-
-  if (jsonError)
+  PrintMetricHeader(out, "fetch_connections_total", "counter", "TCP connections opened to the API hosts.");
+  for (int i = 0; i < numApis; i++)
   {
-    Serial.print(F("DeserializeJson() failed: "));
-    Serial.println(jsonError.c_str());
-    dataApiErrorDate = currentTime;
-    dataApiErrorMessage = jsonError.c_str();
-    return false;
+    out.printf("riverconditions_fetch_connections_total{api=\"%s\"} %u\n", apiNames[i], (unsigned int)apiSessions[i]->connects());
   }
-
-  if (doc["error"].as<bool>() == true)
+  PrintMetricHeader(out, "fetch_last_seconds", "gauge", "Duration of the last API request.");
+  for (int i = 0; i < numApis; i++)
   {
-    dataApiErrorDate = doc["date"].as<String>();
-    dataApiErrorMessage = doc["message"].as<String>();
-    return false;
+    out.printf("riverconditions_fetch_last_seconds{api=\"%s\"} %.3f\n", apiNames[i], apiSessions[i]->lastMillis() / 1000.0);
   }
-
-  SaveDataToSDCard(loctionIndex, payload);
-
-  return true;
-}
-
-void CheckButtons()
-{
-
-  // Illuminate buttons when pressed.
-  digitalWrite(PIN_INDICATOR_LEFT, buttonLeft.isPressed());
-  digitalWrite(PIN_INDICATOR_SELECT, buttonSelect.isPressed());
-  digitalWrite(PIN_INDICATOR_RIGHT, buttonRight.isPressed());
-
-  buttonLeft.read();
-  buttonSelect.read();
-  buttonRight.read();
-
-  if (buttonLeft.wasPressed())
+  PrintMetricHeader(out, "fetch_average_seconds", "gauge", "Average duration of the API requests.");
+  for (int i = 0; i < numApis; i++)
   {
-    if (selectedLoctionIndex == 0)
-    {
-      selectedLoctionIndex = numLocations - 1;
-    }
-    else
-    {
-      selectedLoctionIndex--;
-    }
+    out.printf("riverconditions_fetch_average_seconds{api=\"%s\"} %.3f\n", apiNames[i], apiSessions[i]->averageMillis() / 1000.0);
   }
 
-  if (buttonSelect.wasPressed())
+  PrintMetricHeader(out, "heap_free_bytes", "gauge", "Free heap.");
+  out.printf("riverconditions_heap_free_bytes %u\n", (unsigned int)ESP.getFreeHeap());
+  PrintMetricHeader(out, "heap_min_free_bytes", "gauge", "Lowest free heap since boot.");
+  out.printf("riverconditions_heap_min_free_bytes %u\n", (unsigned int)ESP.getMinFreeHeap());
+  PrintMetricHeader(out, "heap_max_alloc_bytes", "gauge", "Largest allocatable heap block.");
+  out.printf("riverconditions_heap_max_alloc_bytes %u\n", (unsigned int)ESP.getMaxAllocHeap());
+
+  PrintMetricHeader(out, "sd_card_up", "gauge", "SD card mounted.");
+  out.printf("riverconditions_sd_card_up %d\n", sdStatus ? 1 : 0);
+  PrintMetricHeader(out, "store_reads_total", "counter", "Mirrored file reads by tier.");
+  out.printf("riverconditions_store_reads_total{tier=\"flash\"} %u\n", (unsigned int)store.fastReads());
+  out.printf("riverconditions_store_reads_total{tier=\"sd\"} %u\n", (unsigned int)store.bulkReads());
+  PrintMetricHeader(out, "store_flash_writes_total", "counter", "Files written to flash.");
+  out.printf("riverconditions_store_flash_writes_total %u\n", (unsigned int)store.fastWrites());
+  PrintMetricHeader(out, "store_saved_writes_total", "counter", "Flash writes avoided.");
+  out.printf("riverconditions_store_saved_writes_total %u\n", (unsigned int)store.savedWrites());
+  PrintMetricHeader(out, "sd_write_errors_total", "counter", "SD card writes that failed.");
+  out.printf("riverconditions_sd_write_errors_total %u\n", (unsigned int)store.bulkErrors());
+
+  PrintMetricHeader(out, "wifi_connected", "gauge", "WiFi connected.");
+  out.printf("riverconditions_wifi_connected %d\n", wifiState == WifiState::Connected ? 1 : 0);
+  PrintMetricHeader(out, "power_seconds_total", "counter", "Time per power state.");
+  out.printf("riverconditions_power_seconds_total{state=\"active\"} %.3f\n", power.residency(PowerActive) / 1000.0);
+  out.printf("riverconditions_power_seconds_total{state=\"idle\"} %.3f\n", power.residency(PowerIdle) / 1000.0);
+  out.printf("riverconditions_power_seconds_total{state=\"sleep\"} %.3f\n", power.residency(PowerSleep) / 1000.0);
+  PrintMetricHeader(out, "radio_on_seconds_total", "counter", "Time the radio was on.");
+  out.printf("riverconditions_radio_on_seconds_total %.3f\n", power.radioOnMillis() / 1000.0);
+  PrintMetricHeader(out, "log_dropped_total", "counter", "Log messages dropped.");
+  out.printf("riverconditions_log_dropped_total %u\n", (unsigned int)logger.dropped());
+  PrintMetricHeader(out, "boots_total", "counter", "Boots since power on.");
+  out.printf("riverconditions_boots_total %u\n", (unsigned int)recorder.boots());
+  PrintMetricHeader(out, "loop_stalls_total", "counter", "loop() stages running past the stall threshold.");
+  out.printf("riverconditions_loop_stalls_total %u\n", (unsigned int)recorder.stalls());
+  PrintMetricHeader(out, "http_requests_total", "counter", "Requests to this endpoint.");
+  out.printf("riverconditions_http_requests_total %u\n", (unsigned int)statusServer.requests());
+
+  if (peerSharing)
   {
-    if (++displayScreen > numDisplayScreens - 1)
-    {
-      displayScreen = 0;
-    }
+    PrintMetricHeader(out, "peers", "gauge", "Dashboards heard on the LAN.");
+    out.printf("riverconditions_peers %d\n", peers.livePeers());
+    PrintMetricHeader(out, "peer_packets_total", "counter", "Peer packets: records and hellos sent, records received, packets rejected as invalid.");
+    out.printf("riverconditions_peer_packets_total{direction=\"sent\"} %u\n", (unsigned int)peers.sent());
+    out.printf("riverconditions_peer_packets_total{direction=\"received\"} %u\n", (unsigned int)peers.received());
+    out.printf("riverconditions_peer_packets_total{direction=\"rejected\"} %u\n", (unsigned int)peers.rejected());
   }
 
-  if (buttonSelect.pressedFor(3000))
+  unsigned long now = CurrentEpoch();
+  PrintMetricHeader(out, "location_status", "gauge", "Status shown: 0 N.A., 1 Fair, 2 Caution, 3 Danger.");
+  for (int i = 0; i < numLocations; i++)
   {
-    displayScreen = 2;
+    out.print("riverconditions_location_status{location=\"");
+    PrintMetricLabel(out, locations[i].shortName);
+    out.print("\",area=\"");
+    PrintMetricLabel(out, locations[i].area);
+    out.printf("\"} %u\n", locations[i].safety);
   }
-
-  if (buttonRight.wasPressed())
+  PrintMetricHeader(out, "location_data_age_seconds", "gauge", "Age of the latest data, locations with data only.");
+  for (int i = 0; i < numLocations; i++)
   {
-    if (++selectedLoctionIndex > numLocations - 1)
+    if (now == 0 || locations[i].recordTime == 0)
     {
-      selectedLoctionIndex = 0;
+      continue;
     }
+    out.print("riverconditions_location_data_age_seconds{location=\"");
+    PrintMetricLabel(out, locations[i].shortName);
+    out.print("\",area=\"");
+    PrintMetricLabel(out, locations[i].area);
+    out.printf("\"} %lu\n", now > locations[i].recordTime ? now - locations[i].recordTime : 0);
   }
 }
 
-bool ConnectWifi()
+// GET /flightlog: flight recorder records, oldest first.
+void ServeFlightLog(Print &out)
 {
-  int wifiCredentialsIndex = 0;
+  recorder.print(out, flightEventNames, numFlightEvents);
+}
 
-  while (1)
+// Appends the flight recorder to SD card after a reset that kept it.
+void DumpFlightLog()
+{
+  if (!recorder.recovered())
   {
-    tft.fillScreen(TFT_BLACK);
-    tft.setCursor(0, 0);
-    tft.setTextSize(2);
-    tft.setTextColor(TFT_GREEN);
-    tft.printf("Connecting to WiFi\n");
-    tft.printf("SSID: %s\n", wifiCredentials[wifiCredentialsIndex].ssid.c_str());
-    tft.printf("Password: %s\n", wifiCredentials[wifiCredentialsIndex].password.c_str());
-
-    Serial.printf("Connecting to SSID: %s, with password: %s\n", wifiCredentials[wifiCredentialsIndex].ssid.c_str(), wifiCredentials[wifiCredentialsIndex].password.c_str());
-
-    WiFi.begin(wifiCredentials[wifiCredentialsIndex].ssid.c_str(), wifiCredentials[wifiCredentialsIndex].password.c_str());
-
-    int count = 0;
-    while (count++ < 10)
-    {
-      delay(500);
-      tft.print(".");
-      Serial.print(".");
+    return;
+  }
 
-      if (WiFi.status() == WL_CONNECTED)
-      {
-        return true;
-      }
-    }
+  LOG_W("Restarted after %s reset in stage: %s.", FlightRecorder::resetName(recorder.resetReason()), recorder.stageName(recorder.resetStage()));
 
-    Serial.println("");
+  if (!sdStatus)
+  {
+    return;
+  }
 
-    if (++wifiCredentialsIndex == numWifiCredentials)
-    {
-      // Wifi not connected, attempted all credentials.
-      return false;
-    }
+  // Appended, the records of the boot that ended in the reset onwards.
+  File file = SD.open(flightLogFilePath, FILE_APPEND);
+  if (!file)
+  {
+    LOG_E("Failed to open file for writing: %s", flightLogFilePath);
+    return;
   }
+  recorder.print(file, flightEventNames, numFlightEvents, recorder.boots() - 1);
+  file.close();
+  LOG_I("Flight recorder appended to %s.", flightLogFilePath);
 }
 
 void setup()
 {
+  recorder.begin(loopStageNames, numLoopStages, StageIdle, StageSetup);
+
   Serial.begin(115200);
+  logger.begin(Serial);
 
   delay(10);
-  Serial.println("River Conditions starting up...");
+  LOG_I("River Conditions starting up...");
 
-  FastLED.addLeds<APA106, PIN_STRIP_LOCATIONS>(leds, numLEDs);
-
-  buttonLeft.begin();
-  buttonSelect.begin();
-  buttonRight.begin();
+  buttons.begin(buttonPins, sizeof(buttonPins));
+  power.begin(buttonPins, sizeof(buttonPins));
+  buttons.setWakeTask(power.task());
 
   pinMode(PIN_INDICATOR_LEFT, OUTPUT);
   pinMode(PIN_INDICATOR_SELECT, OUTPUT);
@@ -866,58 +3348,144 @@ void setup()
   tft.setRotation(1);
   delay(25); // Delay required to allow rotation to take effect.
 
-  if (!InitSDCard())
+  sdStatus = InitSDCard();
+  InitStore();
+  DumpFlightLog();
+
+  // Without SD card the device starts from the files cached in flash.
+  if (!GetParametersFromSDCard())
   {
-    FatalError("Unable to init SD card.");
+    FatalError(sdStatus ? "Failed to get parameters from SD card.\n(wifi.txt required)" : "Unable to init SD card.");
   }
-  else
+  power.allowLightSleep(powerSave);
+
+  String locationsError;
+  if (!InitLocationsFromSDCard(&locationsError))
   {
-    sdStatus = true;
+    FatalError("Failed to get location init data.\n" + locationsError);
   }
 
-  if (!GetParametersFromSDCard())
+  String rulesError;
+  if (!InitRulesFromSDCard(&rulesError))
   {
-    FatalError("Failed to get parameters from SD card.\n(wifi.txt required)");
+    FatalError("Failed to get safety rules.\n" + rulesError);
   }
 
-  if (!InitLocationsFromSDCard())
+  configWatch.begin(SD);
+  configWatch.watch(wifiFilePath);
+  configWatch.watch(locationsFilePath);
+  configWatch.watch(rulesFilePath);
+
+  // Show last known state from the boot snapshot, status refresh from
+  // location data on SD card is deferred to the regular interval.
+  if (LoadSnapshotFromSDCard())
   {
-    FatalError("Failed to get location init data.\n(locations.json required)");
+    timerUpdateStatusBuffer.setDelayAndReset(timeBetweenIndicatorUpdate);
   }
 
-  UpdateLocationIndicators();
+  FastLED.setBrightness(indicatorBrightness);
+  ShowLocationIndicators(true);
 
-  const int indicatorSignChannel = 0;
-  ledcSetup(0, 500, 8);
-  ledcAttachPin(PIN_INDICATOR_SIGN, 0);
+  ledcSetup(indicatorSignChannel, 500, 8);
+  ledcAttachPin(PIN_INDICATOR_SIGN, indicatorSignChannel);
   ledcWrite(indicatorSignChannel, signBrightness);
+  power.keepPwm(indicatorSignChannel, 500, 8);
 
-  if (ConnectWifi())
+  if (!trendFlow.begin(trendWidth, trendHeight, TFT_CYAN) || !trendGauge.begin(trendWidth, trendHeight, TFT_CYAN))
   {
-    Serial.println("");
-    Serial.println("WiFi connected");
-    Serial.println("IP address: ");
-    Serial.println(WiFi.localIP());
+    LOG_E("Failed to allocate trend sprites.");
   }
-  else
+  if (!overview.begin(textIndent, overviewY, overviewWidth, overviewHeight, overviewColumns, numLocations))
   {
-    Serial.println("WiFi not connected.");
+    LOG_E("Failed to allocate overview sprites.");
   }
 
   DisplayLayout();
+  UpdateDisplay();
+
+  LOG_I("Time to first frame: %lums.", millis());
+
+  for (HttpSession *session : {&dataApiSession, &timeApiSession})
+  {
+    session->addHeader("Accept", "application/msgpack, application/json;q=0.5");
+    session->addHeader("Accept-Encoding", "gzip");
+  }
+  // No gzip from USGS: its 32 KB deflate window is larger than InflateStream's.
+  usgsApiSession.addHeader("Accept", "application/json");
+  usgsApiSession.setCACert(usgsRootCA);
+
+  // WiFi connects in the background (see ServiceWifi()).
+  WiFi.persistent(false);
+  WiFi.setAutoReconnect(false);
+  WiFi.mode(WIFI_STA);
+  statusServer.on("/status", "application/json", ServeStatus);
+  statusServer.on("/metrics", "text/plain; version=0.0.4", ServeMetrics);
+  statusServer.on("/flightlog", "text/plain", ServeFlightLog);
+  statusServer.begin();
+  LoadWifiCache();
+  SetWifiState(WifiState::FastConnect);
+  ServiceWifi();
+
+  recorder.watch(watchdogTimeout);
 }
 
 void loop(void)
 {
-  static msTimer timerTime(0);
   static msTimer timerApi(0);
+  static msTimer timerUsgs(0);
+
+  static msTimer timerSnapshot(5000);
+  static msTimer timerHistoryFlush(timeBetweenHistoryFlush);
+  static msTimer timerSDCard(timeBetweenSDCardChecks);
+  static msTimer timerPowerReport(timeBetweenPowerReports);
+
+  recorder.feed();
 
+  recorder.stage(StageButtons);
   CheckButtons();
 
+  recorder.stage(StageWifi);
+  ServiceWifi();
+
+  recorder.stage(StageLeds);
   UpdateIndicators();
 
   UpdateLocationIndicators();
 
+  if (timerSnapshot.elapsed())
+  {
+    recorder.stage(StageSnapshot);
+    SaveSnapshotToSDCard();
+  }
+
+  if (timerHistoryFlush.elapsed())
+  {
+    recorder.stage(StageHistory);
+    FlushHistory();
+  }
+
+  if (timerSDCard.elapsed())
+  {
+    recorder.stage(StageSDCard);
+    CheckSDCard();
+
+    if (sdStatus)
+    {
+      recorder.stage(StageConfig);
+      CheckConfigFiles();
+    }
+  }
+
+  recorder.stage(StageStore);
+  store.flush();
+
+  if (timerPowerReport.elapsed())
+  {
+    LOG_I("Power: %.1f%% active, %.1f%% idle, %.1f%% light sleep, radio on %.1f%%, %u wake ups, ~%.1f mAh.", power.percent(PowerActive), power.percent(PowerIdle), power.percent(PowerSleep), power.radioPercent(), (unsigned int)power.wakeups(), power.milliampHours());
+  }
+
+  recorder.stage(StageDisplay);
+
   // Screen display timeout.
   static int OldDisplayScreen;
   static msTimer timerDelayScreen(6000);
@@ -925,7 +3493,7 @@ void loop(void)
   {
     OldDisplayScreen = displayScreen;
     timerDelayScreen.resetDelay();
-    Serial.printf("Display screen changed to screen: %u.\n", displayScreen);
+    LOG_D("Display screen changed to screen: %u.", displayScreen);
     UpdateDisplay();
   }
 
@@ -940,7 +3508,7 @@ void loop(void)
   static int oldSelectedLoctionIndex = 99;
   if (timerUpdateScreen.elapsed())
   {
-    if (displayScreen == 2)
+    if (displayScreen == screenDiagnostics || displayScreen == screenFlightLog)
     {
       timerUpdateScreen.setDelay(500);
     }
@@ -956,6 +3524,12 @@ void loop(void)
     UpdateDisplay();
   }
 
+  // Status changes show on the overview as they are scored.
+  if (displayScreen == screenOverview)
+  {
+    DrawOverview(false);
+  }
+
   
   // Fetch data from API(s).
   if (WiFi.status() == WL_CONNECTED)
@@ -964,25 +3538,131 @@ void loop(void)
 
     if (timerTime.elapsed())
     {
+      recorder.stage(StageTimeApi);
       timerTime.setDelay(timeBetweenApiCalls);
       timeApiStatus = UpdateTime();
+      timeApiFailures += !timeApiStatus;
+
+      if (!timeApiStatus)
+      {
+        recorder.event(EventTimeApiFailed);
+      }
     }
 
     if (timerApi.elapsed())
     {
+      recorder.stage(StageDataApi);
       timerApi.setDelay(timeBetweenApiCalls);
-      dataApiStatus = GetDataFromAPI(apiLoctionIndex);
 
-      if (++apiLoctionIndex > numLocations - 1)
+      // The slot of a station fetched by a peer or from USGS only
+      // announces this device.
+      if (usgsDirect && IsUsgsStation(apiStationIndex))
+      {
+        if (peerSharing)
+        {
+          peers.hello();
+        }
+      }
+      else if (IsStationFetchedByPeer(apiStationIndex))
+      {
+        LOG_D("Station %s is fetched by a peer.", stations[apiStationIndex].id.c_str());
+        peers.hello();
+      }
+      else
+      {
+        dataApiStatus = GetDataFromAPI(apiStationIndex);
+        dataApiFailures += !dataApiStatus;
+
+        if (!dataApiStatus)
+        {
+          recorder.event(EventDataApiFailed);
+        }
+
+        if (peerSharing && dataApiStatus)
+        {
+          ShareStation(apiStationIndex);
+        }
+        else if (peerSharing)
+        {
+          peers.hello();
+        }
+      }
+
+      if (++apiStationIndex > numStations - 1)
+      {
+        apiStationIndex = 0;
+      }
+    }
+
+    if (usgsDirect && timerUsgs.elapsed())
+    {
+      recorder.stage(StageUsgsApi);
+      bool usgsApiStatus = GetUsgsDataFromAPI();
+      usgsApiFailures += !usgsApiStatus;
+
+      // A failed request is retried with the next station slot.
+      timerUsgs.setDelay(usgsApiStatus ? timeBetweenUsgsCalls : timeBetweenApiCalls);
+
+      if (!usgsApiStatus)
       {
-        apiLoctionIndex = 0;
+        recorder.event(EventUsgsApiFailed);
       }
     }
   }
-  else
+  else if (wifiState != WifiState::Off)
   {
-    wifiStatus = true;
+    wifiStatus = false;
     dataApiStatus = false;
     timeApiStatus = false;
   }
+
+  recorder.stage(StagePeers);
+  PeerRecord shared;
+  while (peerSharing && peers.read(shared))
+  {
+    ApplyPeerRecord(shared);
+  }
+
+  // Power save: the radio is off until shortly before the next fetch,
+  // it stays on for peer sharing.
+  unsigned long nextFetch = min(timerTime.remaining(), timerApi.remaining());
+  if (usgsDirect)
+  {
+    nextFetch = min(nextFetch, timerUsgs.remaining());
+  }
+  if (powerSave && !peerSharing && wifiState == WifiState::Connected && nextFetch > radioOffGap)
+  {
+    LOG_D("Radio off for %lums.", nextFetch - radioResumeLead);
+    WiFi.disconnect(true);
+    wifiResumeMillis = millis() + nextFetch - radioResumeLead;
+    SetWifiState(WifiState::Off);
+  }
+  power.setRadio(wifiState != WifiState::Off);
+
+  // Idle until the next timer expires or a button edge. Connecting and
+  // held buttons are polled. Spans, not millis() values, are compared as
+  // millis() wraps after 49 days.
+  unsigned long span = msTimer::takeRemaining();
+  bool busy = wifiState == WifiState::FastConnect || wifiState == WifiState::Scanning || wifiState == WifiState::Connecting;
+
+  for (int i = 0; i < (int)sizeof(buttonPins); i++)
+  {
+    busy = busy || buttons.isPressed(i);
+  }
+
+  if (busy)
+  {
+    span = min(span, busyPollInterval);
+  }
+  else if (wifiState == WifiState::Backoff)
+  {
+    span = min(span, MillisUntil(wifiStateMillis + wifiBackoff + 1));
+  }
+  else if (wifiState == WifiState::Off)
+  {
+    span = min(span, MillisUntil(wifiResumeMillis));
+  }
+
+  recorder.stage(StageIdle);
+  power.idle(span);
 }
\ No newline at end of file
@@ -1,26 +1,58 @@
 #include <Arduino.h>
+#include <TimeLib.h>
 
 
-unsigned long GetEpochFromISO8601(String time)
+// Parses an ISO8601 date/time ("2021-05-01T08:15:00.000-04:00", offset
+// as +hh:mm, +hhmm or Z) to a UTC epoch, without an offset the time is
+// taken as UTC. Returns 0 when the date/time fields are missing.
+unsigned long GetEpochFromISO8601(const char *time)
 {
-  int year = time.substring(0, 4).toInt();
-  int month = time.substring(5, 7).toInt();
-  int day = time.substring(8, 10).toInt();
-  int hour = time.substring(11, 13).toInt();
-  int min = time.substring(14, 16).toInt();
-  int sec = time.substring(17, 19).toInt();
-  setTime(hour, min, sec, day, month, year);
-  return now();
+  int year, month, day, hour, min, sec;
+  int length = 0;
+
+  if (sscanf(time, "%4d-%2d-%2dT%2d:%2d:%2d%n", &year, &month, &day, &hour, &min, &sec, &length) != 6 || year < 1970)
+  {
+    return 0;
+  }
+
+  tmElements_t elements;
+  elements.Year = year - 1970;
+  elements.Month = month;
+  elements.Day = day;
+  elements.Hour = hour;
+  elements.Minute = min;
+  elements.Second = sec;
+  long epoch = makeTime(elements);
+
+  const char *zone = time + length;
+  if (*zone == '.')
+  {
+    do
+    {
+      zone++;
+    } while (isdigit((unsigned char)*zone));
+  }
+
+  int offsetHours, offsetMinutes;
+  if ((*zone == '+' || *zone == '-') &&
+      (sscanf(zone + 1, "%2d:%2d", &offsetHours, &offsetMinutes) == 2 || sscanf(zone + 1, "%2d%2d", &offsetHours, &offsetMinutes) == 2))
+  {
+    long offset = offsetHours * 3600L + offsetMinutes * 60L;
+    epoch += *zone == '-' ? offset : -offset;
+  }
+
+  return epoch;
 }
 
 // Compares two ISO8601 formatted date/time strings and returns true if date/times are within N days.
 bool AreDateTimesWithinNDays(String time1, String time2, int days)
 {
-  unsigned long epoch1 = GetEpochFromISO8601(time1);
-  unsigned long epoch2 = GetEpochFromISO8601(time2);
-  unsigned long daysInMS = 60 * 60 * 24 * days;
+  unsigned long epoch1 = GetEpochFromISO8601(time1.c_str());
+  unsigned long epoch2 = GetEpochFromISO8601(time2.c_str());
+  long difference = (long)epoch1 - (long)epoch2;
+  long daysInMS = 60L * 60 * 24 * days;
 
-  if (abs(epoch1 - epoch2) <= daysInMS)
+  if (labs(difference) <= daysInMS)
   {  
     return true;
   }
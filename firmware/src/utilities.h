@@ -1,2 +1,2 @@
-unsigned long GetEpochFromISO8601(String time);
+unsigned long GetEpochFromISO8601(const char *time);
 bool AreDateTimesWithinNDays(String time1, String time2, int days);
\ No newline at end of file